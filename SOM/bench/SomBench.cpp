@@ -0,0 +1,683 @@
+//------------------------------------------------------------------------
+//
+//  Name:   SomBench.cpp
+//
+//  Desc:   times the SOM engine across map sizes, input sizes and thread
+//          counts and prints one record per measurement, as CSV or as
+//          JSON lines, for comparing builds and machines.
+//
+//          bmu          one FindBestMatchingNode call per sample
+//          epoch        one online Epoch per sample, averaged over the
+//                       start of a schedule where the neighbourhood is
+//                       widest
+//          fixed_bmu    the same two with a CEegSomF, the float map with
+//          fixed_epoch  its sizes fixed at compile time, for maps of the
+//                       demo's grid size and EEG band count. Its size
+//                       next to the CSom's goes to stderr
+//          batch_epoch  one BatchEpoch over the training set, per vector
+//          train        a whole online training run, per iteration
+//          train_c2f    the same run coarse to fine, from a map of about
+//                       8 x 8 nodes up
+//          project      Project over the training set, per vector
+//          project_f32  the same with a CQuantizedCodebook of floats,
+//          project_f16  halves and bytes. How far their results are from
+//          project_i8   the double map's goes to stderr
+//          index_exact  one CBmuIndex lookup per sample in the trained
+//          index_approx map, exact and giving up after ApproxLeaves
+//                       leaves. How often each finds the true BMU goes
+//                       to stderr
+//
+//          a build with SOM_TELEMETRY also reports how the train run's
+//          time split between the BMU search and the update, on stderr
+//
+//          --gemm-min-dim sets CSom::SetGemmMinDim, to time the batched
+//          matrix product search against the exact one
+//
+//  Usage:  SomBench [--quick] [--json] [--sizes 10,50,100]
+//                   [--dims 3,8,32] [--threads 1,2,4] [--iterations n]
+//                   [--min-time seconds] [--max-mb n] [--gemm-min-dim n]
+//
+//------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <string>
+#include <algorithm>
+
+using namespace std;
+
+#include "CSom.h"
+#include "CFixedSom.h"
+#include "CQuantizedCodebook.h"
+#include "CBmuIndex.h"
+#include "CThreadPool.h"
+#include "BmuSearch.h"
+#include "utils.h"
+
+
+//how many vectors the random training set holds
+static const int NumSamples = 1024;
+
+//leaves the approximate index search looks in
+static const int ApproxLeaves = 8;
+
+
+struct SOptions
+{
+	vector<int> vSizes;			//maps are vSizes[i] x vSizes[i] nodes
+	vector<int> vDims;			//weights per node
+	vector<int> vThreads;		//thread counts, 1 runs without a pool
+	int iIterations;			//length of the training schedule
+	double dMinTime;			//each measurement runs for at least this long
+	double dMaxMB;				//maps with a bigger codebook are skipped
+	int iGemmMinDim;			//see CSom::SetGemmMinDim
+	bool bJson;
+};
+
+
+//a measurement, as printed
+struct SResult
+{
+	const char* szBenchmark;
+	int iSize;
+	int iDim;
+	int iThreads;
+	long long iSamples;
+	double dSeconds;
+};
+
+
+static double Now()
+{
+	return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//parses a comma separated list of positive integers
+static vector<int> ParseList(const char* szList)
+{
+	vector<int> values;
+
+	for (const char* p = szList; *p; )
+	{
+		int value = atoi(p);
+
+		if (value > 0) values.push_back(value);
+
+		p = strchr(p, ',');
+
+		if (!p) break;
+
+		++p;
+	}
+
+	return values;
+}
+
+static void PrintHeader(const SOptions &options)
+{
+	if (!options.bJson)
+	{
+		printf("benchmark,rows,cols,dim,threads,isa,samples,ns_per_sample,total_ms\n");
+	}
+}
+
+static void Print(const SOptions &options, const SResult &result)
+{
+	const double NsPerSample = result.dSeconds * 1e9 / max(1LL, result.iSamples);
+
+	if (options.bJson)
+	{
+		printf("{\"benchmark\":\"%s\",\"rows\":%d,\"cols\":%d,\"dim\":%d,\"threads\":%d,"
+		       "\"isa\":\"%s\",\"samples\":%lld,\"ns_per_sample\":%.1f,\"total_ms\":%.3f}\n",
+		       result.szBenchmark, result.iSize, result.iSize, result.iDim, result.iThreads,
+		       GetBmuIsaName(GetBmuIsa()), result.iSamples, NsPerSample, result.dSeconds * 1e3);
+	}
+
+	else
+	{
+		printf("%s,%d,%d,%d,%d,%s,%lld,%.1f,%.3f\n",
+		       result.szBenchmark, result.iSize, result.iSize, result.iDim, result.iThreads,
+		       GetBmuIsaName(GetBmuIsa()), result.iSamples, NsPerSample, result.dSeconds * 1e3);
+	}
+
+	fflush(stdout);
+}
+
+//a size x size map to time. The sweep goes up to maps that may not fit
+//in memory, and there is no point timing on without one
+static void CreateMap(CSom &som, int size, int dim, const SOptions &options)
+{
+	if (!som.Create(size, size, size, size, options.iIterations, dim))
+	{
+		fprintf(stderr, "not enough memory for a %dx%d map of %d weights\n", size, size, dim);
+
+		exit(1);
+	}
+}
+
+//------------------------------ Benchmarks ------------------------------
+//
+//  each one returns the number of samples it timed and the time they took
+//------------------------------------------------------------------------
+static void BenchBmu(CSom &som, const vector<vector<double> > &data, double MinTime, SResult &result)
+{
+	long long samples = 0;
+
+	double start = Now(), elapsed = 0;
+
+	volatile int sink = 0;
+
+	do
+	{
+		for (int i=0; i<64; ++i)
+		{
+			sink += som.FindBestMatchingNode(data[(samples + i) % data.size()]);
+		}
+
+		samples += 64;
+
+		elapsed = Now() - start;
+	}
+	while (elapsed < MinTime);
+
+	result.iSamples = samples;
+	result.dSeconds = elapsed;
+}
+
+static void BenchEpoch(CSom &som, const vector<vector<double> > &data, int size, int dim,
+                       const SOptions &options, SResult &result)
+{
+	CreateMap(som, size, dim, options);
+
+	long long samples = 0;
+
+	double elapsed = 0;
+
+	//only the first tenth of the schedule is timed, the part where the
+	//neighbourhood still covers most of the map
+	const int budget = max(1, options.iIterations / 10);
+
+	int used = 0;
+
+	while (elapsed < options.dMinTime)
+	{
+		if (used == budget)
+		{
+			CreateMap(som, size, dim, options);
+
+			used = 0;
+		}
+
+		double start = Now();
+
+		int run = min(8, budget - used);
+
+		for (int i=0; i<run; ++i)
+		{
+			som.Epoch(data);
+		}
+
+		elapsed += Now() - start;
+
+		samples += run;
+		used    += run;
+	}
+
+	result.iSamples = samples;
+	result.dSeconds = elapsed;
+}
+
+static void BenchFixedBmu(const CEegSomF &som, const vector<float> &data, double MinTime, SResult &result)
+{
+	long long samples = 0;
+
+	double start = Now(), elapsed = 0;
+
+	volatile int sink = 0;
+
+	do
+	{
+		for (int i=0; i<64; ++i)
+		{
+			sink += som.FindBestMatchingNode(&data[((samples + i) % NumSamples) * constNumEegBands]);
+		}
+
+		samples += 64;
+
+		elapsed = Now() - start;
+	}
+	while (elapsed < MinTime);
+
+	result.iSamples = samples;
+	result.dSeconds = elapsed;
+}
+
+//times the same part of the schedule as BenchEpoch
+static void BenchFixedEpoch(CEegSomF &som, const vector<float> &data, const SOptions &options, SResult &result)
+{
+	long long samples = 0;
+
+	double elapsed = 0;
+
+	const int budget = max(1, options.iIterations / 10);
+
+	int used = budget;
+
+	while (elapsed < options.dMinTime)
+	{
+		if (used == budget)
+		{
+			if (!som.Create(options.iIterations))
+			{
+				fprintf(stderr, "not enough memory for the fixed map\n");
+
+				exit(1);
+			}
+
+			used = 0;
+		}
+
+		double start = Now();
+
+		int run = min(8, budget - used);
+
+		for (int i=0; i<run; ++i)
+		{
+			som.Epoch(&data[0], NumSamples);
+		}
+
+		elapsed += Now() - start;
+
+		samples += run;
+		used    += run;
+	}
+
+	result.iSamples = samples;
+	result.dSeconds = elapsed;
+}
+
+static void BenchBatchEpoch(CSom &som, const vector<vector<double> > &data, int size, int dim,
+                            const SOptions &options, SResult &result)
+{
+	CreateMap(som, size, dim, options);
+
+	long long samples = 0;
+
+	double elapsed = 0;
+
+	do
+	{
+		//a finished map would return straight away
+		if (som.FinishedTraining())
+		{
+			CreateMap(som, size, dim, options);
+		}
+
+		double start = Now();
+
+		som.BatchEpoch(data);
+
+		elapsed += Now() - start;
+
+		samples += data.size();
+	}
+	while (elapsed < options.dMinTime);
+
+	result.iSamples = samples;
+	result.dSeconds = elapsed;
+}
+
+static void BenchTrain(CSom &som, const vector<vector<double> > &data, int size, int dim,
+                       const SOptions &options, SResult &result)
+{
+	double start = Now();
+
+	CreateMap(som, size, dim, options);
+
+	while (!som.FinishedTraining())
+	{
+		som.Epoch(data);
+	}
+
+	result.iSamples = options.iIterations;
+	result.dSeconds = Now() - start;
+}
+
+static void BenchTrainCoarseToFine(CSom &som, const vector<vector<double> > &data, int size, int dim,
+                                   const SOptions &options, SResult &result)
+{
+	//halve the map while it stays at 8 x 8 or more
+	int levels = 1;
+
+	while ((size >> levels) >= 8) ++levels;
+
+	double start = Now();
+
+	if (!som.CreateCoarseToFine(size, size, size, size, options.iIterations, levels, dim))
+	{
+		fprintf(stderr, "not enough memory for a %dx%d map of %d weights\n", size, size, dim);
+
+		exit(1);
+	}
+
+	while (!som.FinishedTraining())
+	{
+		som.Epoch(data);
+	}
+
+	result.iSamples = options.iIterations;
+	result.dSeconds = Now() - start;
+}
+
+static void BenchProject(CSom &som, const vector<float> &data, int dim, double MinTime, SResult &result)
+{
+	const size_t NumVectors = data.size() / dim;
+
+	vector<uint32_t> bmu(NumVectors);
+	vector<float> dist(NumVectors);
+
+	long long samples = 0;
+
+	double start = Now(), elapsed = 0;
+
+	do
+	{
+		som.Project(&data[0], NumVectors, &bmu[0], &dist[0]);
+
+		samples += NumVectors;
+
+		elapsed = Now() - start;
+	}
+	while (elapsed < MinTime);
+
+	result.iSamples = samples;
+	result.dSeconds = elapsed;
+}
+
+static void BenchIndex(const CBmuIndex &index, const vector<vector<double> > &data, double MinTime, SResult &result)
+{
+	long long samples = 0;
+
+	double start = Now(), elapsed = 0;
+
+	volatile int sink = 0;
+
+	do
+	{
+		for (int i=0; i<64; ++i)
+		{
+			sink += index.FindBestMatchingNode(data[(samples + i) % data.size()]);
+		}
+
+		samples += 64;
+
+		elapsed = Now() - start;
+	}
+	while (elapsed < MinTime);
+
+	result.iSamples = samples;
+	result.dSeconds = elapsed;
+}
+
+static void BenchProjectReduced(CQuantizedCodebook &codebook, const vector<float> &data, int dim,
+                                CThreadPool* pPool, double MinTime, SResult &result)
+{
+	const size_t NumVectors = data.size() / dim;
+
+	vector<uint32_t> bmu(NumVectors);
+	vector<float> dist(NumVectors);
+
+	long long samples = 0;
+
+	double start = Now(), elapsed = 0;
+
+	do
+	{
+		codebook.Project(&data[0], NumVectors, &bmu[0], &dist[0], pPool);
+
+		samples += NumVectors;
+
+		elapsed = Now() - start;
+	}
+	while (elapsed < MinTime);
+
+	result.iSamples = samples;
+	result.dSeconds = elapsed;
+}
+
+//-------------------------------- main ----------------------------------
+//
+//------------------------------------------------------------------------
+int main(int argc, char* argv[])
+{
+	SOptions options;
+
+	options.vSizes      = ParseList("10,40,50,100,250,500");
+	options.vDims       = ParseList("3,8,32,64,256");
+	options.iIterations = constNumIterations;
+	options.dMinTime    = 0.25;
+	options.dMaxMB      = 1024;
+	options.iGemmMinDim = constGemmMinDim;
+	options.bJson       = false;
+
+	//1, the machine's thread count and the powers of two in between
+	const int HardwareThreads = max(1, (int)thread::hardware_concurrency());
+
+	for (int t=1; t<HardwareThreads; t*=2)
+	{
+		options.vThreads.push_back(t);
+	}
+
+	options.vThreads.push_back(HardwareThreads);
+
+	for (int i=1; i<argc; ++i)
+	{
+		const char* arg  = argv[i];
+		const char* next = i + 1 < argc ? argv[i + 1] : "";
+
+		if      (!strcmp(arg, "--json"))       { options.bJson = true; }
+		else if (!strcmp(arg, "--quick"))
+		{
+			options.vSizes      = ParseList("10,40");
+			options.vDims       = ParseList("3,8");
+			options.iIterations = 200;
+			options.dMinTime    = 0.02;
+		}
+		else if (!strcmp(arg, "--sizes"))      { options.vSizes      = ParseList(next); ++i; }
+		else if (!strcmp(arg, "--dims"))       { options.vDims       = ParseList(next); ++i; }
+		else if (!strcmp(arg, "--threads"))    { options.vThreads    = ParseList(next); ++i; }
+		else if (!strcmp(arg, "--iterations")) { options.iIterations = max(2, atoi(next)); ++i; }
+		else if (!strcmp(arg, "--min-time"))   { options.dMinTime    = atof(next); ++i; }
+		else if (!strcmp(arg, "--max-mb"))     { options.dMaxMB      = atof(next); ++i; }
+		else if (!strcmp(arg, "--gemm-min-dim")) { options.iGemmMinDim = atoi(next); ++i; }
+		else
+		{
+			fprintf(stderr, "usage: %s [--quick] [--json] [--sizes 10,50] [--dims 3,8] "
+			                "[--threads 1,2] [--iterations n] [--min-time s] [--max-mb n] [--gemm-min-dim n]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	PrintHeader(options);
+
+	SeedRandom(1);
+
+	CSom som;
+
+	som.SetGemmMinDim(options.iGemmMinDim);
+
+	for (size_t d=0; d<options.vDims.size(); ++d)
+	{
+		const int dim = options.vDims[d];
+
+		vector<vector<double> > data(NumSamples, vector<double>(dim));
+
+		//the same vectors as floats, one after the other, for Project
+		vector<float> packed;
+
+		for (int s=0; s<NumSamples; ++s)
+		{
+			for (int w=0; w<dim; ++w)
+			{
+				data[s][w] = RandFloat();
+
+				packed.push_back((float)data[s][w]);
+			}
+		}
+
+		for (size_t m=0; m<options.vSizes.size(); ++m)
+		{
+			const int size = options.vSizes[m];
+
+			const double MB = (double)size * size * CCodebook::StrideFor(dim) * sizeof(double) / (1 << 20);
+
+			if (MB > options.dMaxMB)
+			{
+				fprintf(stderr, "skipping %dx%d with %d weights, %.0f MB is over --max-mb\n", size, size, dim, MB);
+				continue;
+			}
+
+			for (size_t t=0; t<options.vThreads.size(); ++t)
+			{
+				const int threads = options.vThreads[t];
+
+				CThreadPool* pPool = threads > 1 ? new CThreadPool(threads) : NULL;
+
+				som.SetThreadPool(pPool);
+
+				SResult result = { "", size, dim, threads, 0, 0 };
+
+				CreateMap(som, size, dim, options);
+
+				result.szBenchmark = "bmu";
+				BenchBmu(som, data, options.dMinTime, result);
+				Print(options, result);
+
+				result.szBenchmark = "epoch";
+				BenchEpoch(som, data, size, dim, options, result);
+				Print(options, result);
+
+				//the compile time map only comes in one shape, and runs on
+				//one thread
+				if (dim == constNumEegBands && size == constNumCellsAcross &&
+				    size == constNumCellsDown && threads == 1)
+				{
+					CEegSomF fixed;
+
+					if (!fixed.Create(options.iIterations))
+					{
+						fprintf(stderr, "not enough memory for the fixed map\n");
+
+						return 1;
+					}
+
+					result.szBenchmark = "fixed_bmu";
+					BenchFixedBmu(fixed, packed, options.dMinTime, result);
+					Print(options, result);
+
+					result.szBenchmark = "fixed_epoch";
+					BenchFixedEpoch(fixed, packed, options, result);
+					Print(options, result);
+
+					fprintf(stderr, "fixed %dx%d, %d weights: %.0f%% of the size of the CSom's\n",
+					        size, size, dim,
+					        100.0 * CEegSomF::NumNodes * CEegSomF::NumWeights * sizeof(float) /
+					        ((double)som.GetCodebook().GetNumNodes() * som.GetCodebook().GetStride() * sizeof(double)));
+				}
+
+				result.szBenchmark = "batch_epoch";
+				BenchBatchEpoch(som, data, size, dim, options, result);
+				Print(options, result);
+
+				result.szBenchmark = "train";
+				BenchTrain(som, data, size, dim, options, result);
+				Print(options, result);
+
+				//where the run's time went, if the library keeps count
+				SSomTelemetry telemetry;
+
+				if (som.GetTelemetry(telemetry))
+				{
+					fprintf(stderr, "train %dx%d, %d weights, %d threads: %.0f%% searching, %.0f%% updating, "
+					                "%.1f nodes moved per epoch\n",
+					        size, size, dim, threads,
+					        100 * telemetry.dSearchSeconds / result.dSeconds,
+					        100 * telemetry.dUpdateSeconds / result.dSeconds,
+					        (double)telemetry.iNodesTouched / max((uint64_t)1, telemetry.iEpochs));
+				}
+
+				result.szBenchmark = "train_c2f";
+				BenchTrainCoarseToFine(som, data, size, dim, options, result);
+				Print(options, result);
+
+				result.szBenchmark = "project";
+				BenchProject(som, packed, dim, options.dMinTime, result);
+				Print(options, result);
+
+				//reduced precision copies of the trained map
+				static const SomScalar Scalars[] = { SOM_SCALAR_FLOAT32, SOM_SCALAR_FLOAT16, SOM_SCALAR_INT8 };
+				static const char* Names[] = { "project_f32", "project_f16", "project_i8" };
+
+				for (int q=0; q<3; ++q)
+				{
+					CQuantizedCodebook reduced;
+
+					if (!reduced.Build(som.GetCodebook(), Scalars[q]))
+					{
+						fprintf(stderr, "not enough memory for a %s copy of the map\n", Names[q]);
+
+						continue;
+					}
+
+					result.szBenchmark = Names[q];
+					BenchProjectReduced(reduced, packed, dim, pPool, options.dMinTime, result);
+					Print(options, result);
+
+					SQuantizedAccuracy accuracy = reduced.MeasureAccuracy(som.GetCodebook(), &packed[0], NumSamples, pPool);
+
+					fprintf(stderr, "%s %dx%d, %d weights: %.0f%% of the size, same BMU for %.2f%%, "
+					                "quantization error %.6f against %.6f\n",
+					        Names[q], size, size, dim,
+					        100.0 * reduced.GetBytes() / ((double)som.GetCodebook().GetNumNodes() * som.GetCodebook().GetStride() * sizeof(double)),
+					        100 * accuracy.dBmuAgreement, accuracy.dQE, accuracy.dReferenceQE);
+				}
+
+				//the index is searched on the calling thread only
+				CBmuIndex index;
+
+				if (threads == 1 && !index.Build(som.GetCodebook()))
+				{
+					fprintf(stderr, "not enough memory for an index of the map\n");
+				}
+
+				else if (threads == 1)
+				{
+					static const int Leaves[] = { 0, ApproxLeaves };
+					static const char* IndexNames[] = { "index_exact", "index_approx" };
+
+					for (int l=0; l<2; ++l)
+					{
+						index.SetMaxLeaves(Leaves[l]);
+
+						result.szBenchmark = IndexNames[l];
+						BenchIndex(index, data, options.dMinTime, result);
+						Print(options, result);
+
+						fprintf(stderr, "%s %dx%d, %d weights: true BMU found for %.2f%%\n",
+						        IndexNames[l], size, size, dim, 100 * index.MeasureRecall(data));
+					}
+				}
+
+				som.SetThreadPool(NULL);
+
+				delete pPool;
+			}
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,165 @@
+#ifndef BMUSEARCH_H_
+#define BMUSEARCH_H_
+
+//------------------------------------------------------------------------
+//
+//  Name:   BmuSearch.h
+//
+//  Desc:   vectorized best matching unit search over a codebook matrix.
+//          The kernel is picked once at runtime from the instruction
+//          sets the CPU supports, with a scalar fallback
+//
+//------------------------------------------------------------------------
+
+#include <stdint.h>
+
+#include "SomFile.h"
+
+
+enum BmuIsa
+{
+	BMU_ISA_SCALAR,
+	BMU_ISA_SSE2,
+	BMU_ISA_AVX2,
+	BMU_ISA_AVX512
+};
+
+/*
+* finds the node in [first, last) whose weights are closest to pInput.
+*
+* pWeights is a codebook matrix whose rows are stride doubles apart and
+* hold dim weights followed by zero padding (see CCodebook). pInput must
+* be padded with zeros the same way. Returns the index of the winner, or
+* -1 for an empty range, and stores its squared distance in *pDistSq.
+*
+* ties go to the node with the lowest index, and the distance of a node
+* doesn't depend on how the range was split, so searching sub-ranges and
+* keeping the lowest (distance, index) pair gives the same winner as one
+* search over the whole map
+*/
+typedef int (*BmuKernel)(
+	const double* pWeights,
+	int stride,
+	int dim,
+	const double* pInput,
+	int first,
+	int last,
+	double* pDistSq
+);
+
+/*
+* works out the squared distance from pInput to every node in
+* [first, last) and stores them in pDistSq[0 .. last - first). Same
+* layout rules as BmuKernel, and each distance comes out exactly as the
+* BMU kernel of the same instruction set computes it
+*/
+typedef void (*DistKernel)(
+	const double* pWeights,
+	int stride,
+	int dim,
+	const double* pInput,
+	int first,
+	int last,
+	double* pDistSq
+);
+
+/*
+* works out the dot product of each of NumInputs input vectors with every
+* node in [first, last). The inputs are laid out like the codebook rows,
+* stride doubles apart and zero padded, and the products of input i go
+* to pDot[i * (last - first) .. (i + 1) * (last - first)).
+*
+* this is the matrix product behind the batched distance
+* |x - w|^2 = |x|^2 - 2 x.w + |w|^2, worked out a register tile of inputs
+* by nodes at a time. Each product is reduced in a fixed order, so it
+* doesn't depend on how the inputs or the nodes were split up
+*/
+typedef void (*DotKernel)(
+	const double* pWeights,
+	int stride,
+	int dim,
+	const double* pInputs,
+	int NumInputs,
+	int first,
+	int last,
+	double* pDot
+);
+
+/*
+* the BMU search over a codebook stored at reduced precision (see
+* CQuantizedCodebook), with the input and the distances in floats.
+*
+* pWeights holds rows of stride elements of the kernel's SomScalar type,
+* zero padded past dim; stride is 8 for up to 8 weights and a multiple
+* of 16 otherwise. For SOM_SCALAR_INT8 the weights of node n are its
+* bytes times pScales[n], for the other types pScales isn't used.
+* pInput is padded with zeros to the stride. Same return value, tie
+* breaking and range independence as BmuKernel
+*/
+typedef int (*ReducedBmuKernel)(
+	const void* pWeights,
+	int stride,
+	int dim,
+	const float* pScales,
+	const float* pInput,
+	int first,
+	int last,
+	float* pDistSq
+);
+
+/*
+* the best instruction set this CPU (and OS) supports
+*/
+BmuIsa DetectBmuIsa();
+
+/*
+* the kernel currently used by GetBmuKernel(). Defaults to DetectBmuIsa()
+*/
+BmuIsa GetBmuIsa();
+
+/*
+* forces a particular kernel, e.g. to compare them in a benchmark.
+* Returns false (and changes nothing) if the CPU doesn't support it
+*/
+bool SetBmuIsa(BmuIsa isa);
+
+/*
+* returns the active kernel
+*/
+BmuKernel GetBmuKernel();
+
+/*
+* returns the distance kernel for the active instruction set
+*/
+DistKernel GetDistKernel();
+
+/*
+* returns the dot product kernel for the active instruction set
+*/
+DotKernel GetDotKernel();
+
+/*
+* returns the reduced precision kernel for weights of type scalar
+* (SOM_SCALAR_FLOAT32, SOM_SCALAR_FLOAT16 or SOM_SCALAR_INT8) for the
+* active instruction set. The SSE2 level uses the scalar kernels
+*/
+ReducedBmuKernel GetReducedBmuKernel(SomScalar scalar);
+
+/*
+* conversions between floats and IEEE half precision, rounding to
+* nearest even. Values too big for a half become infinite
+*/
+uint16_t FloatToHalf(float value);
+float HalfToFloat(uint16_t half);
+
+/*
+* the size in bytes of one weight stored as scalar
+*/
+inline int ScalarBytes(int scalar)
+{
+	return scalar == SOM_SCALAR_FLOAT32 ? 4 : scalar == SOM_SCALAR_FLOAT16 ? 2 : 1;
+}
+
+const char* GetBmuIsaName(BmuIsa isa);
+
+#endif
@@ -0,0 +1,124 @@
+#ifndef CBMUINDEX_H_
+#define CBMUINDEX_H_
+
+//------------------------------------------------------------------------
+//
+//  Name:   CBmuIndex.h
+//
+//  Desc:   a k-d tree over the weights of a trained map, for finding
+//          best matching units without scanning every node. It is built
+//          from a frozen codebook, so rebuild it if the map is trained
+//          any further
+//
+//------------------------------------------------------------------------
+
+#include <vector>
+
+using namespace std;
+
+#include "CCodebook.h"
+
+
+class CBmuIndex
+{
+
+private:
+
+	struct SKdNode
+	{
+		int iSplitDim;		//the weight the node splits on, -1 for a leaf
+		double dSplit;		//nodes with a smaller weight go left
+		int iLeft;			//children, for an inner node
+		int iRight;
+		int iFirst;			//the codebook rows in this subtree
+		int iLast;
+	};
+
+	vector<SKdNode> m_Tree;
+	double* m_pWeights;			//copy of the codebook with the rows in leaf order
+	vector<int> m_vNodeId;		//original index of each row of m_pWeights
+	int m_iNumNodes;
+	int m_iDim;
+	int m_iStride;
+	int m_iMaxLeaves;			//leaves searched per query, 0 for an exact search
+
+	CBmuIndex(const CBmuIndex&);
+	CBmuIndex& operator=(const CBmuIndex&);
+
+	int BuildNode(const double* pWeights, int first, int last, int LeafSize);
+
+	int Search(const double* pInput, int MaxLeaves, double* pDistSq) const;
+
+
+public:
+
+	CBmuIndex():
+		m_pWeights(NULL),
+		m_iNumNodes(0),
+		m_iDim(0),
+		m_iStride(0),
+		m_iMaxLeaves(0)
+	{}
+
+	~CBmuIndex();
+
+	/*
+	* builds the tree over a codebook. Leaves hold up to LeafSize nodes,
+	* which are scanned with the BMU kernel. Returns false, leaving the
+	* index empty, if its copy of the weights can't be allocated
+	*/
+	bool Build(const CCodebook &codebook, int LeafSize = 32);
+
+	/*
+	* same, for a weight matrix laid out like a CCodebook's
+	*/
+	bool Build(
+		const double* pWeights,
+		int NumNodes,
+		int dim,
+		int stride,
+		int LeafSize = 32
+	);
+
+	/*
+	* switches between an exact search (0, the default) and an
+	* approximate one that gives up after looking in MaxLeaves leaves,
+	* closest first. How often that still finds the true BMU drops fast
+	* with the number of weights. On random 37 x 37 codebooks and random
+	* inputs 2 leaves found it for 94% of the inputs with 3 weights, 68%
+	* with 8, 37% with 17 and 19% with 32, and 32 leaves for 100%, 100%,
+	* 94% and 82%. Bigger maps need more leaves still (47% with 32 leaves
+	* at 100 x 100 and 32 weights). For 32 weights an exact search is the
+	* safe choice; MeasureRecall, and SomBench's index rows, say how a
+	* setting does on a given map
+	*/
+	void SetMaxLeaves(int MaxLeaves) { m_iMaxLeaves = MaxLeaves; }
+
+	int GetMaxLeaves() const { return m_iMaxLeaves; }
+
+	/*
+	* returns the index of the best matching unit for pInput (dim values)
+	* and optionally its squared distance. Safe to call from several
+	* threads at once.
+	*
+	* an exact search returns a node at the smallest distance, but when
+	* several nodes tie it may not be the one with the lowest index
+	*/
+	int FindBestMatchingNode(const double* pInput, double* pDistSq = NULL) const;
+
+	int FindBestMatchingNode(const vector<double> &vecInput, double* pDistSq = NULL) const
+	{
+		return FindBestMatchingNode(&vecInput[0], pDistSq);
+	}
+
+	/*
+	* the fraction of the samples for which the current setting finds a
+	* node as close as the true BMU (always 1 for an exact search)
+	*/
+	double MeasureRecall(const vector<vector<double>> &samples) const;
+
+	int GetNumNodes() const { return m_iNumNodes; }
+
+};
+
+#endif
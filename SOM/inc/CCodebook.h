@@ -0,0 +1,120 @@
+#ifndef CCODEBOOK_H_
+#define CCODEBOOK_H_
+
+#include <vector>
+
+using namespace std;
+
+#include "CNode.h"
+
+
+/*
+* the weights of every node in the map, stored as one contiguous
+* nodes x stride matrix, plus the grid position of each node.
+*
+* every row starts on a 64 byte boundary and is padded with zeros up to
+* the stride, so the distance loops can walk whole rows without tail handling.
+*
+* the matrix is either allocated by Create or borrowed with Attach, in
+* which case the codebook is read only and must not be trained
+*/
+class CCodebook
+{
+
+private:
+
+	double* m_pWeights;					//the nodes x stride weight matrix
+	int m_iNumNodes;					//number of nodes in the map (rows of the matrix)
+	int m_iCellsAcross;					//width of the grid in cells
+	int m_iCellsUp;						//height of the grid in cells
+	int m_iDim;							//number of weights per node (size of the input vector)
+	int m_iStride;						//distance in doubles between two consecutive rows
+	vector<double> m_GridX;				//column of each node on the grid
+	vector<double> m_GridY;				//row of each node on the grid
+	bool m_bOwner;						//false when the matrix was attached rather than allocated
+
+	//the codebook owns its weight matrix so it can't be copied
+	CCodebook(const CCodebook&);
+	CCodebook& operator=(const CCodebook&);
+
+	void SetShape(int CellsUp, int CellsAcross, int dim);
+
+
+public:
+
+	CCodebook():
+		m_pWeights(NULL),
+		m_iNumNodes(0),
+		m_iCellsAcross(0),
+		m_iCellsUp(0),
+		m_iDim(0),
+		m_iStride(0),
+		m_bOwner(false)
+	{}
+
+	~CCodebook() { Release(); }
+
+	/*
+	* allocates a CellsUp x CellsAcross map of nodes with dim weights
+	* each and initializes the weights to small random values, drawn from
+	* pRandom or from the calling thread's generator if it is NULL.
+	* Returns false, leaving the codebook empty, if the weight matrix
+	* can't be allocated
+	*/
+	bool Create(
+		int CellsUp,
+		int CellsAcross,
+		int dim,
+		CRandom* pRandom = NULL
+	);
+
+	/*
+	* uses a CellsUp x CellsAcross matrix laid out as Create would lay it
+	* out (64 byte aligned, rows padded with zeros to StrideFor(dim)) in
+	* place, without copying it. The memory must outlive the codebook
+	*/
+	void Attach(
+		const double* pWeights,
+		int CellsUp,
+		int CellsAcross,
+		int dim
+	);
+
+	/*
+	* frees the weight matrix, or lets go of an attached one
+	*/
+	void Release();
+
+	/*
+	* exchanges the contents of two codebooks
+	*/
+	void Swap(CCodebook &other);
+
+	bool IsReadOnly() const { return m_pWeights && !m_bOwner; }
+
+	/*
+	* returns the padded row length for a given number of weights,
+	* rounded up to a whole number of cache lines
+	*/
+	static int StrideFor(int dim) { return (dim + 7) & ~7; }
+
+	double* GetRow(int n) { return m_pWeights + (size_t)n * m_iStride; }
+	const double* GetRow(int n) const { return m_pWeights + (size_t)n * m_iStride; }
+
+	CNode GetNode(int n) { return CNode(GetRow(n), m_iDim, m_GridX[n], m_GridY[n]); }
+
+	double* GetWeights() { return m_pWeights; }
+	const double* GetWeights() const { return m_pWeights; }
+
+	const double* GetGridX() const { return &m_GridX[0]; }
+	const double* GetGridY() const { return &m_GridY[0]; }
+
+	int GetNumNodes() const { return m_iNumNodes; }
+	int GetCellsAcross() const { return m_iCellsAcross; }
+	int GetCellsUp() const { return m_iCellsUp; }
+	int GetDim() const { return m_iDim; }
+	int GetStride() const { return m_iStride; }
+
+};
+
+#endif
@@ -12,13 +12,16 @@
 //
 //------------------------------------------------------------------------
 
+#ifdef _WIN32
 #include <windows.h>
+#endif
+
 #include <vector>
 
 using namespace std;
 
 #include "CNode.h"
-#include "Csom.h"
+#include "CSom.h"
 #include "constants.h"
 
 
@@ -28,11 +31,14 @@ class CController
 private:
 
   //pointer to a Self Organising Map
-  Csom*                   m_pSOM;
+  CSom*                   m_pSOM;
 
   //the data for the training
   vector<vector<double> > m_TrainingSet;
 
+  //train with the batch algorithm rather than one vector at a time
+  bool                    m_bBatchTraining;
+
 
   //this method creates a small data set of color values
   //that are used to train the network with
@@ -41,10 +47,15 @@ private:
 
 public:
 
-  CController(int cxClient, int cyClient, int CellsUp, int CellsAcross, int NumIterations)
+  CController(int cxClient,
+              int cyClient,
+              int CellsUp,
+              int CellsAcross,
+              int NumIterations,
+              bool BatchTraining = false):m_bBatchTraining(BatchTraining)
   {
     //create the SOM
-    m_pSOM = new Csom();
+    m_pSOM = new CSom();
 
     m_pSOM->Create(cxClient, cyClient, CellsUp, CellsAcross, NumIterations);
 
@@ -57,12 +68,17 @@ public:
     delete m_pSOM;
   }
 
+#ifdef _WIN32
   void Render(HDC surface);
+#endif
 
   bool Train();
 
   bool Finished()const{return m_pSOM->FinishedTraining();}
 
+  //writes the map to disk so it outlives the demo
+  bool Save(const char* path)const{return m_pSOM->Save(path);}
+
 
 
 };
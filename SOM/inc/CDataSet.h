@@ -0,0 +1,132 @@
+#ifndef CDATASET_H_
+#define CDATASET_H_
+
+//------------------------------------------------------------------------
+//
+//  Name:   CDataSet.h
+//
+//  Desc:   a set of training vectors kept in a flat binary file and
+//          mapped into memory rather than read in, so sets bigger than
+//          RAM can be trained on. The OS pages the vectors in as they
+//          are touched; the chunk hints let a pass over the whole set
+//          read ahead of itself and drop what it is done with.
+//
+//          the file is a 64 byte header followed, at a 64 byte aligned
+//          offset, by the vectors as 32 bit floats, one after the other
+//          with no padding. GetData can therefore be handed straight to
+//          CSom::Project and the error measures
+//
+//------------------------------------------------------------------------
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "CFileMapping.h"
+#include "CThreadPool.h"
+
+
+//the first bytes of every data set file
+const char DataSetMagic[8] = { 'N', 'E', 'D', 'U', 'D', 'A', 'T', 0 };
+
+const uint32_t DataSetVersion = 1;
+
+
+struct SDataSetHeader
+{
+	char szMagic[8];
+	uint32_t iVersion;
+	uint32_t iHeaderSize;			//sizeof(SDataSetHeader)
+	uint32_t iByteOrder;			//SomFileByteOrder
+	uint32_t iScalarType;			//SOM_SCALAR_FLOAT32
+	uint32_t iDim;					//values per vector
+	uint32_t iReserved;
+	uint64_t iNumVectors;
+	uint64_t iDataOffset;			//from the start of the file, a multiple of 64
+	uint8_t Reserved[16];			//zero, pads the header to a cache line
+};
+
+static_assert(sizeof(SDataSetHeader) == 64, "the data set header must stay 64 bytes");
+
+
+class CDataSet
+{
+
+private:
+
+	CFileMapping m_Mapping;
+	const float* m_pData;			//the first vector, inside the mapping
+	size_t m_iNumVectors;
+	int m_iDim;
+
+	CDataSet(const CDataSet&);
+	CDataSet& operator=(const CDataSet&);
+
+
+public:
+
+	CDataSet():
+		m_pData(NULL),
+		m_iNumVectors(0),
+		m_iDim(0)
+	{}
+
+	/*
+	* maps the data set file at path. Returns false, leaving the set
+	* empty, if it can't be opened or isn't a data set file
+	*/
+	bool Open(const char* path);
+
+	void Close();
+
+	const float* GetData() const { return m_pData; }
+
+	const float* GetVector(size_t v) const { return m_pData + v * m_iDim; }
+
+	size_t GetNumVectors() const { return m_iNumVectors; }
+
+	int GetDim() const { return m_iDim; }
+
+	/*
+	* how many vectors make up one chunk of a pass over the set, about
+	* 64MB worth
+	*/
+	size_t GetChunkSize() const;
+
+	/*
+	* read ahead / drop hints for the NumVectors vectors from first on,
+	* see CFileMapping
+	*/
+	void WillNeed(size_t first, size_t NumVectors) const;
+	void DontNeed(size_t first, size_t NumVectors) const;
+
+	/*
+	* writes NumVectors vectors of dim values each, stored one after the
+	* other in pData, to a data set file
+	*/
+	static bool Write(
+		const char* path,
+		const float* pData,
+		size_t NumVectors,
+		int dim
+	);
+
+	/*
+	* converts a CSV file, one vector per line with the values separated
+	* by commas, semicolons, tabs or spaces, to a data set file. A first
+	* line that doesn't start with a number is taken for column names and
+	* skipped, as are blank lines. Fails if the lines don't all have the
+	* same number of values.
+	*
+	* the file is mapped and parsed a block at a time, each block split
+	* by lines over the threads of pPool if given, so memory use stays
+	* bounded however big the file is
+	*/
+	static bool ImportCsv(
+		const char* CsvPath,
+		const char* path,
+		CThreadPool* pPool = NULL
+	);
+
+};
+
+#endif
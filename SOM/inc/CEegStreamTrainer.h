@@ -0,0 +1,137 @@
+#ifndef CEEGSTREAMTRAINER_H_
+#define CEEGSTREAMTRAINER_H_
+
+//------------------------------------------------------------------------
+//
+//  Name:   CEegStreamTrainer.h
+//
+//  Desc:   trains a CSom continuously on vectors as they arrive, for
+//          example the band powers coming out of the EEG decoder.
+//
+//          vectors are handed over through a fixed size single producer,
+//          single consumer ring. Push never blocks or allocates, so it
+//          can be called straight from the decoder's reading thread;
+//          when training falls behind and the ring fills up the newest
+//          vectors are dropped and counted.
+//
+//          there is no end to the stream, so instead of the schedule set
+//          up in CSom::Create the radius and learning rate decay from
+//          their start values towards floor values they then keep. The
+//          map therefore never freezes and follows the signal as it
+//          drifts. Restart goes back to the start values, e.g. when a new
+//          user puts the headset on
+//
+//------------------------------------------------------------------------
+
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <stdint.h>
+
+using namespace std;
+
+#include "CSom.h"
+
+
+class CEegStreamTrainer
+{
+
+private:
+
+	CSom* m_pSom;						//the map being trained (not owned)
+	int m_iDim;							//values per vector, the map's number of weights
+	uint32_t m_iMask;					//ring capacity - 1, the capacity is a power of two
+	vector<double> m_vRing;				//capacity slots of m_iDim values
+
+	//the two ends of the ring, on cache lines of their own so the
+	//producer and the consumer don't keep stealing each other's
+	alignas(64) atomic<uint32_t> m_iWrite;	//slots filled so far, written by the producer only
+	alignas(64) atomic<uint32_t> m_iRead;	//slots trained on so far, written by the consumer only
+	alignas(64) atomic<uint64_t> m_iDropped;	//vectors pushed while the ring was full
+
+	atomic<uint64_t> m_iTrained;		//vectors trained on since construction
+	atomic<uint64_t> m_iStep;			//vectors trained on since the last Restart
+
+	double m_dStartRadius;				//the schedule, radius in cells
+	double m_dFloorRadius;
+	double m_dStartRate;
+	double m_dFloorRate;
+	double m_dTimeConstant;				//in vectors
+
+	thread m_Thread;					//runs Train while started
+	atomic<bool> m_bRunning;
+
+	CEegStreamTrainer(const CEegStreamTrainer&);
+	CEegStreamTrainer& operator=(const CEegStreamTrainer&);
+
+	void Run();
+
+
+public:
+
+	/*
+	* trains pSom, which must already be created. The ring holds Capacity
+	* vectors, rounded up to a power of two
+	*/
+	CEegStreamTrainer(CSom* pSom, int Capacity = 64);
+
+	~CEegStreamTrainer() { Stop(); }
+
+	/*
+	* the radius and learning rate of the n'th vector since the last
+	* Restart are floor + (start - floor) * exp(-n / TimeConstant). By
+	* default the radius starts at half the map and settles at 2 cells,
+	* and the learning rate goes from constStartLearningRate to a tenth
+	* of it, over a time constant of 300 vectors (five minutes of band
+	* powers from the headset)
+	*/
+	void SetSchedule(
+		double StartRadius,
+		double FloorRadius,
+		double StartRate,
+		double FloorRate,
+		double TimeConstant
+	);
+
+	/*
+	* starts the schedule over from its start values
+	*/
+	void Restart() { m_iStep.store(0, memory_order_relaxed); }
+
+	/*
+	* queues one vector of GetCodebook().GetDim() values. Producer side,
+	* call it from one thread only. Returns false if the ring was full and
+	* the vector was dropped
+	*/
+	bool Push(const double* pSample);
+
+	/*
+	* queues the eight band powers of one EegData record (delta through
+	* mid gamma, in the order of its fields) scaled logarithmically from
+	* their 24 bit range to [0, 1]. The map must have constNumEegBands
+	* weights
+	*/
+	bool PushBandPowers(const unsigned int* pBands);
+
+	/*
+	* trains on up to MaxSamples queued vectors and returns how many it
+	* took. Consumer side: call it from one thread only, and not while
+	* the trainer is started
+	*/
+	int Train(int MaxSamples = 0x7fffffff);
+
+	/*
+	* starts a thread that keeps training on whatever is queued, and
+	* stops it. While it runs that thread is the only one that may touch
+	* the map
+	*/
+	void Start();
+	void Stop();
+
+	uint64_t GetNumTrained() const { return m_iTrained.load(memory_order_relaxed); }
+
+	uint64_t GetNumDropped() const { return m_iDropped.load(memory_order_relaxed); }
+
+};
+
+#endif
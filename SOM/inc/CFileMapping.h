@@ -0,0 +1,73 @@
+#ifndef CFILEMAPPING_H_
+#define CFILEMAPPING_H_
+
+//------------------------------------------------------------------------
+//
+//  Name:   CFileMapping.h
+//
+//  Desc:   maps a whole file read-only into memory (mmap on POSIX,
+//          MapViewOfFile on Windows). The pages come straight from the
+//          OS page cache, so every process mapping the same file shares
+//          one copy of it
+//
+//------------------------------------------------------------------------
+
+#include <stddef.h>
+
+
+class CFileMapping
+{
+
+private:
+
+	const void* m_pData;		//start of the mapped file
+	size_t m_iSize;				//length of the mapped file in bytes
+	void* m_hFile;				//Windows file and mapping handles
+	void* m_hMapping;
+
+	CFileMapping(const CFileMapping&);
+	CFileMapping& operator=(const CFileMapping&);
+
+
+public:
+
+	CFileMapping():
+		m_pData(NULL),
+		m_iSize(0),
+		m_hFile(NULL),
+		m_hMapping(NULL)
+	{}
+
+	~CFileMapping() { Close(); }
+
+	/*
+	* maps the file at path, unmapping whatever was mapped before.
+	* Returns false if the file can't be opened or is empty
+	*/
+	bool Open(const char* path);
+
+	void Close();
+
+	/*
+	* exchanges the mappings held by the two objects
+	*/
+	void Swap(CFileMapping &other);
+
+	/*
+	* hints that the given range of the file is about to be read, so the
+	* OS can start bringing it in, or that it won't be read again soon, so
+	* its pages can go. Neither changes what the memory holds. No-ops on
+	* Windows
+	*/
+	void WillNeed(size_t offset, size_t length) const;
+	void DontNeed(size_t offset, size_t length) const;
+
+	bool IsOpen() const { return m_pData != NULL; }
+
+	const void* GetData() const { return m_pData; }
+
+	size_t GetSize() const { return m_iSize; }
+
+};
+
+#endif
@@ -0,0 +1,295 @@
+#ifndef CFIXEDSOM_H_
+#define CFIXEDSOM_H_
+
+//------------------------------------------------------------------------
+//
+//  Name:   CFixedSom.h
+//
+//  Desc:   a Self Organizing Map whose scalar type, input size and grid
+//          size are template parameters. With everything known at compile
+//          time the distance and update loops have fixed trip counts and
+//          are unrolled completely. CSom stays the one to use for maps
+//          configured at runtime
+//
+//------------------------------------------------------------------------
+
+#include <vector>
+#include <math.h>
+#include <limits>
+
+using namespace std;
+
+#include "utils.h"
+#include "constants.h"
+#include "SomSchedule.h"
+
+
+/*
+* compile time unrolled loops over N elements. The sum is split in halves
+* recursively so the additions form a tree rather than one long chain
+*/
+template <typename Scalar, int N>
+struct TUnrolled
+{
+	static inline Scalar SqDist(const Scalar* a, const Scalar* b)
+	{
+		return TUnrolled<Scalar, N / 2>::SqDist(a, b) +
+		       TUnrolled<Scalar, N - N / 2>::SqDist(a + N / 2, b + N / 2);
+	}
+
+	static inline void MoveTowards(Scalar* w, const Scalar* target, Scalar rate)
+	{
+		TUnrolled<Scalar, N / 2>::MoveTowards(w, target, rate);
+		TUnrolled<Scalar, N - N / 2>::MoveTowards(w + N / 2, target + N / 2, rate);
+	}
+};
+
+template <typename Scalar>
+struct TUnrolled<Scalar, 1>
+{
+	static inline Scalar SqDist(const Scalar* a, const Scalar* b)
+	{
+		Scalar diff = a[0] - b[0];
+
+		return diff * diff;
+	}
+
+	static inline void MoveTowards(Scalar* w, const Scalar* target, Scalar rate)
+	{
+		w[0] += rate * (target[0] - w[0]);
+	}
+};
+
+
+template <typename Scalar, int Dim, int Rows, int Cols>
+class CFixedSom
+{
+
+public:
+
+	enum { NumNodes = Rows * Cols };
+
+	enum { NumWeights = Dim };
+
+
+private:
+
+	Scalar* m_pWeights;					//the NumNodes x Dim weight matrix
+	double m_dMapRadius;				//this is the topological 'radius' of the feature map
+	double m_dTimeConstant;				//used in the calculation of the neighbourhood width of influence
+	int m_iNumIterations;				//the number of training iterations
+	int m_iIterationCount;				//keeps track of what iteration the epoch method has reached
+	double m_dStartLearningRate;		//the learning rate the schedule starts from
+	bool m_bDone;						//set true when training is finished
+	vector<double> m_vRadiusSchedule;	//the neighbourhood radius for every iteration
+	vector<double> m_vLearningRateSchedule;	//the learning rate for every iteration
+	vector<Scalar> m_vInfluence;		//the gaussian factor for each grid offset at the current radius
+	CRandom m_Random;					//draws the initial weights and the order vectors are presented in
+
+	CFixedSom(const CFixedSom&);
+	CFixedSom& operator=(const CFixedSom&);
+
+
+public:
+
+	CFixedSom():
+		m_pWeights(NULL),
+		m_dMapRadius(max(Rows, Cols) / 2.0),
+		m_dTimeConstant(0),
+		m_iNumIterations(0),
+		m_iIterationCount(1),
+		m_dStartLearningRate(constStartLearningRate),
+		m_bDone(false),
+		m_Random(GetRandom().Next())
+	{}
+
+	~CFixedSom() { if (m_pWeights) AlignedFree(m_pWeights); }
+
+	/*
+	* restarts the map's random number generator, see CSom::Seed
+	*/
+	void Seed(uint64_t seed) { m_Random.Seed(seed); }
+
+	/*
+	* the learning rate the schedule set up by Create starts from,
+	* constStartLearningRate by default, see CSom::SetStartLearningRate.
+	* Set it before Create
+	*/
+	void SetStartLearningRate(double rate) { m_dStartLearningRate = rate; }
+
+	double GetStartLearningRate() const { return m_dStartLearningRate; }
+
+	/*
+	* initializes the weights to small random values and sets up the
+	* schedules for NumIterations iterations, like CSom::Create. The
+	* weights are allocated the first time; returns false if they can't
+	* be, and the map mustn't be used then
+	*/
+	bool Create(int NumIterations)
+	{
+		if (!m_pWeights)
+		{
+			m_pWeights = (Scalar*)AlignedAlloc(sizeof(Scalar) * NumNodes * Dim, 64);
+
+			if (!m_pWeights) return false;
+		}
+
+		for (int i=0; i<NumNodes * Dim; ++i)
+		{
+			m_pWeights[i] = (Scalar)m_Random.NextDouble();
+		}
+
+		m_iNumIterations  = NumIterations;
+		m_iIterationCount = 1;
+		m_bDone           = false;
+
+		m_dTimeConstant = BuildSomSchedules(NumIterations,
+		                                    m_dMapRadius,
+		                                    m_dStartLearningRate,
+		                                    m_vRadiusSchedule,
+		                                    m_vLearningRateSchedule);
+
+		return true;
+	}
+
+	/*
+	* returns the index of the node closest to pInput (Dim values). If
+	* pDistSq is given it receives the squared distance to the winner
+	*/
+	int FindBestMatchingNode(const Scalar* pInput, Scalar* pDistSq = NULL) const
+	{
+		//the distances are worked out a block of nodes at a time into a
+		//small array, which leaves the compiler a fixed size loop with no
+		//branches in it to vectorize across the nodes
+		enum { Block = 16 };
+
+		Scalar dist[Block];
+
+		int winner = 0;
+
+		Scalar LowestDistance = numeric_limits<Scalar>::max();
+
+		for (int n=0; n + Block <= NumNodes; n += Block)
+		{
+			const Scalar* pRows = m_pWeights + n * Dim;
+
+			for (int b=0; b<Block; ++b)
+			{
+				dist[b] = TUnrolled<Scalar, Dim>::SqDist(pInput, pRows + b * Dim);
+			}
+
+			for (int b=0; b<Block; ++b)
+			{
+				if (dist[b] < LowestDistance)
+				{
+					LowestDistance = dist[b];
+					winner = n + b;
+				}
+			}
+		}
+
+		//whatever is left over when the map isn't a whole number of blocks
+		for (int n=NumNodes - NumNodes % Block; n<NumNodes; ++n)
+		{
+			Scalar d = TUnrolled<Scalar, Dim>::SqDist(pInput, m_pWeights + n * Dim);
+
+			if (d < LowestDistance)
+			{
+				LowestDistance = d;
+				winner = n;
+			}
+		}
+
+		if (pDistSq) *pDistSq = LowestDistance;
+
+		return winner;
+	}
+
+	/*
+	* presents one of the NumVectors vectors in pData (stored one after
+	* the other, Dim values each) chosen at random and runs the map
+	* through one training epoch. Same schedule and update rule as
+	* CSom::Epoch
+	*/
+	bool Epoch(const Scalar* pData, int NumVectors)
+	{
+		if (NumVectors <= 0) return false;
+
+		if (m_bDone) return true;
+
+		if (--m_iNumIterations > 0)
+		{
+			const Scalar* pTarget = pData + m_Random.NextInt(0, NumVectors - 1) * Dim;
+
+			const int winner = FindBestMatchingNode(pTarget);
+
+			const int WinnerRow = winner / Cols;
+			const int WinnerCol = winner % Cols;
+
+			const double radius  = m_vRadiusSchedule[m_iIterationCount];
+			const double WidthSq = radius * radius;
+
+			const Scalar LearningRate = (Scalar)m_vLearningRateSchedule[m_iIterationCount];
+
+			//one gaussian factor per grid offset, see CSom::BuildInfluenceTable
+			m_vInfluence.assign(1, (Scalar)1);
+
+			for (int k=1; (double)k * k < WidthSq; ++k)
+			{
+				m_vInfluence.push_back((Scalar)exp(-(double)(k * k) / (2 * WidthSq)));
+			}
+
+			const int reach = (int)m_vInfluence.size() - 1;
+
+			const int FirstRow = max(0, WinnerRow - reach);
+			const int LastRow  = min(Rows, WinnerRow + reach + 1);
+			const int FirstCol = max(0, WinnerCol - reach);
+			const int LastCol  = min(Cols, WinnerCol + reach + 1);
+
+			for (int row=FirstRow; row<LastRow; ++row)
+			{
+				const int dy = abs(row - WinnerRow);
+
+				const Scalar RowFactor = LearningRate * m_vInfluence[dy];
+
+				for (int col=FirstCol; col<LastCol; ++col)
+				{
+					const int dx = abs(col - WinnerCol);
+
+					if ((double)(dx * dx + dy * dy) >= WidthSq) continue;
+
+					TUnrolled<Scalar, Dim>::MoveTowards(m_pWeights + (row * Cols + col) * Dim,
+					                                    pTarget,
+					                                    RowFactor * m_vInfluence[dx]);
+				}
+			}
+
+			++m_iIterationCount;
+		}
+
+		else
+		{
+			m_bDone = true;
+		}
+
+		return true;
+	}
+
+	bool FinishedTraining() const { return m_bDone; }
+
+	const Scalar* GetRow(int n) const { return m_pWeights + n * Dim; }
+
+	const Scalar* GetWeights() const { return m_pWeights; }
+
+};
+
+
+//maps of the EEG band powers at the demo's grid size, compiled into the
+//library by CFixedSom.cpp
+typedef CFixedSom<float,  constNumEegBands, constNumCellsDown, constNumCellsAcross> CEegSomF;
+typedef CFixedSom<double, constNumEegBands, constNumCellsDown, constNumCellsAcross> CEegSomD;
+
+extern template class CFixedSom<float,  constNumEegBands, constNumCellsDown, constNumCellsAcross>;
+extern template class CFixedSom<double, constNumEegBands, constNumCellsDown, constNumCellsAcross>;
+
+#endif
@@ -8,52 +8,55 @@
 
 using namespace std;
 
+/*
+* a lightweight view of one node of the map. The weights themselves
+* live in the row of the codebook (see CCodebook) the node points to,
+* so a CNode is cheap to create and copy and owns no memory
+*/
 class CNode
 {
 
 private:
 
-	vector<double> m_dWeights;
+	double* m_pWeights;		//this node's row in the codebook
+	int m_iNumWeights;
 	double m_dPosX;
 	double m_dPosY;
 
 
 public:
 
-	CNode(double posX, double posY, int numWeights):
+	CNode(double* pWeights, int numWeights, double posX, double posY):
+		m_pWeights(pWeights),
+		m_iNumWeights(numWeights),
 		m_dPosX(posX),
 		m_dPosY(posY)
-	{
-		/*
-		* initialize the weights to small random variables
-		*/
-		for(int w = 0; w < numWeights; w++)
-		{
-			m_dWeights.push_back(RandFloat());
-		}
-	}
-	
+	{}
+
 	/*
-	* returns the euclidean distance (squared)
+	* returns the euclidean distance
 	* between the node's weights and the input vector
 	*/
-    inline double GetEucDistance(
+	double GetEucDistance(
 		const vector<double> &vecInput
-	);
-	
+	) const;
+
 	/*
 	* given a learning rate and a target vector,
 	* this function adjusts the node's weights accordingly
 	*/
-	inline void AdjustWeights(
+	void AdjustWeights(
 		const vector<double> &vecTarget,
 		const double learningRate,
 		const double influence
 	);
 
+	const double* GetWeights() const { return m_pWeights; }
+	int GetNumWeights() const { return m_iNumWeights; }
+
 	double getPosX() const { return m_dPosX; }
 	double getPosY() const { return m_dPosY; }
 
 };
 
-#endif
\ No newline at end of file
+#endif
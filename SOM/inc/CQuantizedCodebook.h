@@ -0,0 +1,132 @@
+#ifndef CQUANTIZEDCODEBOOK_H_
+#define CQUANTIZEDCODEBOOK_H_
+
+//------------------------------------------------------------------------
+//
+//  Name:   CQuantizedCodebook.h
+//
+//  Desc:   a copy of a trained map's weights at reduced precision, for
+//          classifying only. The BMU search over a large map is bound
+//          by how fast the weights stream in from memory, so storing
+//          them as floats, halves or bytes (with a scale per node)
+//          makes the map 2, 4 or 8 times smaller than the doubles it
+//          was trained in and keeps far more of it in cache.
+//
+//          the inputs and distances are floats. MeasureAccuracy compares
+//          the results with the double precision map they came from.
+//          Like CBmuIndex it is a snapshot, so build it again if the map
+//          is trained any further
+//
+//------------------------------------------------------------------------
+
+#include <vector>
+#include <stdint.h>
+#include <stddef.h>
+
+using namespace std;
+
+#include "CCodebook.h"
+#include "CThreadPool.h"
+#include "SomFile.h"
+
+
+//how a reduced precision map does against the map it was built from
+struct SQuantizedAccuracy
+{
+	double dBmuAgreement;		//fraction of vectors given the same BMU
+	double dReferenceQE;		//mean distance from each vector to its BMU in the original map
+	double dQE;					//the same, to the BMU the reduced map picks (measured on the original weights)
+	double dMaxDistanceError;	//largest difference between a distance the reduced map reports and the exact one
+};
+
+
+class CQuantizedCodebook
+{
+
+private:
+
+	void* m_pWeights;			//nodes x stride weights of type m_Scalar
+	vector<float> m_vScales;	//the factor each node's bytes are multiplied by, for SOM_SCALAR_INT8
+	SomScalar m_Scalar;
+	int m_iNumNodes;
+	int m_iDim;
+	int m_iStride;				//elements between the starts of two rows
+
+	CQuantizedCodebook(const CQuantizedCodebook&);
+	CQuantizedCodebook& operator=(const CQuantizedCodebook&);
+
+
+public:
+
+	CQuantizedCodebook():
+		m_pWeights(NULL),
+		m_Scalar(SOM_SCALAR_FLOAT32),
+		m_iNumNodes(0),
+		m_iDim(0),
+		m_iStride(0)
+	{}
+
+	~CQuantizedCodebook();
+
+	/*
+	* copies the weights of codebook, rounded to the nearest value of
+	* type scalar (SOM_SCALAR_FLOAT32, SOM_SCALAR_FLOAT16 or
+	* SOM_SCALAR_INT8). Each node's bytes are scaled to its largest
+	* weight, so int8 keeps about two decimal digits of every node
+	* whatever its range. Halves top out at 65504. Returns false for
+	* any other type, or if there isn't the memory for the copy
+	*/
+	bool Build(const CCodebook &codebook, SomScalar scalar);
+
+	/*
+	* returns the index of the best matching unit for pInput (dim values)
+	* and optionally its squared distance. Safe to call from several
+	* threads at once
+	*/
+	int FindBestMatchingNode(const float* pInput, float* pDistSq = NULL) const;
+
+	/*
+	* maps NumVectors vectors, stored one after the other in pData, to
+	* their best matching units, as CSom::Project does. The vectors are
+	* split over the threads of pPool if given
+	*/
+	void Project(
+		const float* pData,
+		size_t NumVectors,
+		uint32_t* pBmu,
+		float* pDist = NULL,
+		CThreadPool* pPool = NULL
+	) const;
+
+	/*
+	* projects the vectors with both this map and reference, which must
+	* be the codebook it was built from, and compares the results
+	*/
+	SQuantizedAccuracy MeasureAccuracy(
+		const CCodebook &reference,
+		const float* pData,
+		size_t NumVectors,
+		CThreadPool* pPool = NULL
+	) const;
+
+	/*
+	* the padded row length: 8 for up to 8 weights, which the 8 float
+	* kernels take in one step, and otherwise a multiple of the 16 floats
+	* the widest kernel handles per step
+	*/
+	static int StrideFor(int dim) { return dim <= 8 ? 8 : (dim + 15) & ~15; }
+
+	SomScalar GetScalar() const { return m_Scalar; }
+
+	int GetNumNodes() const { return m_iNumNodes; }
+
+	int GetDim() const { return m_iDim; }
+
+	/*
+	* how much memory the weights and scales take up
+	*/
+	size_t GetBytes() const;
+
+};
+
+#endif
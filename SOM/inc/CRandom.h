@@ -0,0 +1,157 @@
+#ifndef CRANDOM_H_
+#define CRANDOM_H_
+
+//------------------------------------------------------------------------
+//
+//  Name:   CRandom.h
+//
+//  Desc:   a small, fast pseudo random number generator (xoshiro256**).
+//          Each object is an independent stream with no locking, and
+//          Jump moves a stream 2^128 numbers ahead, so one seed can be
+//          split into as many non-overlapping streams as there are
+//          workers. The same seed always gives the same numbers on every
+//          platform
+//
+//------------------------------------------------------------------------
+
+#include <stdint.h>
+
+
+class CRandom
+{
+
+private:
+
+	uint64_t m_State[4];
+
+	static inline uint64_t Rotl(uint64_t x, int k)
+	{
+		return (x << k) | (x >> (64 - k));
+	}
+
+
+public:
+
+	explicit CRandom(uint64_t seed = 0) { Seed(seed); }
+
+	/*
+	* restarts the stream. The seed is spread over the 256 bit state
+	* with splitmix64, so any value, 0 included, is a good seed
+	*/
+	void Seed(uint64_t seed)
+	{
+		for (int i=0; i<4; ++i)
+		{
+			uint64_t z = (seed += 0x9e3779b97f4a7c15ULL);
+
+			z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+			z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+
+			m_State[i] = z ^ (z >> 31);
+		}
+	}
+
+	/*
+	* returns the next 64 random bits
+	*/
+	uint64_t Next()
+	{
+		const uint64_t result = Rotl(m_State[1] * 5, 7) * 9;
+
+		const uint64_t t = m_State[1] << 17;
+
+		m_State[2] ^= m_State[0];
+		m_State[3] ^= m_State[1];
+		m_State[1] ^= m_State[2];
+		m_State[0] ^= m_State[3];
+
+		m_State[2] ^= t;
+
+		m_State[3] = Rotl(m_State[3], 45);
+
+		return result;
+	}
+
+	/*
+	* advances the stream by 2^128 numbers
+	*/
+	void Jump()
+	{
+		static const uint64_t JumpPoly[4] =
+		{
+			0x180ec6d33cfd0abaULL, 0xd5a61266f0c9392cULL,
+			0xa9582618e03fc9aaULL, 0x39abdc4529b1661cULL
+		};
+
+		uint64_t s[4] = { 0, 0, 0, 0 };
+
+		for (int i=0; i<4; ++i)
+		{
+			for (int b=0; b<64; ++b)
+			{
+				if (JumpPoly[i] & ((uint64_t)1 << b))
+				{
+					s[0] ^= m_State[0];
+					s[1] ^= m_State[1];
+					s[2] ^= m_State[2];
+					s[3] ^= m_State[3];
+				}
+
+				Next();
+			}
+		}
+
+		for (int i=0; i<4; ++i)
+		{
+			m_State[i] = s[i];
+		}
+	}
+
+	/*
+	* the n'th independent stream of seed: seeded with it and jumped n
+	* times. Give worker n stream n for reproducible parallel runs
+	*/
+	static CRandom Stream(uint64_t seed, int n)
+	{
+		CRandom random(seed);
+
+		for (int i=0; i<n; ++i)
+		{
+			random.Jump();
+		}
+
+		return random;
+	}
+
+	/*
+	* returns a random double in [0, 1), with all 53 bits of it random
+	*/
+	double NextDouble()
+	{
+		return (Next() >> 11) * (1.0 / 9007199254740992.0);
+	}
+
+	/*
+	* returns a random index below n, for picking from sets too big for
+	* an int
+	*/
+	uint64_t NextIndex(uint64_t n)
+	{
+		return Next() % n;
+	}
+
+	/*
+	* returns a random integer between x and y inclusive
+	*/
+	int NextInt(int x, int y)
+	{
+		const uint64_t range = (uint64_t)((int64_t)y - x) + 1;
+
+		//the top 32 bits scaled to the range, which is as good as
+		//unbiased for the ranges a map needs
+		return (int)(x + (int64_t)(((Next() >> 32) * range) >> 32));
+	}
+
+};
+
+#endif
@@ -2,33 +2,248 @@
 #define CSOM_H_
 
 #include <vector>
+#include <stdint.h>
+#include <stddef.h>
+#include <algorithm>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
 
 using namespace std;
 
 #include "CNode.h"
+#include "CCodebook.h"
+#include "BmuSearch.h"
+#include "CThreadPool.h"
+#include "CFileMapping.h"
+#include "CDataSet.h"
+#include "CSomTelemetry.h"
 #include "constants.h"
 
 
+struct SSomFileHeader;
+
+
+//what CSom::SetEarlyStopping watches for the map settling
+enum SomConvergence
+{
+	SOM_CONVERGE_NEVER,					//always run the whole schedule
+	SOM_CONVERGE_QUANTIZATION_ERROR,	//the distance between the training vectors and their BMUs
+	SOM_CONVERGE_WEIGHT_CHANGE			//how far the nodes move in an epoch
+};
+
+
 class CSom
 {
 
 private:
 
-	vector<CNode> m_SOM;				//the neurons representing the Self Organizing Map
-	CNode* m_pWinningNode;				//this holds the address of the winning node from the current iteration
+	//a map size still to come in a coarse to fine run
+	struct SLevel
+	{
+		int iCellsUp;
+		int iCellsAcross;
+		int iIterations;
+	};
+
+	CCodebook m_Codebook;				//the weights and grid positions of the neurons representing the Self Organizing Map
+	int m_iWinningNode;					//this holds the index of the winning node from the current iteration
 	double m_dMapRadius;				//this is the topological 'radius' of the feature map
 	double m_dTimeConstant;				//used in the calculation of the neighbourhood width of influence
 	int m_iNumIterations;				//the number of training iterations
 	int m_iIterationCount;				//keeps track of what iteration the epoch method has reached
 	double m_dNeighbourhoodRadius;		//the current width of the winning node's area of influence
-	double m_dInfluence;				//how much the learning rate is adjusted for nodes within the area of influence
 	double m_dLearningRate;				// the learning rate
+	double m_dStartLearningRate;		//the learning rate the schedule starts from
 	bool m_bDone;						//set true when training is finished
 	double m_dCellWidth;				//the height and width of the cells that the nodes occupy when rendered into 2D space.
 	double m_dCellHeight;				//the height and width of the cells that the nodes occupy when rendered into 2D space.
+	vector<double> m_vInput;			//the current input vector, zero padded to the codebook stride for the BMU kernel
+	CThreadPool* m_pThreadPool;			//optional pool the epoch is spread across (not owned)
+	vector<int> m_vTaskWinner;			//the local BMU found by each task of a parallel search
+	vector<double> m_vTaskDist;			//and its squared distance
+	vector<double> m_vRadiusSchedule;	//the neighbourhood radius for every iteration
+	vector<double> m_vLearningRateSchedule;	//the learning rate for every iteration
+	vector<double> m_vInfluence;		//the gaussian factor for each grid offset at the current radius
+	CFileMapping m_Mapping;				//the map file the codebook is attached to, after Map
+	CRandom m_Random;					//draws the initial weights and the order vectors are presented in
+	vector<double> m_vSample;			//a vector from a CDataSet, widened to doubles
+	vector<double> m_vNodeNorms;		//the squared length of every node's weights
+	bool m_bNodeNormsValid;				//false once the weights have moved since m_vNodeNorms was worked out
+	int m_iGemmMinDim;					//batches are searched as a matrix product from this many weights up
+	vector<SLevel> m_vLevels;			//the larger maps a coarse to fine run moves on to
+	int m_iNextLevel;					//the one it moves on to next
+	CSomTelemetry m_Telemetry;			//counters and timers for GetTelemetry
+	int m_iErrorSampleEvery;			//epochs between the error samples, 0 for none
+	int m_iErrorSampleSize;				//vectors in each sample
+	vector<float> m_vErrorSample;		//the sample, gathered for Project
+	SomConvergence m_Convergence;		//what early stopping watches, see SetEarlyStopping
+	int m_iConvergenceWindow;			//epochs the moving average spans and between the checks
+	double m_dConvergenceThreshold;		//the smallest relative improvement per window that keeps training going
+	double m_dConvergenceMinFraction;	//of the schedule that always runs
+	double m_dConvergenceAverage;		//the moving average of the measure
+	double m_dConvergenceCheckpoint;	//and what it was at the last check
+	int m_iStageEpochs;					//epochs since the schedule was set up
+	int m_iStageIterations;				//the length of the schedule
+	long long m_iIterationsSaved;		//left out of the schedules by early stopping
+	double m_dEpochError;				//the measures of the epoch just run
+	double m_dEpochChange;
+
+	//scratch space for the batch epoch
+	vector<int> m_vBatchBmu;			//the BMU of every training vector
+	vector<int> m_vBatchOrder;			//the training vectors sorted by BMU
+	vector<int> m_vBatchStart;			//where each node's vectors start in m_vBatchOrder
+	vector<double> m_vBatchSum;			//per node sum of the vectors it won
+	vector<double> m_vBatchCount;		//per node number of vectors it won
+	vector<double> m_vBatchRowSum;		//the sums and counts after smoothing along the rows only
+	vector<double> m_vBatchRowCount;
+	vector<double> m_vBatchDist;		//the squared distance of every training vector to its BMU
+	vector<double> m_vBatchMove;		//how far each node moved in the pass, squared
+
+	/*
+	* works out the radius and learning rate of every iteration of a
+	* NumIterations long training run
+	*/
+	void BuildSchedules(int NumIterations);
 
+	/*
+	* sets the training state and schedules from a map file's header
+	*/
+	void RestoreTraining(const SSomFileHeader &header);
 
-	CNode* FindBestMatchingNode(const vector<double> &vecInput);
+	/*
+	* how many node ranges a loop over NumNodes nodes is split into. Always
+	* one without a thread pool or when the map is too small to be worth it
+	*/
+	int NumTasksFor(int NumNodes) const;
+
+	/*
+	* finds the BMU of pTarget and moves it and its neighbours towards it,
+	* with the current neighbourhood radius and learning rate
+	*/
+	void TrainOn(const double* pTarget);
+
+	/*
+	* applies the neighbourhood update for the current winner to the grid
+	* rows in [firstRow, lastRow), touching only the columns within reach
+	*/
+	void AdjustRows(int firstRow, int lastRow, int reach, const double* pTarget);
+
+	/*
+	* fills table with exp(-k^2 / 2r^2) for every offset k with k^2 < r^2.
+	* The gaussian of a grid offset (dx, dy) is table[dx] * table[dy]
+	*/
+	static void BuildInfluenceTable(double radius, vector<double> &table);
+
+	/*
+	* called when the schedule of the current map runs out. Moves a coarse
+	* to fine run on to its next map and returns true, or returns false if
+	* there is none
+	*/
+	bool NextLevel();
+
+	/*
+	* one iteration of the online schedule on a vector picked at random
+	* from NumVectors, which GetVector returns
+	*/
+	bool OnlineStep(size_t NumVectors, const function<const double*(size_t)> &GetVector);
+
+	/*
+	* one iteration of the batch schedule. Accumulate adds every training
+	* vector to the sums of its BMU
+	*/
+	bool BatchStep(
+		size_t NumVectors,
+		const function<const double*(size_t)> &GetVector,
+		const function<void()> &Accumulate
+	);
+
+	/*
+	* adds Add(vector, sums) up over all NumVectors vectors, which
+	* GetVector writes out, into total's width sums. Add may run on several
+	* threads at once, each with sums of its own, and may overwrite the
+	* vector. pSet, if the vectors come from one, gets read ahead hints
+	*/
+	void SumOverData(
+		size_t NumVectors,
+		const CDataSet* pSet,
+		const function<void(size_t, double*)> &GetVector,
+		int width,
+		const function<void(double*, double*)> &Add,
+		vector<double> &total
+	);
+
+	/*
+	* the work of InitializeLinear
+	*/
+	bool LinearInit(
+		size_t NumVectors,
+		const CDataSet* pSet,
+		const function<void(size_t, double*)> &GetVector
+	);
+
+	/*
+	* feeds the measures of the epoch just run to the moving average and,
+	* if the map has settled, skips the schedule ahead to its last window
+	*/
+	void CheckConvergence();
+
+	/*
+	* counts an epoch that has just run in the telemetry, samples the
+	* errors on the NumVectors vectors GetVector returns if they are due,
+	* and publishes. Adapt has no training set to sample and passes NULL
+	*/
+	void EndEpoch(size_t NumVectors, const function<const double*(size_t)>* pGetVector);
+
+	/*
+	* finds the BMU of every one of NumVectors vectors. GetVector(v, pInput)
+	* writes the weights of vector v to pInput and may be called from
+	* several threads at once
+	*/
+	void AssignBatch(int NumVectors, const function<void(int, double*)> &GetVector);
+
+	/*
+	* adds NumVectors vectors to the per node sums and counts of their
+	* BMUs, each node's in the order of the vectors
+	*/
+	void AccumulateBatch(int NumVectors, const function<void(int, double*)> &GetVector);
+
+	/*
+	* smooths the per node sums and counts over the neighbourhood with a
+	* separable gaussian and moves every node to the weighted mean
+	*/
+	void SmoothBatch();
+
+	/*
+	* works out m_vNodeNorms again if the weights have changed since
+	*/
+	void UpdateNodeNorms();
+
+	/*
+	* the squared length of every node's weights, into norms
+	*/
+	void ComputeNodeNorms(vector<double> &norms) const;
+
+	bool UseGemm() const { return m_Codebook.GetDim() >= m_iGemmMinDim; }
+
+	/*
+	* finds the best matching node of count input vectors, laid out like
+	* the codebook rows, and if pSecond is given the runner up. Distances
+	* are squared; the one to the winner is always worked out directly,
+	* whichever way the search went. pNodeNorms, the squared length of
+	* every node, is only used, and then needed, if UseGemm
+	*/
+	void SearchTile(
+		const double* pInputs,
+		int count,
+		const double* pNodeNorms,
+		vector<double> &scratch,
+		double* pBest,
+		int* pBestNode,
+		double* pSecond,
+		int* pSecondNode
+	) const;
 
 	inline double GetGaussianDistance(const double dist, const double sigma);
 
@@ -36,31 +251,360 @@ private:
 public:
 
 	CSom():
-		m_dCellWidth(0),
-		m_dCellHeight(0),
-		m_pWinningNode(NULL),
-		m_iIterationCount(1),
-		m_iNumIterations(0),
-		m_dTimeConstant(0),
+		m_iWinningNode(-1),
 		m_dMapRadius(0),
+		m_dTimeConstant(0),
+		m_iNumIterations(0),
+		m_iIterationCount(1),
 		m_dNeighbourhoodRadius(0),
-		m_dInfluence(0),
 		m_dLearningRate(constStartLearningRate),
-		m_bDone(false)
+		m_dStartLearningRate(constStartLearningRate),
+		m_bDone(false),
+		m_dCellWidth(0),
+		m_dCellHeight(0),
+		m_pThreadPool(NULL),
+		m_Random(GetRandom().Next()),
+		m_bNodeNormsValid(false),
+		m_iGemmMinDim(constGemmMinDim),
+		m_iNextLevel(0),
+		m_iErrorSampleEvery(0),
+		m_iErrorSampleSize(0),
+		m_Convergence(SOM_CONVERGE_NEVER),
+		m_iConvergenceWindow(0),
+		m_dConvergenceThreshold(0),
+		m_dConvergenceMinFraction(0),
+		m_dConvergenceAverage(0),
+		m_dConvergenceCheckpoint(0),
+		m_iStageEpochs(0),
+		m_iStageIterations(0),
+		m_iIterationsSaved(0),
+		m_dEpochError(0),
+		m_dEpochChange(0)
 	{}
 
-	void Create(
+	/*
+	* restarts the map's random number generator. Seed before Create and
+	* the same seed gives the same initial weights and, for Epoch, the
+	* same training vectors in the same order
+	*/
+	void Seed(uint64_t seed) { m_Random.Seed(seed); }
+
+	/*
+	* the learning rate the schedules set up by Create, CreateCoarseToFine
+	* and Upsample start from, constStartLearningRate by default. Set it
+	* before them; it is saved with the map
+	*/
+	void SetStartLearningRate(double rate) { m_dStartLearningRate = rate; }
+
+	double GetStartLearningRate() const { return m_dStartLearningRate; }
+
+	/*
+	* creates a CellsUp x CellsAcross map of nodes with dim weights each,
+	* to be trained over NumIterations iterations. The client size is only
+	* used to work out the cells Render draws. Returns false, leaving the
+	* map empty, if there isn't the memory for it
+	*/
+	bool Create(
+		int cxClient,
+		int cyClient,
+		int CellsUp,
+		int CellsAcross,
+		int NumIterations,
+		int dim = constSizeOfInputVector
+	);
+
+	/*
+	* sets up a hierarchical run that trains a CellsUp x CellsAcross map
+	* in NumLevels stages. The first trains a map halved NumLevels - 1
+	* times (at least 2 x 2) from random weights with the full schedule.
+	* Each following stage doubles the size with Upsample and only fine
+	* tunes, so the wide neighbourhoods of the early iterations are only
+	* ever swept over small maps. NumIterations is shared out evenly
+	* between the stages; Epoch and BatchEpoch move from one to the next
+	* by themselves and FinishedTraining only turns true after the last.
+	* NumLevels is cut down to the stages that still halve the map and
+	* to NumIterations, so every stage gets at least one iteration.
+	*
+	* Save writes the map of the current stage only, so a run loaded back
+	* in finishes that stage and stops there. Returns false like Create
+	*/
+	bool CreateCoarseToFine(
 		int cxClient,
 		int cyClient,
 		int CellsUp,
 		int CellsAcross,
-		int NumIterations
+		int NumIterations,
+		int NumLevels,
+		int dim = constSizeOfInputVector
 	);
 
+	/*
+	* replaces the random weights Create gives the map with a plane laid
+	* through data along its two principal components: the mean at the
+	* centre of the grid, and the first component (the one along which the
+	* data varies most) running along the longer side and the second along
+	* the other, each spanning its standard deviation either side. The map
+	* then starts out ordered, and training only has to fit it to the data
+	* rather than untangle it.
+	*
+	* the components are found with a few passes of randomized subspace
+	* iteration over the data, so no covariance matrix is formed and the
+	* cost grows with the number of vectors times the dimension. A data set
+	* is streamed through like BatchEpoch does, and the result is the same
+	* for any number of threads.
+	*
+	* call it after Create or CreateCoarseToFine. The schedule they set up
+	* starts with a neighbourhood as wide as the map, which is there to
+	* order a random map; a map initialized like this trains as well on a
+	* schedule that starts narrower, see SetStartRadius. Returns false if
+	* the vectors are the wrong size, or the map is empty or read only
+	*/
+	bool InitializeLinear(const vector<vector<double>> &data);
+
+	bool InitializeLinear(const CDataSet &data);
+
+	/*
+	* starts the schedule of the current map over, with the neighbourhood
+	* radius decaying from radius cells (at least 2) rather than from half
+	* the map. Call it after Create, CreateCoarseToFine or
+	* InitializeLinear, before training
+	*/
+	void SetStartRadius(double radius);
+
+	/*
+	* replaces the map with a CellsUp x CellsAcross one whose weights are
+	* interpolated bilinearly from the current map, which is stretched to
+	* cover the new grid corner to corner. Training starts over with a
+	* NumIterations long schedule for fine tuning: its radius starts at
+	* twice the width of a stretched cell, so only the detail the old map
+	* couldn't hold is learnt. Returns false if the map is empty
+	*/
+	bool Upsample(int CellsUp, int CellsAcross, int NumIterations);
+
+#ifdef _WIN32
+	/*
+	* draws every node as a cell coloured by its first three weights
+	*/
+	void Render(HDC surface);
+#endif
+
+	/*
+	* runs one training epoch on a vector chosen at random from data.
+	* Returns false if the vectors are the wrong size or the map is read
+	* only
+	*/
 	bool Epoch(const vector<vector<double>> &data);
 
+	/*
+	* the same, picking the vector from a mapped data set. Only that vector
+	* is read, so a pass of online training touches the set at random; for
+	* sets that don't fit in memory BatchEpoch reads it in order
+	*/
+	bool Epoch(const CDataSet &data);
+
+	/*
+	* runs one epoch of the batch SOM algorithm: every training vector is
+	* assigned to its BMU, then every node is moved in one go to the mean of
+	* the vectors won by the nodes in its neighbourhood, weighted by the
+	* same gaussian the online epoch uses (cut off at a square of half
+	* width the neighbourhood radius, so it can be applied one axis at a
+	* time). Each call counts as one iteration of the schedule set up in
+	* Create, so batch training wants far fewer iterations than online.
+	*
+	* no randomness is involved and every sum is taken in a fixed order,
+	* so the result is the same for any number of threads
+	*/
+	bool BatchEpoch(const vector<vector<double>> &data);
+
+	/*
+	* the same over a mapped data set, which is read straight through a
+	* chunk at a time with the next chunk read ahead. The vectors are
+	* added up in the same order as from memory, so the result doesn't
+	* depend on the chunk size either
+	*/
+	bool BatchEpoch(const CDataSet &data);
+
+	/*
+	* moves the map towards one input vector (GetCodebook().GetDim()
+	* values) with the given neighbourhood radius, in cells, and learning
+	* rate. It leaves the schedule set up in Create alone, so it is the
+	* step to use when the vectors arrive one by one with no end in sight.
+	* Returns false if the map is empty or read only
+	*/
+	bool Adapt(const double* pInput, double radius, double LearningRate);
+
 	bool FinishedTraining() const { return m_bDone; }
 
+	/*
+	* ends a schedule early once the map has settled, rather than always
+	* running it to the end. A moving average over Window epochs is kept
+	* of the measure: the mean distance between the vectors trained on
+	* and their BMUs, found before the nodes move, or the mean distance
+	* the nodes move. Both come out of the epoch at next to no cost. Every
+	* Window epochs, once MinFraction of the schedule has run, the
+	* schedule jumps ahead to its last Window iterations if the average
+	* has come down by less than Threshold of itself since the last check.
+	* Those still run, so the map is always finished at the final radius
+	* (for online training the learning rate is next to nothing by then),
+	* after which training stops or a coarse to fine run moves on to its
+	* next map, with a fresh average.
+	*
+	* online epochs only move the winner's neighbourhood by the learning
+	* rate, which decays on its own, so weight change is mainly of use
+	* with BatchEpoch. Window wants to be a few thousand online epochs or
+	* a few batch passes. SOM_CONVERGE_NEVER, the default, turns it off
+	*/
+	void SetEarlyStopping(
+		SomConvergence measure,
+		int Window = 1000,
+		double Threshold = 0.001,
+		double MinFraction = 0.25
+	);
+
+	/*
+	* the iterations early stopping has left out of the schedules since
+	* the map was created or loaded
+	*/
+	long long GetIterationsSaved() const { return m_iIterationsSaved; }
+
+	/*
+	* presents an input vector to every node and returns the index of the
+	* best matching unit. If pDistSq is given it receives the squared
+	* euclidean distance between the input and the winner
+	*/
+	int FindBestMatchingNode(const double* pInput, double* pDistSq = NULL);
+
+	int FindBestMatchingNode(const vector<double> &vecInput, double* pDistSq = NULL)
+	{
+		return FindBestMatchingNode(&vecInput[0], pDistSq);
+	}
+
+	/*
+	* maps NumVectors input vectors, stored one after the other in pData,
+	* to their best matching units without training. pBmu receives the
+	* index of each winner and pDist, if given, the euclidean distance to
+	* it. pSecond, if given, receives the runner up.
+	*
+	* the work is split over the thread pool by blocks of vectors, and
+	* each block walks the map a cache sized slice of nodes at a time so
+	* the slice is reused by every vector of the block while it is hot.
+	*
+	* it only reads the map, so several threads may project with the same
+	* map at once, as long as none of them trains it meanwhile. The node
+	* lengths the matrix product search needs are worked out when training
+	* finishes and when a map is loaded; a map still being trained has
+	* them worked out afresh for every call
+	*/
+	void Project(
+		const float* pData,
+		size_t NumVectors,
+		uint32_t* pBmu,
+		float* pDist,
+		uint32_t* pSecond = NULL
+	) const;
+
+	/*
+	* from how many weights per node up BatchEpoch and Project search
+	* their vectors as one matrix product,
+	*
+	*   |x - w|^2 = |x|^2 - 2 x.w + |w|^2
+	*
+	* with the node lengths cached, rather than one distance at a time.
+	* That is several times faster for long vectors, but the subtraction
+	* rounds differently, so when two nodes are within a rounding error of
+	* each other the other one can win. Results stay the same for any
+	* number of threads. Pass a huge value to always use the exact search
+	*/
+	void SetGemmMinDim(int dim) { m_iGemmMinDim = dim; }
+
+	/*
+	* the mean distance between each vector and its BMU. Read only, like
+	* Project
+	*/
+	double QuantizationError(const float* pData, size_t NumVectors) const;
+
+	/*
+	* the fraction of vectors whose best and second best units are not
+	* next to each other on the grid (diagonals count as next to). Read
+	* only, like Project
+	*/
+	double TopographicError(const float* pData, size_t NumVectors) const;
+
+	/*
+	* works out both measures above from a single Project, for when both
+	* are wanted
+	*/
+	void MapErrors(
+		const float* pData,
+		size_t NumVectors,
+		double &QuantizationError,
+		double &TopographicError
+	) const;
+
+	/*
+	* copies the latest training figures (see CSomTelemetry). It can be
+	* called from any thread while another one trains the map, without
+	* holding the training up. Returns false, with everything zero, if
+	* the library was built without SOM_TELEMETRY
+	*/
+	bool GetTelemetry(SSomTelemetry &telemetry) const { return m_Telemetry.Read(telemetry); }
+
+	/*
+	* has the quantization and topographic error measured every
+	* EveryEpochs epochs on SampleSize training vectors spread evenly over
+	* the set, and published with the telemetry. Each sample costs a
+	* Project over those vectors, which isn't counted as search time. 0,
+	* the default, turns it off
+	*/
+	void SetTelemetrySampling(int EveryEpochs, int SampleSize = 1000)
+	{
+		m_iErrorSampleEvery = max(0, EveryEpochs);
+		m_iErrorSampleSize  = max(1, SampleSize);
+	}
+
+	/*
+	* returns a view of the n'th node of the map
+	*/
+	CNode GetNode(int n) { return m_Codebook.GetNode(n); }
+
+	const CCodebook& GetCodebook() const { return m_Codebook; }
+
+	/*
+	* writes the map and how far its training has got to path, in the
+	* format described in SomFile.h. The file is written under a temporary
+	* name and renamed over path, so processes that have the old file
+	* mapped keep seeing it intact
+	*/
+	bool Save(const char* path) const;
+
+	/*
+	* replaces the map with a copy of the one saved in path, which can
+	* then be trained further
+	*/
+	bool Load(const char* path);
+
+	/*
+	* replaces the map with the one saved in path, mapped into memory and
+	* used in place. Nothing is read until it is touched and the pages are
+	* shared with every other process mapping the file, so this is the way
+	* to bring up large maps that are only used for classifying. The map
+	* is read only: Epoch and BatchEpoch return false.
+	*
+	* on failure both Load and Map leave the current map as it was
+	*/
+	bool Map(const char* path);
+
+	bool IsReadOnly() const { return m_Codebook.IsReadOnly(); }
+
+	/*
+	* spreads the BMU search and the neighbourhood update of each epoch
+	* over the threads of pPool, or goes back to one thread if it is NULL.
+	* Every node range is searched and updated exactly as it would be on
+	* one thread and the local winners are combined in node order, so the
+	* map trains to the same weights either way
+	*/
+	void SetThreadPool(CThreadPool* pPool) { m_pThreadPool = pPool; }
+
 };
 
-#endif
\ No newline at end of file
+#endif
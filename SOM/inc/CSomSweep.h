@@ -0,0 +1,154 @@
+#ifndef CSOMSWEEP_H_
+#define CSOMSWEEP_H_
+
+//------------------------------------------------------------------------
+//
+//  Name:   CSomSweep.h
+//
+//  Desc:   trains a list of map configurations (size, schedule length,
+//          start learning rate, coarse to fine levels, online or batch)
+//          on one data set, side by side on a CTaskScheduler, and
+//          measures how good each map came out.
+//
+//          the data set is mapped once and only ever read, so every map
+//          trains from the same pages. Each map is trained by one task
+//          at a time without a thread pool of its own; there are usually
+//          far more configurations than threads, and running them side by
+//          side scales better than splitting every map's epochs up.
+//          Every map is seeded with its configuration's seed, so its
+//          results don't depend on how many threads the sweep ran on or
+//          what else it ran next to
+//
+//------------------------------------------------------------------------
+
+#include <vector>
+#include <mutex>
+#include <functional>
+#include <stdint.h>
+
+using namespace std;
+
+#include "CDataSet.h"
+#include "CTaskScheduler.h"
+#include "CSom.h"
+
+
+struct SSomConfig
+{
+	int iCellsUp;
+	int iCellsAcross;
+	int iIterations;				//epochs for online training, passes for batch
+	double dStartLearningRate;		//online only, batch training has no learning rate
+	int iLevels;					//1 trains the map flat, more coarse to fine
+	bool bBatch;
+	uint64_t iSeed;
+};
+
+struct SSweepResult
+{
+	SSomConfig config;
+	double dQuantizationError;		//see CSom::QuantizationError, over the whole set, NaN
+	double dTopographicError;		//and CSom::TopographicError, if the map didn't fit in memory
+	double dSeconds;				//training and measuring this map took
+	long long iIterationsSaved;		//by early stopping, see CSom::SetEarlyStopping
+};
+
+
+class CSomSweep
+{
+
+private:
+
+	const CDataSet* m_pData;
+	CTaskScheduler* m_pScheduler;
+
+	vector<SSomConfig> m_vConfigs;
+	vector<SSweepResult> m_vResults;	//in the order the configurations were added
+
+	mutex m_Mutex;						//serializes the OnFinished calls
+
+	SomConvergence m_Convergence;		//early stopping for every map
+	int m_iStopWindow;
+	double m_dStopThreshold;
+
+	bool m_bLinearInit;					//maps start from InitializeLinear rather than random weights
+	double m_dLinearStartRadius;		//and their schedules from this radius, if not 0
+
+	CSomSweep(const CSomSweep&);
+	CSomSweep& operator=(const CSomSweep&);
+
+	/*
+	* a rough measure of the work the c'th configuration is, to hand the
+	* longest runs out first
+	*/
+	double CostOf(int c) const;
+
+
+public:
+
+	/*
+	* data must stay open, and the scheduler alive, until Run returns
+	*/
+	CSomSweep(const CDataSet &data, CTaskScheduler &scheduler):
+		m_pData(&data),
+		m_pScheduler(&scheduler),
+		m_Convergence(SOM_CONVERGE_NEVER),
+		m_iStopWindow(0),
+		m_dStopThreshold(0),
+		m_bLinearInit(false),
+		m_dLinearStartRadius(0)
+	{}
+
+	void Add(const SSomConfig &config) { m_vConfigs.push_back(config); }
+
+	/*
+	* adds every combination of the values given, with seeds seed,
+	* seed + 1, ... in the order the combinations are added in
+	*/
+	void AddGrid(
+		const vector<int> &sizes,
+		const vector<int> &iterations,
+		const vector<double> &rates,
+		const vector<int> &levels,
+		bool batch,
+		uint64_t seed
+	);
+
+	/*
+	* has every map stop early once it has settled, see
+	* CSom::SetEarlyStopping
+	*/
+	void SetEarlyStopping(SomConvergence measure, int Window, double Threshold)
+	{
+		m_Convergence    = measure;
+		m_iStopWindow    = Window;
+		m_dStopThreshold = Threshold;
+	}
+
+	/*
+	* has every map start from CSom::InitializeLinear, with its schedule
+	* starting from StartRadius cells if that isn't 0. The principal
+	* components are worked out again for every map, from the task
+	* training it
+	*/
+	void SetLinearInit(bool linear, double StartRadius = 0)
+	{
+		m_bLinearInit        = linear;
+		m_dLinearStartRadius = StartRadius;
+	}
+
+	int GetNumConfigs() const { return (int)m_vConfigs.size(); }
+
+	/*
+	* trains every configuration added and blocks until they are all
+	* done. OnFinished, if given, is called with each result as soon as
+	* its map is done, from the thread that trained it, but never from two
+	* threads at once. Returns false if the data set is empty
+	*/
+	bool Run(const function<void(const SSweepResult&)> &OnFinished = nullptr);
+
+	const vector<SSweepResult>& GetResults() const { return m_vResults; }
+
+};
+
+#endif
@@ -0,0 +1,152 @@
+#ifndef CSOMTELEMETRY_H_
+#define CSOMTELEMETRY_H_
+
+//------------------------------------------------------------------------
+//
+//  Name:   CSomTelemetry.h
+//
+//  Desc:   counters and timers a CSom keeps about its training, for
+//          watching where the time goes and whether the map has settled.
+//
+//          the training thread is the only writer. It publishes each
+//          epoch's figures under a sequence number, and a reader on any
+//          other thread copies them out and tries again if an epoch was
+//          published while it read, so the writer never waits and a
+//          reader always gets the figures of one and the same epoch.
+//
+//          built without SOM_TELEMETRY defined (the CMake option of the
+//          same name) the class is empty and every call compiles to
+//          nothing; Read then always returns false
+//
+//------------------------------------------------------------------------
+
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+
+using namespace std;
+
+
+struct SSomTelemetry
+{
+	uint64_t iEpochs;				//online steps, Adapt calls and batch passes since the map was created
+	uint64_t iVectors;				//vectors searched for their BMU while training
+	uint64_t iNodesTouched;			//node weight updates made
+	double dSearchSeconds;			//spent finding BMUs, in total
+	double dUpdateSeconds;			//spent moving the weights, in total
+	double dRadius;					//neighbourhood radius of the last epoch, in cells
+	double dLearningRate;			//learning rate of the last epoch, 0 for a batch pass
+	uint64_t iErrorEpoch;			//the epoch the errors below were sampled after, 0 for never
+	double dQuantizationError;		//see CSom::SetTelemetrySampling
+	double dTopographicError;
+};
+
+
+class CSomTelemetry
+{
+
+#ifdef SOM_TELEMETRY
+
+private:
+
+	//each figure lives in an atomic so the reader may copy it while it is
+	//being written; the sequence number tells the reader whether it did
+	atomic<uint32_t> m_iSequence;			//odd while an epoch is being published
+	atomic<uint64_t> m_Values[sizeof(SSomTelemetry) / sizeof(uint64_t)];
+
+	SSomTelemetry m_Current;				//the writer's own copy
+
+	static_assert(sizeof(SSomTelemetry) % sizeof(uint64_t) == 0, "the telemetry is copied as whole words");
+
+public:
+
+	typedef chrono::steady_clock::time_point Time;
+
+	CSomTelemetry():
+		m_iSequence(0)
+	{
+		Reset();
+	}
+
+	static Time Now() { return chrono::steady_clock::now(); }
+
+	static double Seconds(Time from, Time to) { return chrono::duration<double>(to - from).count(); }
+
+	/*
+	* writer side. The figures are gathered in the writer's copy and
+	* only made visible by Publish
+	*/
+	SSomTelemetry& Current() { return m_Current; }
+
+	void Publish()
+	{
+		uint64_t words[sizeof(SSomTelemetry) / sizeof(uint64_t)];
+
+		memcpy(words, &m_Current, sizeof(words));
+
+		const uint32_t sequence = m_iSequence.load(memory_order_relaxed);
+
+		m_iSequence.store(sequence + 1, memory_order_relaxed);
+
+		atomic_thread_fence(memory_order_release);
+
+		for (size_t i=0; i<sizeof(words) / sizeof(words[0]); ++i)
+		{
+			m_Values[i].store(words[i], memory_order_relaxed);
+		}
+
+		m_iSequence.store(sequence + 2, memory_order_release);
+	}
+
+	void Reset()
+	{
+		memset(&m_Current, 0, sizeof(m_Current));
+
+		Publish();
+	}
+
+	/*
+	* reader side, safe from any thread
+	*/
+	bool Read(SSomTelemetry &telemetry) const
+	{
+		uint64_t words[sizeof(SSomTelemetry) / sizeof(uint64_t)];
+
+		for (;;)
+		{
+			const uint32_t before = m_iSequence.load(memory_order_acquire);
+
+			if (before & 1) continue;
+
+			for (size_t i=0; i<sizeof(words) / sizeof(words[0]); ++i)
+			{
+				words[i] = m_Values[i].load(memory_order_relaxed);
+			}
+
+			atomic_thread_fence(memory_order_acquire);
+
+			if (m_iSequence.load(memory_order_relaxed) == before) break;
+		}
+
+		memcpy(&telemetry, words, sizeof(words));
+
+		return true;
+	}
+
+#else
+
+public:
+
+	bool Read(SSomTelemetry &telemetry) const
+	{
+		memset(&telemetry, 0, sizeof(telemetry));
+
+		return false;
+	}
+
+#endif
+
+};
+
+#endif
@@ -0,0 +1,94 @@
+#ifndef CTASKSCHEDULER_H_
+#define CTASKSCHEDULER_H_
+
+//------------------------------------------------------------------------
+//
+//  Name:   CTaskScheduler.h
+//
+//  Desc:   runs independent tasks on a set of worker threads, each with
+//          a queue of its own. A worker takes the newest task off its
+//          own queue, so a task that submits a follow up usually runs
+//          it next while its data is still in cache, and when its queue
+//          is empty it steals the oldest task from another worker's.
+//          Unlike CThreadPool, which runs one parallel loop at a time,
+//          tasks of any length can come and go while others run, and
+//          tasks may submit more tasks.
+//
+//          a task must not wait for another one. Tasks may share a
+//          CThreadPool, but their loops then take turns on it
+//
+//------------------------------------------------------------------------
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+
+using namespace std;
+
+
+class CTaskScheduler
+{
+
+private:
+
+	struct SQueue
+	{
+		mutex m_Mutex;
+		deque<function<void()> > m_Tasks;	//newest at the back
+	};
+
+	vector<SQueue*> m_vQueues;			//one per worker
+	vector<thread> m_Workers;
+	mutex m_Mutex;
+	condition_variable m_WorkReady;		//signalled when a task is queued or the scheduler shuts down
+	condition_variable m_AllDone;		//signalled when the last pending task finishes
+	atomic<int> m_iQueued;				//tasks sitting in a queue
+	atomic<int> m_iPending;				//tasks submitted and not finished yet
+	atomic<unsigned int> m_iNextQueue;	//where tasks from outside the workers go next
+	bool m_bStop;
+
+	CTaskScheduler(const CTaskScheduler&);
+	CTaskScheduler& operator=(const CTaskScheduler&);
+
+	void WorkerLoop(int worker);
+
+	/*
+	* takes a task off worker's own queue, or failing that steals one.
+	* Returns false if every queue is empty
+	*/
+	bool TakeTask(int worker, function<void()> &task);
+
+
+public:
+
+	/*
+	* starts NumThreads workers, or one per hardware thread if it is zero
+	*/
+	explicit CTaskScheduler(int NumThreads = 0);
+
+	/*
+	* waits for every task to finish before stopping the workers
+	*/
+	~CTaskScheduler();
+
+	/*
+	* queues a task. From a task it goes on the queue of the worker
+	* running it, from any other thread on the workers' queues in turn
+	*/
+	void Submit(const function<void()> &task);
+
+	/*
+	* blocks until every task submitted so far, and every task those
+	* submit, has finished. Don't call it from a task
+	*/
+	void Wait();
+
+	int GetNumThreads() const { return (int)m_Workers.size(); }
+
+};
+
+#endif
@@ -0,0 +1,96 @@
+#ifndef CTHREADPOOL_H_
+#define CTHREADPOOL_H_
+
+//------------------------------------------------------------------------
+//
+//  Name:   CThreadPool.h
+//
+//  Desc:   a fixed set of worker threads that run the tasks of a
+//          parallel loop. The calling thread takes part in the loop too
+//
+//------------------------------------------------------------------------
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+
+using namespace std;
+
+
+class CThreadPool
+{
+
+private:
+
+	vector<thread> m_Workers;				//the background threads (the caller is the extra one)
+	mutex m_Mutex;
+	mutex m_LoopMutex;						//lets one loop run at a time when several threads share the pool
+	condition_variable m_WorkReady;			//signalled when a new loop starts or the pool shuts down
+	condition_variable m_WorkDone;			//signalled when the last task finishes or a worker goes idle
+
+	const function<void(int)>* m_pTask;		//the body of the loop being run
+	int m_iNumTasks;						//how many tasks the loop has
+	atomic<int> m_iNextTask;				//the next task nobody has picked up yet
+	atomic<int> m_iTasksDone;				//how many tasks have finished
+	int m_iActive;							//workers still looking at the current loop
+	unsigned int m_iGeneration;				//bumped every time a loop starts
+	bool m_bStop;
+
+	CThreadPool(const CThreadPool&);
+	CThreadPool& operator=(const CThreadPool&);
+
+	void WorkerLoop();
+
+	void RunTasks();
+
+
+public:
+
+	/*
+	* creates a pool which runs loops on NumThreads threads, counting the
+	* caller. Zero means one thread per hardware thread
+	*/
+	explicit CThreadPool(int NumThreads = 0);
+
+	~CThreadPool();
+
+	/*
+	* calls task(i) for every i in [0, NumTasks) spread over the threads
+	* of the pool and returns when all of them are done. Tasks are handed
+	* out in order but may run in any order, so each task must only write
+	* data no other task touches. Loops started from several threads at
+	* once take turns; a task must not start a loop of its own
+	*/
+	void ParallelFor(int NumTasks, const function<void(int)> &task);
+
+	int GetNumThreads() const { return (int)m_Workers.size() + 1; }
+
+	/*
+	* how many ranges a loop over NumItems items is split into on pPool:
+	* no more than TasksPerThread per thread and no fewer than
+	* MinItemsPerTask items in each. Always one without a pool
+	*/
+	static int NumTasksFor(
+		const CThreadPool* pPool,
+		size_t NumItems,
+		size_t MinItemsPerTask = 1,
+		int TasksPerThread = 1
+	);
+
+	/*
+	* splits [0, NumItems) into NumTasks contiguous ranges and calls
+	* body(task, first, last) for each, on pPool if there is more than one
+	*/
+	static void RunRanges(
+		CThreadPool* pPool,
+		size_t NumItems,
+		int NumTasks,
+		const function<void(int, size_t, size_t)> &body
+	);
+
+};
+
+#endif
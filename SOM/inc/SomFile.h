@@ -0,0 +1,119 @@
+#ifndef SOMFILE_H_
+#define SOMFILE_H_
+
+//------------------------------------------------------------------------
+//
+//  Name:   SomFile.h
+//
+//  Desc:   layout of a saved map. The file is a fixed size header
+//          followed, at a 64 byte aligned offset, by the weight matrix
+//          exactly as a CCodebook holds it in memory (row major, every
+//          row padded with zeros to the stride). A mapped file can
+//          therefore be used as a codebook without copying anything
+//
+//------------------------------------------------------------------------
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "CCodebook.h"
+
+
+//the first bytes of every map file
+const char SomFileMagic[8] = { 'N', 'E', 'D', 'U', 'S', 'O', 'M', 0 };
+
+//bump this whenever the layout below changes
+const uint32_t SomFileVersion = 1;
+
+//written as is, so a file saved on a machine of the other byte order
+//reads back as 0x04030201 and is rejected
+const uint32_t SomFileByteOrder = 0x01020304;
+
+enum SomTopology
+{
+	SOM_TOPOLOGY_RECT		//rectangular grid, node n at row n / across, column n % across
+};
+
+enum SomScalar
+{
+	SOM_SCALAR_FLOAT64,
+	SOM_SCALAR_FLOAT32,
+	SOM_SCALAR_FLOAT16,		//IEEE half precision
+	SOM_SCALAR_INT8			//signed bytes, with a float scale per row
+};
+
+
+struct SSomFileHeader
+{
+	char szMagic[8];
+	uint32_t iVersion;
+	uint32_t iHeaderSize;			//sizeof(SSomFileHeader)
+	uint32_t iByteOrder;
+	uint32_t iScalarType;			//a SomScalar
+	uint32_t iTopology;				//a SomTopology
+	uint32_t iDim;					//weights per node
+	uint32_t iStride;				//elements between the starts of two rows
+	uint32_t iCellsAcross;
+	uint32_t iCellsUp;
+
+	//where training had got to, so a loaded map can carry on
+	uint32_t iTotalIterations;		//the length of the schedule
+	uint32_t iIterationCount;		//the next iteration of it
+	uint32_t iDone;					//non zero once training finished
+	double dMapRadius;
+	double dTimeConstant;
+	double dNeighbourhoodRadius;
+	double dLearningRate;
+
+	uint64_t iWeightsOffset;		//from the start of the file, a multiple of 64
+	uint64_t iWeightsBytes;			//iCellsAcross * iCellsUp * iStride elements
+
+	double dStartLearningRate;		//where the learning rate schedule starts, 0 for constStartLearningRate
+
+	uint8_t Reserved[16];			//zero, pads the header to two cache lines
+};
+
+static_assert(sizeof(SSomFileHeader) == 128, "the map file header must stay 128 bytes");
+
+
+/*
+* returns true if the size bytes at pData start with a header this
+* version understands, describing a weight matrix that fits in them
+*/
+inline bool IsValidSomFile(const void* pData, size_t size)
+{
+	if (size < sizeof(SSomFileHeader)) return false;
+
+	const SSomFileHeader* pHeader = (const SSomFileHeader*)pData;
+
+	if (memcmp(pHeader->szMagic, SomFileMagic, sizeof(SomFileMagic)) != 0) return false;
+
+	if (pHeader->iVersion    != SomFileVersion   ||
+	    pHeader->iHeaderSize != sizeof(SSomFileHeader) ||
+	    pHeader->iByteOrder  != SomFileByteOrder ||
+	    pHeader->iScalarType != SOM_SCALAR_FLOAT64 ||
+	    pHeader->iTopology   != SOM_TOPOLOGY_RECT)
+	{
+		return false;
+	}
+
+	if (pHeader->iDim == 0 || pHeader->iDim > 0x7ffffff8 ||
+	    pHeader->iStride != (uint32_t)CCodebook::StrideFor(pHeader->iDim) ||
+	    pHeader->iCellsAcross == 0 ||
+	    pHeader->iCellsUp == 0 ||
+	    (uint64_t)pHeader->iCellsAcross * pHeader->iCellsUp > 0x7fffffff)
+	{
+		return false;
+	}
+
+	uint64_t bytes = (uint64_t)pHeader->iCellsAcross * pHeader->iCellsUp *
+	                 pHeader->iStride * sizeof(double);
+
+	return pHeader->iWeightsBytes == bytes &&
+	       pHeader->iWeightsOffset % 64 == 0 &&
+	       pHeader->iWeightsOffset >= sizeof(SSomFileHeader) &&
+	       pHeader->iWeightsOffset + bytes <= size;
+}
+
+#endif
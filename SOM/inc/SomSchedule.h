@@ -0,0 +1,56 @@
+#ifndef SOMSCHEDULE_H_
+#define SOMSCHEDULE_H_
+
+//------------------------------------------------------------------------
+//
+//  Name:   SomSchedule.h
+//
+//  Desc:   the neighbourhood radius and learning rate of every iteration
+//          of a training run. CSom and CFixedSom both train by it, so it
+//          lives here once rather than in each of them
+//
+//------------------------------------------------------------------------
+
+#include <vector>
+#include <math.h>
+
+using namespace std;
+
+
+/*
+* fills RadiusSchedule and LearningRateSchedule with NumIterations + 1
+* values each, indexed by iteration count from 1 on. The radius shrinks
+* from MapRadius by exp(-it / TimeConstant), with the time constant
+* chosen so it reaches one cell at the end of the run, and the learning
+* rate falls from StartLearningRate towards zero. Returns the time
+* constant
+*/
+inline double BuildSomSchedules(int NumIterations,
+                                double MapRadius,
+                                double StartLearningRate,
+                                vector<double> &RadiusSchedule,
+                                vector<double> &LearningRateSchedule)
+{
+	//a map of up to 2 x 2 cells has a radius of 1 or less, whose log is
+	//no use as a time constant (it would keep the radius where it is, or
+	//make it grow); its radius decays over the whole run instead
+	const double TimeConstant = MapRadius > 1 ? NumIterations / log(MapRadius) : NumIterations;
+
+	RadiusSchedule.assign(NumIterations + 1, MapRadius);
+	LearningRateSchedule.assign(NumIterations + 1, StartLearningRate);
+
+	for (int it=1; it<=NumIterations; ++it)
+	{
+		RadiusSchedule[it] = MapRadius * exp(-(double)it / TimeConstant);
+
+		if (it > 1)
+		{
+			LearningRateSchedule[it] = StartLearningRate *
+			                           exp(-(double)(it - 1) / (NumIterations - (it - 1)));
+		}
+	}
+
+	return TimeConstant;
+}
+
+#endif
@@ -10,11 +10,19 @@ const int constNumCellsDown = 40;
 //represented by its red, green and blue components. (RGB)
 const int     constSizeOfInputVector   = 3;
 
+//number of EEG band powers the headset reports (delta, theta, low and
+//high alpha, low and high beta, low and mid gamma)
+const int     constNumEegBands         = 8;
+
 //the number of epochs desired for the training
 const int    constNumIterations       = 1000;
 
 //the value of the learning rate at the start of training
 const double constStartLearningRate   = 0.1;
 
+//maps with at least this many weights per node search batches of
+//vectors as a matrix product (see CSom::SetGemmMinDim)
+const int    constGemmMinDim          = 32;
+
 
 #endif
\ No newline at end of file
@@ -7,19 +7,44 @@
 #include <string>
 #include <iostream>
 #include <vector>
+#include <atomic>
+
+#include "CRandom.h"
+
+#ifdef _MSC_VER
+#include <malloc.h>
+#endif
 
 using namespace std;
 
+// returns the random number generator of the calling thread. Every
+// thread starts on a stream of its own, so threads never share a
+// generator or wait on each other for numbers
+inline CRandom& GetRandom()
+{
+	static atomic<int> NextStream(0);
+
+	static thread_local CRandom random = CRandom::Stream(0x5eed, NextStream++);
+
+	return random;
+}
+
+// restarts the calling thread's generator from seed
+inline void SeedRandom(uint64_t seed)
+{
+	GetRandom().Seed(seed);
+}
+
 // returns a random integer between x and y
 inline int RandInt(int x, int y)
 {
-	return rand() % (y - x + 1) + x;
+	return GetRandom().NextInt(x, y);
 }
 
 // returns a random float between zero and 1
 inline double RandFloat()
 {
-	return (rand()) / (RAND_MAX + 1.0);
+	return GetRandom().NextDouble();
 }
 
 // returns a random bool
@@ -83,4 +108,27 @@ inline int RoundUnderOffset(double val, double offset)
   return (mantissa < offset ? integral : ++integral);
 }
 
+// allocates a block of memory aligned to the given boundary
+// (which must be a power of two). Release it with AlignedFree
+inline void* AlignedAlloc(size_t size, size_t alignment)
+{
+#ifdef _MSC_VER
+	return _aligned_malloc(size, alignment);
+#else
+	void* ptr = NULL;
+	if(posix_memalign(&ptr, alignment, size) != 0) return NULL;
+	return ptr;
+#endif
+}
+
+// frees memory obtained from AlignedAlloc
+inline void AlignedFree(void* ptr)
+{
+#ifdef _MSC_VER
+	_aligned_free(ptr);
+#else
+	free(ptr);
+#endif
+}
+
 #endif
\ No newline at end of file
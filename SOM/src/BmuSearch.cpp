@@ -0,0 +1,1380 @@
+#include "BmuSearch.h"
+
+#include <float.h>
+#include <string.h>
+
+#include <algorithm>
+
+using namespace std;
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define SOM_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+//MSVC lets any function use any intrinsic, gcc and clang need to be told
+//which instruction sets a function is allowed to use
+#if defined(SOM_X86) && !defined(_MSC_VER)
+#define SOM_TARGET(isa) __attribute__((target(isa)))
+#else
+#define SOM_TARGET(isa)
+#endif
+
+
+//------------------------------ BmuScalar -------------------------------
+//
+//  the reference kernel, used when nothing better is available
+//------------------------------------------------------------------------
+static int BmuScalar(const double* pWeights,
+                     int stride,
+                     int dim,
+                     const double* pInput,
+                     int first,
+                     int last,
+                     double* pDistSq)
+{
+  int winner = -1;
+
+  double LowestDistance = DBL_MAX;
+
+  for (int n=first; n<last; ++n)
+  {
+    const double* pRow = pWeights + (size_t)n * stride;
+
+    double dist = 0;
+
+    for (int w=0; w<dim; ++w)
+    {
+      double diff = pInput[w] - pRow[w];
+
+      dist += diff * diff;
+    }
+
+    if (dist < LowestDistance)
+    {
+      LowestDistance = dist;
+
+      winner = n;
+    }
+  }
+
+  *pDistSq = LowestDistance;
+
+  return winner;
+}
+
+static void DistScalar(const double* pWeights,
+                       int stride,
+                       int dim,
+                       const double* pInput,
+                       int first,
+                       int last,
+                       double* pDistSq)
+{
+  for (int n=first; n<last; ++n)
+  {
+    const double* pRow = pWeights + (size_t)n * stride;
+
+    double dist = 0;
+
+    for (int w=0; w<dim; ++w)
+    {
+      double diff = pInput[w] - pRow[w];
+
+      dist += diff * diff;
+    }
+
+    pDistSq[n - first] = dist;
+  }
+}
+
+//------------------------------ DotScalar -------------------------------
+//
+//  the reference dot product kernel
+//------------------------------------------------------------------------
+static void DotScalar(const double* pWeights,
+                      int stride,
+                      int dim,
+                      const double* pInputs,
+                      int NumInputs,
+                      int first,
+                      int last,
+                      double* pDot)
+{
+  const int ld = last - first;
+
+  for (int i=0; i<NumInputs; ++i)
+  {
+    const double* pInput = pInputs + (size_t)i * stride;
+
+    for (int n=first; n<last; ++n)
+    {
+      const double* pRow = pWeights + (size_t)n * stride;
+
+      double dot = 0;
+
+      for (int w=0; w<dim; ++w)
+      {
+        dot += pInput[w] * pRow[w];
+      }
+
+      pDot[(size_t)i * ld + (n - first)] = dot;
+    }
+  }
+}
+
+#ifdef SOM_X86
+
+//picks the lowest (distance, index) pair out of the lanes of a register
+static inline void ReduceLanes(const double* lanes,
+                               const double* lanesIdx,
+                               int count,
+                               double &LowestDistance,
+                               int &winner)
+{
+  for (int l=0; l<count; ++l)
+  {
+    if (lanesIdx[l] < 0) continue;
+
+    if (lanes[l] < LowestDistance ||
+        (lanes[l] == LowestDistance && (int)lanesIdx[l] < winner))
+    {
+      LowestDistance = lanes[l];
+      winner = (int)lanesIdx[l];
+    }
+  }
+}
+
+//------------------------------ BmuSse2 ---------------------------------
+//
+//  two nodes per register. The squared differences of each node are
+//  accumulated across its row, then the two accumulators are folded into
+//  one register holding both distances so the compare and select of the
+//  argmin run on both nodes at once
+//------------------------------------------------------------------------
+SOM_TARGET("sse2")
+static inline __m128d SqDistSse2(const double* pRow, const double* pInput, int len)
+{
+  __m128d acc = _mm_setzero_pd();
+
+  for (int w=0; w<len; w+=2)
+  {
+    __m128d diff = _mm_sub_pd(_mm_loadu_pd(pInput + w), _mm_loadu_pd(pRow + w));
+
+    acc = _mm_add_pd(acc, _mm_mul_pd(diff, diff));
+  }
+
+  return acc;
+}
+
+SOM_TARGET("sse2")
+static int BmuSse2(const double* pWeights,
+                   int stride,
+                   int dim,
+                   const double* pInput,
+                   int first,
+                   int last,
+                   double* pDistSq)
+{
+  const int len = (dim + 1) & ~1;
+
+  __m128d best    = _mm_set1_pd(DBL_MAX);
+  __m128d bestIdx = _mm_set1_pd(-1);
+  __m128d idx     = _mm_set_pd(first + 1, first);
+  __m128d step    = _mm_set1_pd(2);
+
+  int n = first;
+
+  for (; n + 2 <= last; n += 2)
+  {
+    const double* pRow = pWeights + (size_t)n * stride;
+
+    __m128d a0 = SqDistSse2(pRow,          pInput, len);
+    __m128d a1 = SqDistSse2(pRow + stride, pInput, len);
+
+    //[a0.0 + a0.1, a1.0 + a1.1]
+    __m128d dist = _mm_add_pd(_mm_unpacklo_pd(a0, a1), _mm_unpackhi_pd(a0, a1));
+
+    __m128d mask = _mm_cmplt_pd(dist, best);
+
+    best    = _mm_or_pd(_mm_and_pd(mask, dist), _mm_andnot_pd(mask, best));
+    bestIdx = _mm_or_pd(_mm_and_pd(mask, idx),  _mm_andnot_pd(mask, bestIdx));
+
+    idx = _mm_add_pd(idx, step);
+  }
+
+  double lanes[2], lanesIdx[2];
+
+  _mm_storeu_pd(lanes, best);
+  _mm_storeu_pd(lanesIdx, bestIdx);
+
+  double LowestDistance = DBL_MAX;
+  int winner = -1;
+
+  ReduceLanes(lanes, lanesIdx, 2, LowestDistance, winner);
+
+  for (; n<last; ++n)
+  {
+    __m128d a = SqDistSse2(pWeights + (size_t)n * stride, pInput, len);
+
+    double dist = _mm_cvtsd_f64(_mm_add_sd(a, _mm_unpackhi_pd(a, a)));
+
+    if (dist < LowestDistance)
+    {
+      LowestDistance = dist;
+      winner = n;
+    }
+  }
+
+  *pDistSq = LowestDistance;
+
+  return winner;
+}
+
+SOM_TARGET("sse2")
+static void DistSse2(const double* pWeights,
+                     int stride,
+                     int dim,
+                     const double* pInput,
+                     int first,
+                     int last,
+                     double* pDistSq)
+{
+  const int len = (dim + 1) & ~1;
+
+  int n = first;
+
+  for (; n + 2 <= last; n += 2)
+  {
+    const double* pRow = pWeights + (size_t)n * stride;
+
+    __m128d a0 = SqDistSse2(pRow,          pInput, len);
+    __m128d a1 = SqDistSse2(pRow + stride, pInput, len);
+
+    _mm_storeu_pd(pDistSq + (n - first),
+                  _mm_add_pd(_mm_unpacklo_pd(a0, a1), _mm_unpackhi_pd(a0, a1)));
+  }
+
+  for (; n<last; ++n)
+  {
+    __m128d a = SqDistSse2(pWeights + (size_t)n * stride, pInput, len);
+
+    pDistSq[n - first] = _mm_cvtsd_f64(_mm_add_sd(a, _mm_unpackhi_pd(a, a)));
+  }
+}
+
+//------------------------------ DotSse2 ---------------------------------
+//
+//  the dot product kernels work on a register tile of I inputs by N
+//  nodes: every weight loaded is used I times and every input value N
+//  times, so the arithmetic rather than the loads sets the pace. Each
+//  pair gets an accumulator of its own, reduced in a fixed order, so a
+//  dot product comes out the same whichever tile computes it
+//------------------------------------------------------------------------
+template <int I, int N>
+SOM_TARGET("sse2")
+static inline void DotTileSse2(const double* pRows,
+                               int stride,
+                               int len,
+                               const double* pInputs,
+                               double* pDot,
+                               int ld)
+{
+  __m128d acc[I][N];
+
+  for (int i=0; i<I; ++i)
+    for (int n=0; n<N; ++n) acc[i][n] = _mm_setzero_pd();
+
+  for (int w=0; w<len; w+=2)
+  {
+    __m128d row[N];
+
+    for (int n=0; n<N; ++n) row[n] = _mm_loadu_pd(pRows + (size_t)n * stride + w);
+
+    for (int i=0; i<I; ++i)
+    {
+      __m128d x = _mm_loadu_pd(pInputs + (size_t)i * stride + w);
+
+      for (int n=0; n<N; ++n) acc[i][n] = _mm_add_pd(acc[i][n], _mm_mul_pd(x, row[n]));
+    }
+  }
+
+  for (int i=0; i<I; ++i)
+    for (int n=0; n<N; ++n)
+      pDot[(size_t)i * ld + n] = _mm_cvtsd_f64(_mm_add_sd(acc[i][n], _mm_unpackhi_pd(acc[i][n], acc[i][n])));
+}
+
+//I inputs against every node in [first, last)
+template <int I>
+SOM_TARGET("sse2")
+static inline void DotRowsSse2(const double* pWeights,
+                               int stride,
+                               int len,
+                               const double* pInputs,
+                               int first,
+                               int last,
+                               double* pDot,
+                               int ld)
+{
+  int n = first;
+
+  for (; n + 2 <= last; n += 2)
+  {
+    DotTileSse2<I, 2>(pWeights + (size_t)n * stride, stride, len, pInputs, pDot + (n - first), ld);
+  }
+
+  if (n < last)
+  {
+    DotTileSse2<I, 1>(pWeights + (size_t)n * stride, stride, len, pInputs, pDot + (n - first), ld);
+  }
+}
+
+SOM_TARGET("sse2")
+static void DotSse2(const double* pWeights,
+                    int stride,
+                    int dim,
+                    const double* pInputs,
+                    int NumInputs,
+                    int first,
+                    int last,
+                    double* pDot)
+{
+  const int len = (dim + 1) & ~1;
+  const int ld  = last - first;
+
+  for (int i=0; i<NumInputs; i+=4)
+  {
+    const double* pIn = pInputs + (size_t)i * stride;
+
+    double* pOut = pDot + (size_t)i * ld;
+
+    switch (min(4, NumInputs - i))
+    {
+      case 4:  DotRowsSse2<4>(pWeights, stride, len, pIn, first, last, pOut, ld); break;
+      case 3:  DotRowsSse2<3>(pWeights, stride, len, pIn, first, last, pOut, ld); break;
+      case 2:  DotRowsSse2<2>(pWeights, stride, len, pIn, first, last, pOut, ld); break;
+      default: DotRowsSse2<1>(pWeights, stride, len, pIn, first, last, pOut, ld); break;
+    }
+  }
+}
+
+//------------------------------ BmuAvx2 ---------------------------------
+//
+//  four nodes per register, same scheme as the SSE2 kernel. Every
+//  distance is reduced as (a0 + a1) + (a2 + a3) whether the node is part
+//  of a block of four or not, so the result doesn't depend on where a
+//  range starts
+//------------------------------------------------------------------------
+SOM_TARGET("avx2")
+static inline __m256d SqDistAvx2(const double* pRow, const double* pInput, int len)
+{
+  __m256d acc = _mm256_setzero_pd();
+
+  for (int w=0; w<len; w+=4)
+  {
+    __m256d diff = _mm256_sub_pd(_mm256_loadu_pd(pInput + w), _mm256_loadu_pd(pRow + w));
+
+    acc = _mm256_add_pd(acc, _mm256_mul_pd(diff, diff));
+  }
+
+  return acc;
+}
+
+//folds the accumulators of four nodes into one register of four distances
+SOM_TARGET("avx2")
+static inline __m256d Fold4(__m256d a0, __m256d a1, __m256d a2, __m256d a3)
+{
+  __m256d s01 = _mm256_hadd_pd(a0, a1);
+  __m256d s23 = _mm256_hadd_pd(a2, a3);
+
+  return _mm256_add_pd(_mm256_permute2f128_pd(s01, s23, 0x20),
+                       _mm256_permute2f128_pd(s01, s23, 0x31));
+}
+
+//reduces one node's accumulator in the same order as Fold4
+SOM_TARGET("avx2")
+static inline double Fold1(__m256d a)
+{
+  __m256d s = _mm256_hadd_pd(a, a);
+
+  return _mm_cvtsd_f64(_mm_add_sd(_mm256_castpd256_pd128(s), _mm256_extractf128_pd(s, 1)));
+}
+
+SOM_TARGET("avx2")
+static int BmuAvx2(const double* pWeights,
+                   int stride,
+                   int dim,
+                   const double* pInput,
+                   int first,
+                   int last,
+                   double* pDistSq)
+{
+  const int len = (dim + 3) & ~3;
+
+  __m256d best    = _mm256_set1_pd(DBL_MAX);
+  __m256d bestIdx = _mm256_set1_pd(-1);
+  __m256d idx     = _mm256_set_pd(first + 3, first + 2, first + 1, first);
+  __m256d step    = _mm256_set1_pd(4);
+
+  int n = first;
+
+  for (; n + 4 <= last; n += 4)
+  {
+    const double* pRow = pWeights + (size_t)n * stride;
+
+    __m256d dist = Fold4(SqDistAvx2(pRow,              pInput, len),
+                         SqDistAvx2(pRow + stride,     pInput, len),
+                         SqDistAvx2(pRow + 2 * stride, pInput, len),
+                         SqDistAvx2(pRow + 3 * stride, pInput, len));
+
+    __m256d mask = _mm256_cmp_pd(dist, best, _CMP_LT_OQ);
+
+    best    = _mm256_blendv_pd(best, dist, mask);
+    bestIdx = _mm256_blendv_pd(bestIdx, idx, mask);
+
+    idx = _mm256_add_pd(idx, step);
+  }
+
+  double lanes[4], lanesIdx[4];
+
+  _mm256_storeu_pd(lanes, best);
+  _mm256_storeu_pd(lanesIdx, bestIdx);
+
+  double LowestDistance = DBL_MAX;
+  int winner = -1;
+
+  ReduceLanes(lanes, lanesIdx, 4, LowestDistance, winner);
+
+  for (; n<last; ++n)
+  {
+    double dist = Fold1(SqDistAvx2(pWeights + (size_t)n * stride, pInput, len));
+
+    if (dist < LowestDistance)
+    {
+      LowestDistance = dist;
+      winner = n;
+    }
+  }
+
+  *pDistSq = LowestDistance;
+
+  return winner;
+}
+
+SOM_TARGET("avx2")
+static void DistAvx2(const double* pWeights,
+                     int stride,
+                     int dim,
+                     const double* pInput,
+                     int first,
+                     int last,
+                     double* pDistSq)
+{
+  const int len = (dim + 3) & ~3;
+
+  int n = first;
+
+  for (; n + 4 <= last; n += 4)
+  {
+    const double* pRow = pWeights + (size_t)n * stride;
+
+    _mm256_storeu_pd(pDistSq + (n - first),
+                     Fold4(SqDistAvx2(pRow,              pInput, len),
+                           SqDistAvx2(pRow + stride,     pInput, len),
+                           SqDistAvx2(pRow + 2 * stride, pInput, len),
+                           SqDistAvx2(pRow + 3 * stride, pInput, len)));
+  }
+
+  for (; n<last; ++n)
+  {
+    pDistSq[n - first] = Fold1(SqDistAvx2(pWeights + (size_t)n * stride, pInput, len));
+  }
+}
+
+//------------------------------ DotAvx2 ---------------------------------
+//
+//  4 inputs by 2 nodes, which with the loads takes 14 of the 16 ymm
+//  registers. This is the one kernel that uses FMA, which DetectBmuIsa
+//  requires along with AVX2
+//------------------------------------------------------------------------
+template <int I, int N>
+SOM_TARGET("avx2,fma")
+static inline void DotTileAvx2(const double* pRows,
+                               int stride,
+                               int len,
+                               const double* pInputs,
+                               double* pDot,
+                               int ld)
+{
+  __m256d acc[I][N];
+
+  for (int i=0; i<I; ++i)
+    for (int n=0; n<N; ++n) acc[i][n] = _mm256_setzero_pd();
+
+  for (int w=0; w<len; w+=4)
+  {
+    __m256d row[N];
+
+    for (int n=0; n<N; ++n) row[n] = _mm256_loadu_pd(pRows + (size_t)n * stride + w);
+
+    for (int i=0; i<I; ++i)
+    {
+      __m256d x = _mm256_loadu_pd(pInputs + (size_t)i * stride + w);
+
+      for (int n=0; n<N; ++n) acc[i][n] = _mm256_fmadd_pd(x, row[n], acc[i][n]);
+    }
+  }
+
+  for (int i=0; i<I; ++i)
+    for (int n=0; n<N; ++n) pDot[(size_t)i * ld + n] = Fold1(acc[i][n]);
+}
+
+template <int I>
+SOM_TARGET("avx2,fma")
+static inline void DotRowsAvx2(const double* pWeights,
+                               int stride,
+                               int len,
+                               const double* pInputs,
+                               int first,
+                               int last,
+                               double* pDot,
+                               int ld)
+{
+  int n = first;
+
+  for (; n + 2 <= last; n += 2)
+  {
+    DotTileAvx2<I, 2>(pWeights + (size_t)n * stride, stride, len, pInputs, pDot + (n - first), ld);
+  }
+
+  if (n < last)
+  {
+    DotTileAvx2<I, 1>(pWeights + (size_t)n * stride, stride, len, pInputs, pDot + (n - first), ld);
+  }
+}
+
+SOM_TARGET("avx2,fma")
+static void DotAvx2(const double* pWeights,
+                    int stride,
+                    int dim,
+                    const double* pInputs,
+                    int NumInputs,
+                    int first,
+                    int last,
+                    double* pDot)
+{
+  const int len = (dim + 3) & ~3;
+  const int ld  = last - first;
+
+  for (int i=0; i<NumInputs; i+=4)
+  {
+    const double* pIn = pInputs + (size_t)i * stride;
+
+    double* pOut = pDot + (size_t)i * ld;
+
+    switch (min(4, NumInputs - i))
+    {
+      case 4:  DotRowsAvx2<4>(pWeights, stride, len, pIn, first, last, pOut, ld); break;
+      case 3:  DotRowsAvx2<3>(pWeights, stride, len, pIn, first, last, pOut, ld); break;
+      case 2:  DotRowsAvx2<2>(pWeights, stride, len, pIn, first, last, pOut, ld); break;
+      default: DotRowsAvx2<1>(pWeights, stride, len, pIn, first, last, pOut, ld); break;
+    }
+  }
+}
+
+//gcc 12's own avx512 headers trip these warnings on the 512 -> 256 bit
+//casts, so they are off for the AVX-512 kernels only
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#endif
+
+//------------------------------ BmuAvx512 -------------------------------
+//
+//  eight nodes per register. Each 512 bit accumulator is first halved
+//  into 256 bits, then folded like the AVX2 kernel. Short rows (four
+//  weights or less) don't fill a 512 bit register, so they are handed to
+//  the AVX2 kernel
+//------------------------------------------------------------------------
+SOM_TARGET("avx512f")
+static inline __m256d SqDistAvx512(const double* pRow, const double* pInput, int len)
+{
+  __m512d acc = _mm512_setzero_pd();
+
+  for (int w=0; w<len; w+=8)
+  {
+    __m512d diff = _mm512_sub_pd(_mm512_loadu_pd(pInput + w), _mm512_loadu_pd(pRow + w));
+
+    acc = _mm512_add_pd(acc, _mm512_mul_pd(diff, diff));
+  }
+
+  return _mm256_add_pd(_mm512_castpd512_pd256(acc), _mm512_extractf64x4_pd(acc, 1));
+}
+
+SOM_TARGET("avx512f,avx2")
+static int BmuAvx512(const double* pWeights,
+                     int stride,
+                     int dim,
+                     const double* pInput,
+                     int first,
+                     int last,
+                     double* pDistSq)
+{
+  if (dim <= 4)
+  {
+    return BmuAvx2(pWeights, stride, dim, pInput, first, last, pDistSq);
+  }
+
+  const int len = (dim + 7) & ~7;
+
+  __m512d best    = _mm512_set1_pd(DBL_MAX);
+  __m512d bestIdx = _mm512_set1_pd(-1);
+  __m512d idx     = _mm512_set_pd(first + 7, first + 6, first + 5, first + 4,
+                                  first + 3, first + 2, first + 1, first);
+  __m512d step    = _mm512_set1_pd(8);
+
+  int n = first;
+
+  for (; n + 8 <= last; n += 8)
+  {
+    const double* pRow = pWeights + (size_t)n * stride;
+
+    __m256d lo = Fold4(SqDistAvx512(pRow,              pInput, len),
+                       SqDistAvx512(pRow + stride,     pInput, len),
+                       SqDistAvx512(pRow + 2 * stride, pInput, len),
+                       SqDistAvx512(pRow + 3 * stride, pInput, len));
+
+    __m256d hi = Fold4(SqDistAvx512(pRow + 4 * stride, pInput, len),
+                       SqDistAvx512(pRow + 5 * stride, pInput, len),
+                       SqDistAvx512(pRow + 6 * stride, pInput, len),
+                       SqDistAvx512(pRow + 7 * stride, pInput, len));
+
+    __m512d dist = _mm512_insertf64x4(_mm512_castpd256_pd512(lo), hi, 1);
+
+    __mmask8 mask = _mm512_cmp_pd_mask(dist, best, _CMP_LT_OQ);
+
+    best    = _mm512_mask_blend_pd(mask, best, dist);
+    bestIdx = _mm512_mask_blend_pd(mask, bestIdx, idx);
+
+    idx = _mm512_add_pd(idx, step);
+  }
+
+  double lanes[8], lanesIdx[8];
+
+  _mm512_storeu_pd(lanes, best);
+  _mm512_storeu_pd(lanesIdx, bestIdx);
+
+  double LowestDistance = DBL_MAX;
+  int winner = -1;
+
+  ReduceLanes(lanes, lanesIdx, 8, LowestDistance, winner);
+
+  for (; n<last; ++n)
+  {
+    double dist = Fold1(SqDistAvx512(pWeights + (size_t)n * stride, pInput, len));
+
+    if (dist < LowestDistance)
+    {
+      LowestDistance = dist;
+      winner = n;
+    }
+  }
+
+  *pDistSq = LowestDistance;
+
+  return winner;
+}
+
+SOM_TARGET("avx512f,avx2")
+static void DistAvx512(const double* pWeights,
+                       int stride,
+                       int dim,
+                       const double* pInput,
+                       int first,
+                       int last,
+                       double* pDistSq)
+{
+  if (dim <= 4)
+  {
+    DistAvx2(pWeights, stride, dim, pInput, first, last, pDistSq);
+
+    return;
+  }
+
+  const int len = (dim + 7) & ~7;
+
+  int n = first;
+
+  for (; n + 4 <= last; n += 4)
+  {
+    const double* pRow = pWeights + (size_t)n * stride;
+
+    _mm256_storeu_pd(pDistSq + (n - first),
+                     Fold4(SqDistAvx512(pRow,              pInput, len),
+                           SqDistAvx512(pRow + stride,     pInput, len),
+                           SqDistAvx512(pRow + 2 * stride, pInput, len),
+                           SqDistAvx512(pRow + 3 * stride, pInput, len)));
+  }
+
+  for (; n<last; ++n)
+  {
+    pDistSq[n - first] = Fold1(SqDistAvx512(pWeights + (size_t)n * stride, pInput, len));
+  }
+}
+
+//------------------------------ DotAvx512 -------------------------------
+//
+//  4 inputs by 4 nodes, 24 of the 32 zmm registers. Rows of four weights
+//  or less go to the AVX2 kernel, as for the distances
+//------------------------------------------------------------------------
+template <int I, int N>
+SOM_TARGET("avx512f,avx2,fma")
+static inline void DotTileAvx512(const double* pRows,
+                                 int stride,
+                                 int len,
+                                 const double* pInputs,
+                                 double* pDot,
+                                 int ld)
+{
+  __m512d acc[I][N];
+
+  for (int i=0; i<I; ++i)
+    for (int n=0; n<N; ++n) acc[i][n] = _mm512_setzero_pd();
+
+  for (int w=0; w<len; w+=8)
+  {
+    __m512d row[N];
+
+    for (int n=0; n<N; ++n) row[n] = _mm512_loadu_pd(pRows + (size_t)n * stride + w);
+
+    for (int i=0; i<I; ++i)
+    {
+      __m512d x = _mm512_loadu_pd(pInputs + (size_t)i * stride + w);
+
+      for (int n=0; n<N; ++n) acc[i][n] = _mm512_fmadd_pd(x, row[n], acc[i][n]);
+    }
+  }
+
+  for (int i=0; i<I; ++i)
+  {
+    for (int n=0; n<N; ++n)
+    {
+      pDot[(size_t)i * ld + n] = Fold1(_mm256_add_pd(_mm512_castpd512_pd256(acc[i][n]),
+                                                     _mm512_extractf64x4_pd(acc[i][n], 1)));
+    }
+  }
+}
+
+template <int I>
+SOM_TARGET("avx512f,avx2,fma")
+static inline void DotRowsAvx512(const double* pWeights,
+                                 int stride,
+                                 int len,
+                                 const double* pInputs,
+                                 int first,
+                                 int last,
+                                 double* pDot,
+                                 int ld)
+{
+  int n = first;
+
+  for (; n + 4 <= last; n += 4)
+  {
+    DotTileAvx512<I, 4>(pWeights + (size_t)n * stride, stride, len, pInputs, pDot + (n - first), ld);
+  }
+
+  for (; n<last; ++n)
+  {
+    DotTileAvx512<I, 1>(pWeights + (size_t)n * stride, stride, len, pInputs, pDot + (n - first), ld);
+  }
+}
+
+SOM_TARGET("avx512f,avx2,fma")
+static void DotAvx512(const double* pWeights,
+                      int stride,
+                      int dim,
+                      const double* pInputs,
+                      int NumInputs,
+                      int first,
+                      int last,
+                      double* pDot)
+{
+  if (dim <= 4)
+  {
+    DotAvx2(pWeights, stride, dim, pInputs, NumInputs, first, last, pDot);
+
+    return;
+  }
+
+  const int len = (dim + 7) & ~7;
+  const int ld  = last - first;
+
+  for (int i=0; i<NumInputs; i+=4)
+  {
+    const double* pIn = pInputs + (size_t)i * stride;
+
+    double* pOut = pDot + (size_t)i * ld;
+
+    switch (min(4, NumInputs - i))
+    {
+      case 4:  DotRowsAvx512<4>(pWeights, stride, len, pIn, first, last, pOut, ld); break;
+      case 3:  DotRowsAvx512<3>(pWeights, stride, len, pIn, first, last, pOut, ld); break;
+      case 2:  DotRowsAvx512<2>(pWeights, stride, len, pIn, first, last, pOut, ld); break;
+      default: DotRowsAvx512<1>(pWeights, stride, len, pIn, first, last, pOut, ld); break;
+    }
+  }
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+#endif //SOM_X86
+
+//------------------------------------------------------------------------
+//
+//  the reduced precision kernels. Each one is a template over the type
+//  the weights are stored in, which only changes how a run of them is
+//  loaded and widened to floats; the int8 weights are then scaled by
+//  their node's factor. The distance of a node is reduced in a fixed
+//  order, so it doesn't depend on where a range starts
+//------------------------------------------------------------------------
+
+template <int T>
+static inline float ReducedWeight(const char* pRow, int w)
+{
+  if (T == SOM_SCALAR_FLOAT32) return ((const float*)pRow)[w];
+  if (T == SOM_SCALAR_FLOAT16) return HalfToFloat(((const uint16_t*)pRow)[w]);
+
+  return (float)((const int8_t*)pRow)[w];
+}
+
+template <int T>
+static int ReducedBmuScalar(const void* pWeights,
+                            int stride,
+                            int dim,
+                            const float* pScales,
+                            const float* pInput,
+                            int first,
+                            int last,
+                            float* pDistSq)
+{
+  const size_t RowBytes = (size_t)stride * ScalarBytes(T);
+
+  int winner = -1;
+
+  float LowestDistance = FLT_MAX;
+
+  for (int n=first; n<last; ++n)
+  {
+    const char* pRow = (const char*)pWeights + n * RowBytes;
+
+    const float scale = T == SOM_SCALAR_INT8 ? pScales[n] : 1.0f;
+
+    float dist = 0;
+
+    for (int w=0; w<dim; ++w)
+    {
+      float diff = pInput[w] - scale * ReducedWeight<T>(pRow, w);
+
+      dist += diff * diff;
+    }
+
+    if (dist < LowestDistance)
+    {
+      LowestDistance = dist;
+
+      winner = n;
+    }
+  }
+
+  *pDistSq = LowestDistance;
+
+  return winner;
+}
+
+#ifdef SOM_X86
+
+//eight weights widened to floats
+template <int T>
+SOM_TARGET("avx2,fma,f16c")
+static inline __m256 LoadReducedAvx2(const char* pRow, int w)
+{
+  if (T == SOM_SCALAR_FLOAT32) return _mm256_loadu_ps((const float*)pRow + w);
+
+  if (T == SOM_SCALAR_FLOAT16)
+  {
+    return _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)((const uint16_t*)pRow + w)));
+  }
+
+  return _mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(_mm_loadl_epi64((const __m128i*)(pRow + w))));
+}
+
+SOM_TARGET("avx2")
+static inline float SumAvx2(__m256 a)
+{
+  __m128 s = _mm_add_ps(_mm256_castps256_ps128(a), _mm256_extractf128_ps(a, 1));
+
+  s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+
+  return _mm_cvtss_f32(_mm_add_ss(s, _mm_shuffle_ps(s, s, 1)));
+}
+
+template <int T>
+SOM_TARGET("avx2,fma,f16c")
+static int ReducedBmuAvx2(const void* pWeights,
+                          int stride,
+                          int dim,
+                          const float* pScales,
+                          const float* pInput,
+                          int first,
+                          int last,
+                          float* pDistSq)
+{
+  const size_t RowBytes = (size_t)stride * ScalarBytes(T);
+
+  const int len = (dim + 7) & ~7;
+
+  int winner = -1;
+
+  float LowestDistance = FLT_MAX;
+
+  for (int n=first; n<last; ++n)
+  {
+    const char* pRow = (const char*)pWeights + n * RowBytes;
+
+    const __m256 scale = _mm256_set1_ps(T == SOM_SCALAR_INT8 ? pScales[n] : 1.0f);
+
+    __m256 acc = _mm256_setzero_ps();
+
+    for (int w=0; w<len; w+=8)
+    {
+      __m256 x = _mm256_loadu_ps(pInput + w);
+
+      __m256 diff = T == SOM_SCALAR_INT8 ? _mm256_fnmadd_ps(LoadReducedAvx2<T>(pRow, w), scale, x)
+                                         : _mm256_sub_ps(x, LoadReducedAvx2<T>(pRow, w));
+
+      acc = _mm256_fmadd_ps(diff, diff, acc);
+    }
+
+    float dist = SumAvx2(acc);
+
+    if (dist < LowestDistance)
+    {
+      LowestDistance = dist;
+
+      winner = n;
+    }
+  }
+
+  *pDistSq = LowestDistance;
+
+  return winner;
+}
+
+//the same warnings as the double kernels above
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#endif
+
+//sixteen weights widened to floats
+template <int T>
+SOM_TARGET("avx512f,avx2,fma,f16c")
+static inline __m512 LoadReducedAvx512(const char* pRow, int w)
+{
+  if (T == SOM_SCALAR_FLOAT32) return _mm512_loadu_ps((const float*)pRow + w);
+
+  if (T == SOM_SCALAR_FLOAT16)
+  {
+    return _mm512_cvtph_ps(_mm256_loadu_si256((const __m256i*)((const uint16_t*)pRow + w)));
+  }
+
+  return _mm512_cvtepi32_ps(_mm512_cvtepi8_epi32(_mm_loadu_si128((const __m128i*)(pRow + w))));
+}
+
+template <int T>
+SOM_TARGET("avx512f,avx2,fma,f16c")
+static int ReducedBmuAvx512(const void* pWeights,
+                            int stride,
+                            int dim,
+                            const float* pScales,
+                            const float* pInput,
+                            int first,
+                            int last,
+                            float* pDistSq)
+{
+  //rows of 8 weights or less are only 8 wide
+  if (dim <= 8)
+  {
+    return ReducedBmuAvx2<T>(pWeights, stride, dim, pScales, pInput, first, last, pDistSq);
+  }
+
+  const size_t RowBytes = (size_t)stride * ScalarBytes(T);
+
+  const int len = (dim + 15) & ~15;
+
+  int winner = -1;
+
+  float LowestDistance = FLT_MAX;
+
+  for (int n=first; n<last; ++n)
+  {
+    const char* pRow = (const char*)pWeights + n * RowBytes;
+
+    const __m512 scale = _mm512_set1_ps(T == SOM_SCALAR_INT8 ? pScales[n] : 1.0f);
+
+    __m512 acc = _mm512_setzero_ps();
+
+    for (int w=0; w<len; w+=16)
+    {
+      __m512 x = _mm512_loadu_ps(pInput + w);
+
+      __m512 diff = T == SOM_SCALAR_INT8 ? _mm512_fnmadd_ps(LoadReducedAvx512<T>(pRow, w), scale, x)
+                                         : _mm512_sub_ps(x, LoadReducedAvx512<T>(pRow, w));
+
+      acc = _mm512_fmadd_ps(diff, diff, acc);
+    }
+
+    //halved to 256 bits and summed like the AVX2 kernel
+    float dist = SumAvx2(_mm256_add_ps(_mm512_castps512_ps256(acc),
+                                       _mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(acc), 1))));
+
+    if (dist < LowestDistance)
+    {
+      LowestDistance = dist;
+
+      winner = n;
+    }
+  }
+
+  *pDistSq = LowestDistance;
+
+  return winner;
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+#endif //SOM_X86
+
+#ifdef SOM_X86
+
+//------------------------------ CpuId -----------------------------------
+//
+//------------------------------------------------------------------------
+static void CpuId(unsigned int leaf, unsigned int subleaf, unsigned int regs[4])
+{
+#ifdef _MSC_VER
+  __cpuidex((int*)regs, (int)leaf, (int)subleaf);
+#else
+  __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+//returns the register states the OS saves on a context switch
+static unsigned long long XGetBv()
+{
+#ifdef _MSC_VER
+  return _xgetbv(0);
+#else
+  unsigned int eax, edx;
+
+  __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+
+  return ((unsigned long long)edx << 32) | eax;
+#endif
+}
+
+#endif //SOM_X86
+
+
+//---------------------------- DetectBmuIsa ------------------------------
+//
+//  an instruction set is only usable if the CPU has it and the OS saves
+//  the registers it uses, hence the xgetbv checks
+//------------------------------------------------------------------------
+BmuIsa DetectBmuIsa()
+{
+#ifdef SOM_X86
+  unsigned int regs[4];
+
+  CpuId(0, 0, regs);
+
+  const unsigned int MaxLeaf = regs[0];
+
+  CpuId(1, 0, regs);
+
+  const bool sse2    = (regs[3] & (1u << 26)) != 0;
+  const bool osxsave = (regs[2] & (1u << 27)) != 0;
+  const bool avx     = (regs[2] & (1u << 28)) != 0;
+  const bool fma     = (regs[2] & (1u << 12)) != 0;
+  const bool f16c    = (regs[2] & (1u << 29)) != 0;
+
+  if (!sse2) return BMU_ISA_SCALAR;
+
+  if (!osxsave || !avx || MaxLeaf < 7) return BMU_ISA_SSE2;
+
+  const unsigned long long xcr0 = XGetBv();
+
+  //xmm and ymm state
+  if ((xcr0 & 0x6) != 0x6) return BMU_ISA_SSE2;
+
+  CpuId(7, 0, regs);
+
+  const bool avx2    = (regs[1] & (1u << 5))  != 0;
+  const bool avx512f = (regs[1] & (1u << 16)) != 0;
+
+  //every AVX2 CPU so far has FMA and F16C as well, which the dot product
+  //and reduced precision kernels rely on
+  if (!avx2 || !fma || !f16c) return BMU_ISA_SSE2;
+
+  //opmask and zmm state
+  if (avx512f && (xcr0 & 0xE0) == 0xE0) return BMU_ISA_AVX512;
+
+  return BMU_ISA_AVX2;
+#else
+  return BMU_ISA_SCALAR;
+#endif
+}
+
+static BmuKernel KernelFor(BmuIsa isa)
+{
+  switch (isa)
+  {
+#ifdef SOM_X86
+    case BMU_ISA_SSE2:   return BmuSse2;
+    case BMU_ISA_AVX2:   return BmuAvx2;
+    case BMU_ISA_AVX512: return BmuAvx512;
+#endif
+    default:             return BmuScalar;
+  }
+}
+
+//the kernel is picked once, the first time anyone asks for it
+static DistKernel DistKernelFor(BmuIsa isa)
+{
+  switch (isa)
+  {
+#ifdef SOM_X86
+    case BMU_ISA_SSE2:   return DistSse2;
+    case BMU_ISA_AVX2:   return DistAvx2;
+    case BMU_ISA_AVX512: return DistAvx512;
+#endif
+    default:             return DistScalar;
+  }
+}
+
+static DotKernel DotKernelFor(BmuIsa isa)
+{
+  switch (isa)
+  {
+#ifdef SOM_X86
+    case BMU_ISA_SSE2:   return DotSse2;
+    case BMU_ISA_AVX2:   return DotAvx2;
+    case BMU_ISA_AVX512: return DotAvx512;
+#endif
+    default:             return DotScalar;
+  }
+}
+
+static BmuIsa& ActiveIsa()
+{
+  static BmuIsa isa = DetectBmuIsa();
+
+  return isa;
+}
+
+static BmuKernel& ActiveKernel()
+{
+  static BmuKernel kernel = KernelFor(ActiveIsa());
+
+  return kernel;
+}
+
+static DistKernel& ActiveDistKernel()
+{
+  static DistKernel kernel = DistKernelFor(ActiveIsa());
+
+  return kernel;
+}
+
+static DotKernel& ActiveDotKernel()
+{
+  static DotKernel kernel = DotKernelFor(ActiveIsa());
+
+  return kernel;
+}
+
+BmuIsa GetBmuIsa()
+{
+  return ActiveIsa();
+}
+
+bool SetBmuIsa(BmuIsa isa)
+{
+  if (isa > DetectBmuIsa()) return false;
+
+  ActiveIsa()    = isa;
+  ActiveKernel() = KernelFor(isa);
+
+  ActiveDistKernel() = DistKernelFor(isa);
+  ActiveDotKernel()  = DotKernelFor(isa);
+
+  return true;
+}
+
+BmuKernel GetBmuKernel()
+{
+  return ActiveKernel();
+}
+
+DistKernel GetDistKernel()
+{
+  return ActiveDistKernel();
+}
+
+DotKernel GetDotKernel()
+{
+  return ActiveDotKernel();
+}
+
+template <int T>
+static ReducedBmuKernel ReducedKernelFor(BmuIsa isa)
+{
+  switch (isa)
+  {
+#ifdef SOM_X86
+    case BMU_ISA_AVX2:   return ReducedBmuAvx2<T>;
+    case BMU_ISA_AVX512: return ReducedBmuAvx512<T>;
+#endif
+    default:             return ReducedBmuScalar<T>;
+  }
+}
+
+ReducedBmuKernel GetReducedBmuKernel(SomScalar scalar)
+{
+  switch (scalar)
+  {
+    case SOM_SCALAR_FLOAT32: return ReducedKernelFor<SOM_SCALAR_FLOAT32>(GetBmuIsa());
+    case SOM_SCALAR_FLOAT16: return ReducedKernelFor<SOM_SCALAR_FLOAT16>(GetBmuIsa());
+    case SOM_SCALAR_INT8:    return ReducedKernelFor<SOM_SCALAR_INT8>(GetBmuIsa());
+    default:                 return NULL;
+  }
+}
+
+//----------------------------- FloatToHalf ------------------------------
+//
+//  done on the bits, so it works without F16C and rounds the same way
+//  as the hardware conversion
+//------------------------------------------------------------------------
+uint16_t FloatToHalf(float value)
+{
+  uint32_t bits;
+
+  memcpy(&bits, &value, sizeof(bits));
+
+  const uint32_t sign = (bits >> 16) & 0x8000;
+  const uint32_t abs  = bits & 0x7fffffff;
+
+  //infinity, and NaN made quiet with the top of its payload kept
+  if (abs == 0x7f800000) return (uint16_t)(sign | 0x7c00);
+  if (abs >  0x7f800000) return (uint16_t)(sign | 0x7e00 | ((abs >> 13) & 0x3ff));
+
+  //65520 and up round to infinity
+  if (abs >= 0x477ff000) return (uint16_t)(sign | 0x7c00);
+
+  //below the smallest normal half the result is subnormal, or zero from
+  //half the smallest subnormal down
+  if (abs < 0x38800000)
+  {
+    if (abs <= 0x33000000) return (uint16_t)sign;
+
+    const uint32_t mantissa = (abs & 0x7fffff) | 0x800000;
+    const int shift = 126 - (int)(abs >> 23);
+
+    uint32_t half = mantissa >> shift;
+
+    const uint32_t rest    = mantissa & ((1u << shift) - 1);
+    const uint32_t halfway = 1u << (shift - 1);
+
+    if (rest > halfway || (rest == halfway && (half & 1))) ++half;
+
+    return (uint16_t)(sign | half);
+  }
+
+  //rebias the exponent from 127 to 15 and round off 13 bits of mantissa.
+  //A carry out of the mantissa correctly moves up to the next exponent
+  uint32_t half = (abs - 0x38000000) >> 13;
+
+  const uint32_t rest = abs & 0x1fff;
+
+  if (rest > 0x1000 || (rest == 0x1000 && (half & 1))) ++half;
+
+  return (uint16_t)(sign | half);
+}
+
+float HalfToFloat(uint16_t half)
+{
+  const uint32_t sign = (uint32_t)(half & 0x8000) << 16;
+
+  uint32_t exponent = (half >> 10) & 0x1f;
+  uint32_t mantissa = half & 0x3ff;
+  uint32_t bits;
+
+  if (exponent == 0x1f)
+  {
+    bits = sign | 0x7f800000 | (mantissa << 13);
+
+    if (mantissa) bits |= 0x400000;
+  }
+
+  else if (exponent != 0)
+  {
+    bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+  }
+
+  else if (mantissa == 0)
+  {
+    bits = sign;
+  }
+
+  else
+  {
+    //subnormal, normalized for the float's wider exponent
+    exponent = 113;
+
+    while (!(mantissa & 0x400))
+    {
+      mantissa <<= 1;
+      --exponent;
+    }
+
+    bits = sign | (exponent << 23) | ((mantissa & 0x3ff) << 13);
+  }
+
+  float value;
+
+  memcpy(&value, &bits, sizeof(value));
+
+  return value;
+}
+
+const char* GetBmuIsaName(BmuIsa isa)
+{
+  switch (isa)
+  {
+    case BMU_ISA_SSE2:   return "sse2";
+    case BMU_ISA_AVX2:   return "avx2";
+    case BMU_ISA_AVX512: return "avx512";
+    default:             return "scalar";
+  }
+}
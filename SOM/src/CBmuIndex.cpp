@@ -0,0 +1,278 @@
+#include "CBmuIndex.h"
+#include "BmuSearch.h"
+
+#include <algorithm>
+#include <float.h>
+#include <string.h>
+
+
+//an entry of the queue of subtrees still to be searched, ordered by the
+//smallest squared distance any node inside could have
+struct SPending
+{
+	double dBound;
+	int iNode;
+
+	bool operator>(const SPending &rhs) const { return dBound > rhs.dBound; }
+};
+
+
+CBmuIndex::~CBmuIndex()
+{
+	if (m_pWeights) AlignedFree(m_pWeights);
+}
+
+//------------------------------- Build ----------------------------------
+//
+//------------------------------------------------------------------------
+bool CBmuIndex::Build(const CCodebook &codebook, int LeafSize)
+{
+	return Build(codebook.GetWeights(),
+	      codebook.GetNumNodes(),
+	      codebook.GetDim(),
+	      codebook.GetStride(),
+	      LeafSize);
+}
+
+bool CBmuIndex::Build(const double* pWeights,
+                      int NumNodes,
+                      int dim,
+                      int stride,
+                      int LeafSize)
+{
+	m_Tree.clear();
+
+	if (m_pWeights) AlignedFree(m_pWeights);
+
+	//the rows are copied in here in leaf order once the tree is built, so
+	//every leaf is one contiguous block the BMU kernel can scan
+	m_pWeights = (double*)AlignedAlloc((size_t)NumNodes * stride * sizeof(double), 64);
+
+	if (!m_pWeights)
+	{
+		m_iNumNodes = 0;
+		m_vNodeId.clear();
+
+		return false;
+	}
+
+	m_iNumNodes = NumNodes;
+	m_iDim      = dim;
+	m_iStride   = stride;
+
+	m_vNodeId.resize(NumNodes);
+
+	for (int n=0; n<NumNodes; ++n)
+	{
+		m_vNodeId[n] = n;
+	}
+
+	if (NumNodes > 0)
+	{
+		BuildNode(pWeights, 0, NumNodes, max(1, LeafSize));
+	}
+
+	for (int n=0; n<NumNodes; ++n)
+	{
+		memcpy(m_pWeights + (size_t)n * stride,
+		       pWeights + (size_t)m_vNodeId[n] * stride,
+		       stride * sizeof(double));
+	}
+
+	return true;
+}
+
+//----------------------------- BuildNode --------------------------------
+//
+//  splits the nodes in [first, last) at the median of the weight with
+//  the largest spread, and returns the index of the new tree node
+//------------------------------------------------------------------------
+int CBmuIndex::BuildNode(const double* pWeights, int first, int last, int LeafSize)
+{
+	SKdNode node;
+
+	node.iSplitDim = -1;
+	node.dSplit    = 0;
+	node.iLeft     = -1;
+	node.iRight    = -1;
+	node.iFirst    = first;
+	node.iLast     = last;
+
+	const int self = (int)m_Tree.size();
+
+	m_Tree.push_back(node);
+
+	if (last - first <= LeafSize) return self;
+
+	int SplitDim = -1;
+
+	double LargestSpread = 0;
+
+	for (int w=0; w<m_iDim; ++w)
+	{
+		double lo = DBL_MAX, hi = -DBL_MAX;
+
+		for (int i=first; i<last; ++i)
+		{
+			double v = pWeights[(size_t)m_vNodeId[i] * m_iStride + w];
+
+			lo = min(lo, v);
+			hi = max(hi, v);
+		}
+
+		if (hi - lo > LargestSpread)
+		{
+			LargestSpread = hi - lo;
+			SplitDim = w;
+		}
+	}
+
+	//all the nodes are identical, nothing to split on
+	if (SplitDim < 0) return self;
+
+	const int mid = first + (last - first) / 2;
+
+	const int stride = m_iStride;
+
+	nth_element(m_vNodeId.begin() + first,
+	            m_vNodeId.begin() + mid,
+	            m_vNodeId.begin() + last,
+	            [&](int a, int b)
+	{
+		return pWeights[(size_t)a * stride + SplitDim] < pWeights[(size_t)b * stride + SplitDim];
+	});
+
+	const double split = pWeights[(size_t)m_vNodeId[mid] * stride + SplitDim];
+
+	int left  = BuildNode(pWeights, first, mid, LeafSize);
+	int right = BuildNode(pWeights, mid, last, LeafSize);
+
+	m_Tree[self].iSplitDim = SplitDim;
+	m_Tree[self].dSplit    = split;
+	m_Tree[self].iLeft     = left;
+	m_Tree[self].iRight    = right;
+
+	return self;
+}
+
+//------------------------------- Search ---------------------------------
+//
+//  best bin first: subtrees are searched in order of how close they could
+//  possibly be to the input, and the search stops once none of them can
+//  beat the best node found so far, or after MaxLeaves leaves if that
+//  isn't zero. Returns a row of m_pWeights
+//------------------------------------------------------------------------
+int CBmuIndex::Search(const double* pInput, int MaxLeaves, double* pDistSq) const
+{
+	//each thread keeps its own queue so queries don't allocate
+	static thread_local vector<SPending> pending;
+
+	BmuKernel kernel = GetBmuKernel();
+
+	double LowestDistance = DBL_MAX;
+
+	int winner = -1;
+
+	int LeavesSearched = 0;
+
+	pending.clear();
+
+	SPending root = { 0, 0 };
+
+	pending.push_back(root);
+
+	while (!pending.empty())
+	{
+		pop_heap(pending.begin(), pending.end(), greater<SPending>());
+
+		SPending next = pending.back();
+
+		pending.pop_back();
+
+		if (next.dBound >= LowestDistance) break;
+
+		//walk down to the leaf on the input's side of every split,
+		//queueing the other side
+		const SKdNode* pNode = &m_Tree[next.iNode];
+
+		while (pNode->iSplitDim >= 0)
+		{
+			double diff = pInput[pNode->iSplitDim] - pNode->dSplit;
+
+			SPending far;
+
+			far.dBound = max(next.dBound, diff * diff);
+			far.iNode  = diff < 0 ? pNode->iRight : pNode->iLeft;
+
+			if (far.dBound < LowestDistance)
+			{
+				pending.push_back(far);
+
+				push_heap(pending.begin(), pending.end(), greater<SPending>());
+			}
+
+			pNode = &m_Tree[diff < 0 ? pNode->iLeft : pNode->iRight];
+		}
+
+		double dist;
+
+		int best = kernel(m_pWeights, m_iStride, m_iDim, pInput, pNode->iFirst, pNode->iLast, &dist);
+
+		if (best >= 0 && dist < LowestDistance)
+		{
+			LowestDistance = dist;
+			winner = best;
+		}
+
+		if (MaxLeaves > 0 && ++LeavesSearched >= MaxLeaves) break;
+	}
+
+	if (pDistSq) *pDistSq = LowestDistance;
+
+	return winner;
+}
+
+//------------------------ FindBestMatchingNode --------------------------
+//
+//------------------------------------------------------------------------
+int CBmuIndex::FindBestMatchingNode(const double* pInput, double* pDistSq) const
+{
+	if (m_iNumNodes == 0) return -1;
+
+	//the kernel wants the input padded like the rows
+	static thread_local vector<double> input;
+
+	input.assign(m_iStride, 0);
+
+	memcpy(&input[0], pInput, m_iDim * sizeof(double));
+
+	int winner = Search(&input[0], m_iMaxLeaves, pDistSq);
+
+	return winner < 0 ? -1 : m_vNodeId[winner];
+}
+
+//--------------------------- MeasureRecall ------------------------------
+//
+//------------------------------------------------------------------------
+double CBmuIndex::MeasureRecall(const vector<vector<double> > &samples) const
+{
+	if (samples.empty() || m_iNumNodes == 0) return 1.0;
+
+	vector<double> input(m_iStride, 0);
+
+	int hits = 0;
+
+	for (size_t s=0; s<samples.size(); ++s)
+	{
+		memcpy(&input[0], &samples[s][0], m_iDim * sizeof(double));
+
+		double exact, found;
+
+		Search(&input[0], 0, &exact);
+		Search(&input[0], m_iMaxLeaves, &found);
+
+		if (found <= exact) ++hits;
+	}
+
+	return (double)hits / samples.size();
+}
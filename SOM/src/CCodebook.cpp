@@ -0,0 +1,127 @@
+#include "CCodebook.h"
+
+#include <string.h>
+#include <algorithm>
+
+
+//--------------------------- Create -------------------------------------
+//
+//  allocates the weight matrix and the grid coordinate arrays. Nodes are
+//  laid out row by row, so node n sits at column n % CellsAcross and
+//  row n / CellsAcross
+//------------------------------------------------------------------------
+bool CCodebook::Create(int CellsUp, int CellsAcross, int dim, CRandom* pRandom)
+{
+	Release();
+
+	SetShape(CellsUp, CellsAcross, dim);
+
+	size_t bytes = (size_t)m_iNumNodes * m_iStride * sizeof(double);
+
+	m_pWeights = (double*)AlignedAlloc(bytes, 64);
+
+	if (!m_pWeights)
+	{
+		Release();
+
+		return false;
+	}
+
+	m_bOwner = true;
+
+	//the padding has to stay zero for the distance loops
+	memset(m_pWeights, 0, bytes);
+
+	CRandom &random = pRandom ? *pRandom : GetRandom();
+
+	for (int n=0; n<m_iNumNodes; ++n)
+	{
+		//initialize the weights to small random variables
+		double* pRow = GetRow(n);
+
+		for (int w=0; w<dim; ++w)
+		{
+			pRow[w] = random.NextDouble();
+		}
+	}
+
+	return true;
+}
+
+//--------------------------- Attach -------------------------------------
+//
+//------------------------------------------------------------------------
+void CCodebook::Attach(const double* pWeights, int CellsUp, int CellsAcross, int dim)
+{
+	Release();
+
+	SetShape(CellsUp, CellsAcross, dim);
+
+	//the codebook never writes through the pointer while it doesn't own
+	//it, training refuses to run on a read only codebook
+	m_pWeights = const_cast<double*>(pWeights);
+	m_bOwner   = false;
+}
+
+//---------------------------- Swap --------------------------------------
+//
+//------------------------------------------------------------------------
+void CCodebook::Swap(CCodebook &other)
+{
+	swap(m_pWeights,     other.m_pWeights);
+	swap(m_iNumNodes,    other.m_iNumNodes);
+	swap(m_iCellsAcross, other.m_iCellsAcross);
+	swap(m_iCellsUp,     other.m_iCellsUp);
+	swap(m_iDim,         other.m_iDim);
+	swap(m_iStride,      other.m_iStride);
+	swap(m_bOwner,       other.m_bOwner);
+
+	m_GridX.swap(other.m_GridX);
+	m_GridY.swap(other.m_GridY);
+}
+
+//--------------------------- SetShape -----------------------------------
+//
+//  sets the sizes and fills in the grid coordinate arrays
+//------------------------------------------------------------------------
+void CCodebook::SetShape(int CellsUp, int CellsAcross, int dim)
+{
+	m_iCellsUp     = CellsUp;
+	m_iCellsAcross = CellsAcross;
+	m_iNumNodes    = CellsUp * CellsAcross;
+	m_iDim         = dim;
+	m_iStride      = StrideFor(dim);
+
+	m_GridX.resize(m_iNumNodes);
+	m_GridY.resize(m_iNumNodes);
+
+	for (int row=0; row<CellsUp; ++row)
+	{
+		for (int col=0; col<CellsAcross; ++col)
+		{
+			int n = row * CellsAcross + col;
+
+			m_GridX[n] = col;
+			m_GridY[n] = row;
+		}
+	}
+}
+
+//--------------------------- Release ------------------------------------
+//
+//------------------------------------------------------------------------
+void CCodebook::Release()
+{
+	if (m_pWeights && m_bOwner)
+	{
+		AlignedFree(m_pWeights);
+	}
+
+	m_pWeights = NULL;
+	m_bOwner   = false;
+
+	m_GridX.clear();
+	m_GridY.clear();
+
+	m_iNumNodes = 0;
+}
@@ -1,6 +1,8 @@
 #include "CController.h"
 
 
+#ifdef _WIN32
+
 //---------------------------- Render ------------------------------------
 //
 //------------------------------------------------------------------------
@@ -8,6 +10,8 @@ void CController::Render(HDC surface)
 {
   m_pSOM->Render(surface);
 }
+
+#endif
               
       
 //--------------------------- Train --------------------------------------
@@ -18,7 +22,10 @@ bool CController::Train()
 {
   if (!m_pSOM->FinishedTraining())
   {
-    if (!m_pSOM->Epoch(m_TrainingSet))
+    bool ok = m_bBatchTraining ? m_pSOM->BatchEpoch(m_TrainingSet)
+                               : m_pSOM->Epoch(m_TrainingSet);
+
+    if (!ok)
     {
       return false;
     }
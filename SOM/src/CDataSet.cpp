@@ -0,0 +1,416 @@
+#include "CDataSet.h"
+#include "SomFile.h"
+
+#include <stdio.h>
+#include <math.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+using namespace std;
+
+
+//a pass over the set is split into chunks of about this many bytes
+static const size_t ChunkBytes = 64 << 20;
+
+//ImportCsv parses the text this many bytes at a time
+static const size_t CsvBlockBytes = 64 << 20;
+
+
+//------------------------------- Open -----------------------------------
+//
+//------------------------------------------------------------------------
+bool CDataSet::Open(const char* path)
+{
+	Close();
+
+	CFileMapping file;
+
+	if (!file.Open(path) || file.GetSize() < sizeof(SDataSetHeader)) return false;
+
+	const SDataSetHeader* pHeader = (const SDataSetHeader*)file.GetData();
+
+	if (memcmp(pHeader->szMagic, DataSetMagic, sizeof(DataSetMagic)) != 0 ||
+	    pHeader->iVersion    != DataSetVersion ||
+	    pHeader->iHeaderSize != sizeof(SDataSetHeader) ||
+	    pHeader->iByteOrder  != SomFileByteOrder ||
+	    pHeader->iScalarType != SOM_SCALAR_FLOAT32 ||
+	    pHeader->iDim == 0 || pHeader->iDim > 0x7fffffff ||
+	    pHeader->iDataOffset % 64 != 0 ||
+	    pHeader->iDataOffset < sizeof(SDataSetHeader) ||
+	    pHeader->iDataOffset > file.GetSize())
+	{
+		return false;
+	}
+
+	//written as a division so a corrupt count can't overflow
+	if (pHeader->iNumVectors > (file.GetSize() - pHeader->iDataOffset) / (pHeader->iDim * sizeof(float)))
+	{
+		return false;
+	}
+
+	m_pData       = (const float*)((const char*)file.GetData() + pHeader->iDataOffset);
+	m_iNumVectors = (size_t)pHeader->iNumVectors;
+	m_iDim        = (int)pHeader->iDim;
+
+	m_Mapping.Swap(file);
+
+	return true;
+}
+
+//------------------------------- Close ----------------------------------
+//
+//------------------------------------------------------------------------
+void CDataSet::Close()
+{
+	m_Mapping.Close();
+
+	m_pData       = NULL;
+	m_iNumVectors = 0;
+	m_iDim        = 0;
+}
+
+//---------------------------- GetChunkSize ------------------------------
+//
+//------------------------------------------------------------------------
+size_t CDataSet::GetChunkSize() const
+{
+	return max((size_t)1, ChunkBytes / (max(1, m_iDim) * sizeof(float)));
+}
+
+//------------------------------ WillNeed --------------------------------
+//
+//------------------------------------------------------------------------
+void CDataSet::WillNeed(size_t first, size_t NumVectors) const
+{
+	const size_t offset = (const char*)GetVector(first) - (const char*)m_Mapping.GetData();
+
+	m_Mapping.WillNeed(offset, NumVectors * m_iDim * sizeof(float));
+}
+
+void CDataSet::DontNeed(size_t first, size_t NumVectors) const
+{
+	const size_t offset = (const char*)GetVector(first) - (const char*)m_Mapping.GetData();
+
+	m_Mapping.DontNeed(offset, NumVectors * m_iDim * sizeof(float));
+}
+
+
+//------------------------------------------------------------------------
+//
+//  writing. The vectors go to a temporary file next to the target, with
+//  the header filled in once their number is known, and the file is only
+//  renamed over the target when it is complete, so anyone who has the
+//  old one mapped keeps seeing it intact
+//------------------------------------------------------------------------
+
+static FILE* BeginWrite(const string &temp)
+{
+	FILE* pFile = fopen(temp.c_str(), "wb");
+
+	if (!pFile) return NULL;
+
+	//room for the header, filled in by EndWrite
+	static const char zeros[64] = { 0 };
+
+	if (fwrite(zeros, 1, sizeof(zeros), pFile) != sizeof(zeros))
+	{
+		fclose(pFile);
+		remove(temp.c_str());
+
+		return NULL;
+	}
+
+	return pFile;
+}
+
+static bool EndWrite(FILE* pFile, const string &temp, const char* path, size_t NumVectors, int dim, bool ok)
+{
+	SDataSetHeader header;
+
+	memset(&header, 0, sizeof(header));
+
+	memcpy(header.szMagic, DataSetMagic, sizeof(DataSetMagic));
+
+	header.iVersion    = DataSetVersion;
+	header.iHeaderSize = sizeof(SDataSetHeader);
+	header.iByteOrder  = SomFileByteOrder;
+	header.iScalarType = SOM_SCALAR_FLOAT32;
+	header.iDim        = dim;
+	header.iNumVectors = NumVectors;
+	header.iDataOffset = 64;
+
+	ok = ok && fseek(pFile, 0, SEEK_SET) == 0 &&
+	     fwrite(&header, sizeof(header), 1, pFile) == 1;
+
+	ok = (fclose(pFile) == 0) && ok;
+
+#ifdef _WIN32
+	//rename won't replace an existing file on Windows
+	if (ok) remove(path);
+#endif
+
+	if (ok) ok = rename(temp.c_str(), path) == 0;
+
+	if (!ok) remove(temp.c_str());
+
+	return ok;
+}
+
+//------------------------------- Write ----------------------------------
+//
+//------------------------------------------------------------------------
+bool CDataSet::Write(const char* path, const float* pData, size_t NumVectors, int dim)
+{
+	if (dim <= 0) return false;
+
+	const string temp = string(path) + ".tmp";
+
+	FILE* pFile = BeginWrite(temp);
+
+	if (!pFile) return false;
+
+	const size_t count = NumVectors * dim;
+
+	bool ok = fwrite(pData, sizeof(float), count, pFile) == count;
+
+	return EndWrite(pFile, temp, path, NumVectors, dim, ok);
+}
+
+
+//------------------------------------------------------------------------
+//
+//  CSV parsing. The text is mapped rather than NUL terminated, so every
+//  scan is bounded by an end pointer instead of using strtod
+//------------------------------------------------------------------------
+
+static inline bool IsBlank(char c) { return c == ' ' || c == '\t'; }
+
+static inline bool IsSeparator(char c) { return c == ',' || c == ';'; }
+
+static inline bool IsLineEnd(char c) { return c == '\n' || c == '\r'; }
+
+static inline bool IsDigit(char c) { return c >= '0' && c <= '9'; }
+
+//parses a decimal number with an optional sign, fraction and exponent
+static bool ParseNumber(const char* &p, const char* end, double &value)
+{
+	bool negative = false;
+
+	if (p < end && (*p == '-' || *p == '+')) negative = *p++ == '-';
+
+	uint64_t mantissa = 0;
+
+	int scale = 0, digits = 0;
+
+	for (; p < end && IsDigit(*p); ++p, ++digits)
+	{
+		//digits past what fits in the mantissa only move the point
+		if (mantissa < 1000000000000000000ULL) mantissa = mantissa * 10 + (*p - '0');
+		else ++scale;
+	}
+
+	if (p < end && *p == '.')
+	{
+		for (++p; p < end && IsDigit(*p); ++p, ++digits)
+		{
+			if (mantissa < 1000000000000000000ULL)
+			{
+				mantissa = mantissa * 10 + (*p - '0');
+				--scale;
+			}
+		}
+	}
+
+	if (digits == 0) return false;
+
+	if (p < end && (*p == 'e' || *p == 'E'))
+	{
+		++p;
+
+		bool NegativeExp = false;
+
+		if (p < end && (*p == '-' || *p == '+')) NegativeExp = *p++ == '-';
+
+		if (p == end || !IsDigit(*p)) return false;
+
+		int exponent = 0;
+
+		for (; p < end && IsDigit(*p); ++p)
+		{
+			exponent = min(exponent * 10 + (*p - '0'), 100000);
+		}
+
+		scale += NegativeExp ? -exponent : exponent;
+	}
+
+	value = (double)mantissa * pow(10.0, scale);
+
+	if (negative) value = -value;
+
+	return true;
+}
+
+//parses the line at p, moving p past its end. Returns the number of
+//values on it, 0 for a blank line, or -1 if it isn't all numbers
+static int ParseLine(const char* &p, const char* end, vector<float>* pOut)
+{
+	while (p < end && IsBlank(*p)) ++p;
+
+	int count = 0;
+
+	while (p < end && !IsLineEnd(*p))
+	{
+		double value;
+
+		if (!ParseNumber(p, end, value)) return -1;
+
+		if (pOut) pOut->push_back((float)value);
+
+		++count;
+
+		while (p < end && IsBlank(*p)) ++p;
+
+		if (p < end && IsSeparator(*p))
+		{
+			++p;
+
+			while (p < end && IsBlank(*p)) ++p;
+		}
+	}
+
+	while (p < end && IsLineEnd(*p)) ++p;
+
+	return count;
+}
+
+//returns the start of the line after the one pos is on
+static const char* NextLine(const char* pos, const char* end)
+{
+	while (pos < end && *pos != '\n') ++pos;
+
+	return pos < end ? pos + 1 : end;
+}
+
+//----------------------------- ImportCsv --------------------------------
+//
+//------------------------------------------------------------------------
+bool CDataSet::ImportCsv(const char* CsvPath, const char* path, CThreadPool* pPool)
+{
+	CFileMapping csv;
+
+	if (!csv.Open(CsvPath)) return false;
+
+	const char* p   = (const char*)csv.GetData();
+	const char* end = p + csv.GetSize();
+
+	//a UTF-8 byte order mark
+	if (end - p >= 3 && !memcmp(p, "\xEF\xBB\xBF", 3)) p += 3;
+
+	//skip blank lines, and a header line if there is one
+	bool header = false;
+
+	while (p < end)
+	{
+		const char* line = p;
+
+		int count = ParseLine(p, end, NULL);
+
+		if (count > 0)
+		{
+			p = line;
+			break;
+		}
+
+		if (count < 0)
+		{
+			//only the first line may be column names
+			if (header) return false;
+
+			header = true;
+
+			p = NextLine(line, end);
+		}
+	}
+
+	//the first data line gives the number of values per vector
+	int dim;
+
+	{
+		const char* line = p;
+
+		dim = ParseLine(line, end, NULL);
+
+		if (dim <= 0) return false;
+	}
+
+	const string temp = string(path) + ".tmp";
+
+	FILE* pFile = BeginWrite(temp);
+
+	if (!pFile) return false;
+
+	const int NumTasks = pPool ? pPool->GetNumThreads() * 4 : 1;
+
+	vector<vector<float> > parsed(NumTasks);
+
+	vector<char> failed(NumTasks);
+
+	size_t NumVectors = 0;
+
+	bool ok = true;
+
+	while (ok && p < end)
+	{
+		const char* BlockEnd = NextLine(p + min((size_t)(end - p), CsvBlockBytes) - 1, end);
+
+		//split the block by lines, one range per task
+		vector<const char*> bounds(NumTasks + 1);
+
+		bounds[0]        = p;
+		bounds[NumTasks] = BlockEnd;
+
+		for (int t=1; t<NumTasks; ++t)
+		{
+			const char* split = p + (BlockEnd - p) * t / NumTasks;
+
+			bounds[t] = max(bounds[t - 1], split == p ? p : NextLine(split - 1, BlockEnd));
+		}
+
+		auto ParseRange = [&](int t)
+		{
+			parsed[t].clear();
+			failed[t] = 0;
+
+			const char* q = bounds[t];
+
+			while (q < bounds[t + 1])
+			{
+				int count = ParseLine(q, bounds[t + 1], &parsed[t]);
+
+				if (count != 0 && count != dim)
+				{
+					failed[t] = 1;
+					return;
+				}
+			}
+		};
+
+		if (pPool) pPool->ParallelFor(NumTasks, ParseRange);
+		else       ParseRange(0);
+
+		//written in task order, which is file order
+		for (int t=0; t<NumTasks && ok; ++t)
+		{
+			ok = !failed[t] &&
+			     fwrite(parsed[t].data(), sizeof(float), parsed[t].size(), pFile) == parsed[t].size();
+
+			NumVectors += parsed[t].size() / dim;
+		}
+
+		p = BlockEnd;
+	}
+
+	return EndWrite(pFile, temp, path, NumVectors, dim, ok);
+}
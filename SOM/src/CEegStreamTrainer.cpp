@@ -0,0 +1,166 @@
+#include "CEegStreamTrainer.h"
+
+#include <math.h>
+#include <string.h>
+#include <chrono>
+
+
+//how long the training thread naps when it finds the ring empty
+static const int IdleSleepMs = 2;
+
+
+CEegStreamTrainer::CEegStreamTrainer(CSom* pSom, int Capacity):
+	m_pSom(pSom),
+	m_iDim(pSom->GetCodebook().GetDim()),
+	m_iWrite(0),
+	m_iRead(0),
+	m_iDropped(0),
+	m_iTrained(0),
+	m_iStep(0),
+	m_bRunning(false)
+{
+	uint32_t size = 1;
+
+	while (size < (uint32_t)max(1, Capacity)) size <<= 1;
+
+	m_iMask = size - 1;
+
+	m_vRing.resize((size_t)size * m_iDim);
+
+	const CCodebook &codebook = pSom->GetCodebook();
+
+	SetSchedule(max(codebook.GetCellsAcross(), codebook.GetCellsUp()) / 2.0,
+	            2.0,
+	            constStartLearningRate,
+	            constStartLearningRate / 10,
+	            300);
+}
+
+//---------------------------- SetSchedule -------------------------------
+//
+//------------------------------------------------------------------------
+void CEegStreamTrainer::SetSchedule(double StartRadius,
+                                    double FloorRadius,
+                                    double StartRate,
+                                    double FloorRate,
+                                    double TimeConstant)
+{
+	m_dStartRadius  = StartRadius;
+	m_dFloorRadius  = FloorRadius;
+	m_dStartRate    = StartRate;
+	m_dFloorRate    = FloorRate;
+	m_dTimeConstant = max(TimeConstant, 1e-9);
+}
+
+//------------------------------- Push -----------------------------------
+//
+//------------------------------------------------------------------------
+bool CEegStreamTrainer::Push(const double* pSample)
+{
+	const uint32_t write = m_iWrite.load(memory_order_relaxed);
+
+	//the acquire pairs with the consumer's release, so the slot it frees
+	//is done being read before it is overwritten
+	if (write - m_iRead.load(memory_order_acquire) > m_iMask)
+	{
+		m_iDropped.fetch_add(1, memory_order_relaxed);
+
+		return false;
+	}
+
+	memcpy(&m_vRing[(size_t)(write & m_iMask) * m_iDim], pSample, m_iDim * sizeof(double));
+
+	m_iWrite.store(write + 1, memory_order_release);
+
+	return true;
+}
+
+//-------------------------- PushBandPowers ------------------------------
+//
+//  the powers span several orders of magnitude, so they are compared on
+//  a log scale or delta would swamp the rest
+//------------------------------------------------------------------------
+bool CEegStreamTrainer::PushBandPowers(const unsigned int* pBands)
+{
+	if (m_iDim != constNumEegBands) return false;
+
+	//the largest 3 byte value maps to 1
+	static const double scale = 1.0 / log(16777216.0);
+
+	double sample[constNumEegBands];
+
+	for (int b=0; b<constNumEegBands; ++b)
+	{
+		sample[b] = log(1.0 + pBands[b]) * scale;
+	}
+
+	return Push(sample);
+}
+
+//------------------------------- Train ----------------------------------
+//
+//------------------------------------------------------------------------
+int CEegStreamTrainer::Train(int MaxSamples)
+{
+	uint32_t read = m_iRead.load(memory_order_relaxed);
+
+	const uint32_t write = m_iWrite.load(memory_order_acquire);
+
+	int trained = 0;
+
+	while (read != write && trained < MaxSamples)
+	{
+		const double t = (double)m_iStep.fetch_add(1, memory_order_relaxed);
+
+		const double decay = exp(-t / m_dTimeConstant);
+
+		const double radius = m_dFloorRadius + (m_dStartRadius - m_dFloorRadius) * decay;
+		const double rate   = m_dFloorRate   + (m_dStartRate   - m_dFloorRate)   * decay;
+
+		//trained on in place, the producer can't reuse the slot until
+		//the read index moves past it
+		m_pSom->Adapt(&m_vRing[(size_t)(read & m_iMask) * m_iDim], radius, rate);
+
+		m_iRead.store(++read, memory_order_release);
+
+		++trained;
+	}
+
+	m_iTrained.fetch_add(trained, memory_order_relaxed);
+
+	return trained;
+}
+
+//------------------------------- Start ----------------------------------
+//
+//------------------------------------------------------------------------
+void CEegStreamTrainer::Start()
+{
+	if (m_bRunning.exchange(true)) return;
+
+	m_Thread = thread(&CEegStreamTrainer::Run, this);
+}
+
+void CEegStreamTrainer::Stop()
+{
+	if (!m_bRunning.exchange(false)) return;
+
+	m_Thread.join();
+}
+
+//-------------------------------- Run -----------------------------------
+//
+//  the vectors come in at the headset's pace, a handful a second, so
+//  polling with a short sleep costs nothing and keeps Push free of any
+//  signalling
+//------------------------------------------------------------------------
+void CEegStreamTrainer::Run()
+{
+	while (m_bRunning.load(memory_order_relaxed))
+	{
+		if (Train(256) == 0)
+		{
+			this_thread::sleep_for(chrono::milliseconds(IdleSleepMs));
+		}
+	}
+}
@@ -0,0 +1,153 @@
+#include "CFileMapping.h"
+
+#include <algorithm>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+
+//passes a hint about [offset, offset + length) to madvise, widened to
+//whole pages as it wants
+static void Advise(const void* pData, size_t size, size_t offset, size_t length, bool WillNeed)
+{
+#ifdef _WIN32
+	(void)pData; (void)size; (void)offset; (void)length; (void)WillNeed;
+#else
+	if (!pData || offset >= size) return;
+
+	length = min(length, size - offset);
+
+	const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+
+	const size_t first = offset / page * page;
+
+	madvise((char*)pData + first, length + (offset - first), WillNeed ? MADV_WILLNEED : MADV_DONTNEED);
+#endif
+}
+
+//-------------------------------- Open ----------------------------------
+//
+//------------------------------------------------------------------------
+bool CFileMapping::Open(const char* path)
+{
+	Close();
+
+#ifdef _WIN32
+
+	HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+	                          OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+
+	if (file == INVALID_HANDLE_VALUE) return false;
+
+	LARGE_INTEGER size;
+
+	if (!GetFileSizeEx(file, &size) || size.QuadPart == 0)
+	{
+		CloseHandle(file);
+		return false;
+	}
+
+	HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+
+	if (!mapping)
+	{
+		CloseHandle(file);
+		return false;
+	}
+
+	const void* data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+
+	if (!data)
+	{
+		CloseHandle(mapping);
+		CloseHandle(file);
+		return false;
+	}
+
+	m_hFile    = file;
+	m_hMapping = mapping;
+	m_pData    = data;
+	m_iSize    = (size_t)size.QuadPart;
+
+#else
+
+	int fd = open(path, O_RDONLY);
+
+	if (fd < 0) return false;
+
+	struct stat info;
+
+	if (fstat(fd, &info) != 0 || info.st_size == 0)
+	{
+		close(fd);
+		return false;
+	}
+
+	void* data = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+
+	//the mapping keeps the file alive on its own
+	close(fd);
+
+	if (data == MAP_FAILED) return false;
+
+	m_pData = data;
+	m_iSize = (size_t)info.st_size;
+
+#endif
+
+	return true;
+}
+
+//-------------------------------- Close ---------------------------------
+//
+//------------------------------------------------------------------------
+void CFileMapping::Close()
+{
+	if (!m_pData) return;
+
+#ifdef _WIN32
+	UnmapViewOfFile(m_pData);
+	CloseHandle((HANDLE)m_hMapping);
+	CloseHandle((HANDLE)m_hFile);
+
+	m_hMapping = NULL;
+	m_hFile    = NULL;
+#else
+	munmap((void*)m_pData, m_iSize);
+#endif
+
+	m_pData = NULL;
+	m_iSize = 0;
+}
+
+//----------------------------- WillNeed ---------------------------------
+//
+//------------------------------------------------------------------------
+void CFileMapping::WillNeed(size_t offset, size_t length) const
+{
+	Advise(m_pData, m_iSize, offset, length, true);
+}
+
+void CFileMapping::DontNeed(size_t offset, size_t length) const
+{
+	Advise(m_pData, m_iSize, offset, length, false);
+}
+
+//-------------------------------- Swap ----------------------------------
+//
+//------------------------------------------------------------------------
+void CFileMapping::Swap(CFileMapping &other)
+{
+	swap(m_pData,    other.m_pData);
+	swap(m_iSize,    other.m_iSize);
+	swap(m_hFile,    other.m_hFile);
+	swap(m_hMapping, other.m_hMapping);
+}
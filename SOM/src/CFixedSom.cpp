@@ -0,0 +1,7 @@
+#include "CFixedSom.h"
+
+
+//the EEG maps are compiled here once, so every build checks the template
+//even though only the benchmark uses it
+template class CFixedSom<float,  constNumEegBands, constNumCellsDown, constNumCellsAcross>;
+template class CFixedSom<double, constNumEegBands, constNumCellsDown, constNumCellsAcross>;
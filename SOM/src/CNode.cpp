@@ -1,12 +1,12 @@
 #include "CNode.h"
 
-double CNode::GetEucDistance(const vector<double> &vecInput)
+double CNode::GetEucDistance(const vector<double> &vecInput) const
 {
 	double distance = 0;
-  
-	for(int i = 0; i < m_dWeights.size(); i++)
+
+	for(int i = 0; i < m_iNumWeights; i++)
 	{
-		distance += (vecInput[i] - m_dWeights[i]) * (vecInput[i] - m_dWeights[i]);
+		distance += (vecInput[i] - m_pWeights[i]) * (vecInput[i] - m_pWeights[i]);
 	}
 
 	return sqrt(distance);
@@ -17,8 +17,8 @@ void CNode::AdjustWeights(
     const double learningRate,
     const double influence
 ) {
-	for(int w = 0; w < vecTarget.size(); w++)
+	for(int w = 0; w < m_iNumWeights; w++)
 	{
-		m_dWeights[w] += learningRate * influence * (vecTarget[w] - m_dWeights[w]);
+		m_pWeights[w] += learningRate * influence * (vecTarget[w] - m_pWeights[w]);
 	}
-}
\ No newline at end of file
+}
@@ -0,0 +1,244 @@
+#include "CQuantizedCodebook.h"
+#include "BmuSearch.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <math.h>
+#include <string.h>
+
+
+
+CQuantizedCodebook::~CQuantizedCodebook()
+{
+	if (m_pWeights) AlignedFree(m_pWeights);
+}
+
+//------------------------------- Build ----------------------------------
+//
+//------------------------------------------------------------------------
+bool CQuantizedCodebook::Build(const CCodebook &codebook, SomScalar scalar)
+{
+	if (scalar != SOM_SCALAR_FLOAT32 && scalar != SOM_SCALAR_FLOAT16 && scalar != SOM_SCALAR_INT8)
+	{
+		return false;
+	}
+
+	if (m_pWeights) AlignedFree(m_pWeights);
+
+	m_Scalar    = scalar;
+	m_iNumNodes = codebook.GetNumNodes();
+	m_iDim      = codebook.GetDim();
+	m_iStride   = StrideFor(m_iDim);
+
+	const size_t RowBytes = m_iStride * ScalarBytes(scalar);
+
+	//zeroed, so the padding past dim reads as zero weights
+	m_pWeights = AlignedAlloc(max((size_t)64, m_iNumNodes * RowBytes), 64);
+
+	if (!m_pWeights)
+	{
+		m_iNumNodes = 0;
+		m_vScales.clear();
+
+		return false;
+	}
+
+	memset(m_pWeights, 0, m_iNumNodes * RowBytes);
+
+	m_vScales.assign(scalar == SOM_SCALAR_INT8 ? m_iNumNodes : 0, 0.0f);
+
+	for (int n=0; n<m_iNumNodes; ++n)
+	{
+		const double* pRow = codebook.GetRow(n);
+
+		char* pOut = (char*)m_pWeights + n * RowBytes;
+
+		if (scalar == SOM_SCALAR_FLOAT32)
+		{
+			for (int w=0; w<m_iDim; ++w)
+			{
+				((float*)pOut)[w] = (float)pRow[w];
+			}
+		}
+
+		else if (scalar == SOM_SCALAR_FLOAT16)
+		{
+			for (int w=0; w<m_iDim; ++w)
+			{
+				((uint16_t*)pOut)[w] = FloatToHalf((float)pRow[w]);
+			}
+		}
+
+		else
+		{
+			//the largest weight of the node maps to 127
+			double largest = 0;
+
+			for (int w=0; w<m_iDim; ++w)
+			{
+				largest = max(largest, fabs(pRow[w]));
+			}
+
+			const float scale = (float)(largest / 127);
+
+			m_vScales[n] = scale;
+
+			if (scale == 0) continue;
+
+			for (int w=0; w<m_iDim; ++w)
+			{
+				double q = floor(pRow[w] / scale + 0.5);
+
+				((int8_t*)pOut)[w] = (int8_t)max(-127.0, min(127.0, q));
+			}
+		}
+	}
+
+	return true;
+}
+
+//------------------------ FindBestMatchingNode --------------------------
+//
+//------------------------------------------------------------------------
+int CQuantizedCodebook::FindBestMatchingNode(const float* pInput, float* pDistSq) const
+{
+	if (m_iNumNodes == 0) return -1;
+
+	//the kernel wants the input padded like the rows
+	static thread_local vector<float> input;
+
+	input.assign(m_iStride, 0);
+
+	memcpy(&input[0], pInput, m_iDim * sizeof(float));
+
+	float dist;
+
+	int winner = GetReducedBmuKernel(m_Scalar)(m_pWeights,
+	                                           m_iStride,
+	                                           m_iDim,
+	                                           m_vScales.empty() ? NULL : &m_vScales[0],
+	                                           &input[0],
+	                                           0,
+	                                           m_iNumNodes,
+	                                           &dist);
+
+	if (pDistSq) *pDistSq = dist;
+
+	return winner;
+}
+
+//------------------------------- Project --------------------------------
+//
+//------------------------------------------------------------------------
+void CQuantizedCodebook::Project(const float* pData,
+                                 size_t NumVectors,
+                                 uint32_t* pBmu,
+                                 float* pDist,
+                                 CThreadPool* pPool) const
+{
+	if (m_iNumNodes == 0) return;
+
+	ReducedBmuKernel kernel = GetReducedBmuKernel(m_Scalar);
+
+	const float* pScales = m_vScales.empty() ? NULL : &m_vScales[0];
+
+	CThreadPool::RunRanges(pPool, NumVectors, CThreadPool::NumTasksFor(pPool, NumVectors, 1, 4), [&](int, size_t first, size_t last)
+	{
+		vector<float> input(m_iStride, 0);
+
+		for (size_t v=first; v<last; ++v)
+		{
+			memcpy(&input[0], pData + v * m_iDim, m_iDim * sizeof(float));
+
+			float dist;
+
+			pBmu[v] = (uint32_t)kernel(m_pWeights, m_iStride, m_iDim, pScales, &input[0], 0, m_iNumNodes, &dist);
+
+			if (pDist) pDist[v] = sqrtf(dist);
+		}
+	});
+}
+
+//-------------------------- MeasureAccuracy -----------------------------
+//
+//------------------------------------------------------------------------
+SQuantizedAccuracy CQuantizedCodebook::MeasureAccuracy(const CCodebook &reference,
+                                                       const float* pData,
+                                                       size_t NumVectors,
+                                                       CThreadPool* pPool) const
+{
+	SQuantizedAccuracy accuracy = { 1.0, 0, 0, 0 };
+
+	if (NumVectors == 0 || m_iNumNodes == 0 ||
+	    reference.GetNumNodes() != m_iNumNodes || reference.GetDim() != m_iDim)
+	{
+		return accuracy;
+	}
+
+	vector<uint32_t> bmu(NumVectors);
+	vector<float> dist(NumVectors);
+
+	Project(pData, NumVectors, &bmu[0], &dist[0], pPool);
+
+	BmuKernel  search = GetBmuKernel();
+	DistKernel exact  = GetDistKernel();
+
+	const int stride = reference.GetStride();
+	const int NumTasks = CThreadPool::NumTasksFor(pPool, NumVectors, 1, 4);
+
+	//per task totals, added up in task order so the result doesn't
+	//depend on the timing of the threads
+	vector<size_t> agreed(NumTasks, 0);
+	vector<double> ReferenceQE(NumTasks, 0), QE(NumTasks, 0), MaxError(NumTasks, 0);
+
+	CThreadPool::RunRanges(pPool, NumVectors, NumTasks, [&](int task, size_t first, size_t last)
+	{
+		vector<double> input(stride, 0);
+
+		for (size_t v=first; v<last; ++v)
+		{
+			for (int w=0; w<m_iDim; ++w)
+			{
+				input[w] = pData[v * m_iDim + w];
+			}
+
+			double best, picked;
+
+			int winner = search(reference.GetWeights(), stride, m_iDim, &input[0], 0, m_iNumNodes, &best);
+
+			exact(reference.GetWeights(), stride, m_iDim, &input[0], bmu[v], bmu[v] + 1, &picked);
+
+			if (winner == (int)bmu[v]) ++agreed[task];
+
+			ReferenceQE[task] += sqrt(best);
+			QE[task]          += sqrt(picked);
+
+			MaxError[task] = max(MaxError[task], fabs(dist[v] - sqrt(picked)));
+		}
+	});
+
+	size_t TotalAgreed = 0;
+
+	for (int task=0; task<NumTasks; ++task)
+	{
+		TotalAgreed                += agreed[task];
+		accuracy.dReferenceQE      += ReferenceQE[task];
+		accuracy.dQE               += QE[task];
+		accuracy.dMaxDistanceError  = max(accuracy.dMaxDistanceError, MaxError[task]);
+	}
+
+	accuracy.dBmuAgreement = (double)TotalAgreed / NumVectors;
+	accuracy.dReferenceQE /= NumVectors;
+	accuracy.dQE          /= NumVectors;
+
+	return accuracy;
+}
+
+//------------------------------ GetBytes --------------------------------
+//
+//------------------------------------------------------------------------
+size_t CQuantizedCodebook::GetBytes() const
+{
+	return (size_t)m_iNumNodes * m_iStride * ScalarBytes(m_Scalar) +
+	       m_vScales.size() * sizeof(float);
+}
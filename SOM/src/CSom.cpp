@@ -1,11 +1,38 @@
 #include "CSom.h"
+#include "SomFile.h"
+#include "SomSchedule.h"
 
+#include <float.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string>
 
-void CSom::Create(int cxClient,
+
+//a range smaller than this isn't worth handing to another thread
+static const int MinNodesPerTask = 4096;
+
+//InitializeLinear sums the training vectors up this many at a time. The
+//blocks are the same for any number of threads, and so are the sums
+static const int LinearBlock = 4096;
+
+//the directions its subspace iteration refines, two more than the two
+//it needs so those converge quickly, and how many passes it makes
+static const int LinearBasis = 4;
+static const int LinearPasses = 8;
+
+//Project and the batch search work on this many input vectors at a time...
+static const int TileVectors = 16;
+
+//...against a slice of the codebook about this big in bytes
+static const int SliceBytes = 128 * 1024;
+
+
+bool CSom::Create(int cxClient,
                   int cyClient,
                   int CellsUp,
                   int CellsAcross,
-                  int NumIterations)
+                  int NumIterations,
+                  int dim)
 {
 
   m_dCellWidth  = (double)cxClient / (double)CellsAcross;
@@ -13,125 +40,1994 @@ void CSom::Create(int cxClient,
   m_dCellHeight = (double)cyClient / (double)CellsUp;
 
   m_iNumIterations = NumIterations;
-  
-  //create all the nodes
+
+  //create all the nodes. The weights of the whole map live in a single
+  //contiguous matrix and each node is identified by its row in it
+  const bool created = m_Codebook.Create(CellsUp, CellsAcross, dim, &m_Random);
+
+  //the codebook no longer points into a mapped file, if it did
+  m_Mapping.Close();
+
+  m_bNodeNormsValid = false;
+
+  if (!created) return false;
+
+#ifdef SOM_TELEMETRY
+  m_Telemetry.Reset();
+#endif
+
+  m_iIterationsSaved = 0;
+
+  //a plain map, not a stage of a coarse to fine run
+  m_vLevels.clear();
+  m_iNextLevel = 0;
+
+  m_iIterationCount      = 1;
+  m_dNeighbourhoodRadius = 0;
+  m_dLearningRate        = m_dStartLearningRate;
+  m_bDone                = false;
+
+  //this is the topological 'radius' of the feature map, measured in
+  //grid cells
+  m_dMapRadius = max(CellsAcross, CellsUp)/2.0;
+
+  BuildSchedules(NumIterations);
+
+  return true;
+}
+
+//------------------------- CreateCoarseToFine ---------------------------
+//
+//------------------------------------------------------------------------
+bool CSom::CreateCoarseToFine(int cxClient,
+                              int cyClient,
+                              int CellsUp,
+                              int CellsAcross,
+                              int NumIterations,
+                              int NumLevels,
+                              int dim)
+{
+  //no more stages than there are halvings that leave the longer side 2
+  //cells or more, or iterations to give them
+  int MaxLevels = 1;
+
+  for (int longest = max(CellsUp, CellsAcross); longest > 2; longest = (longest + 1) / 2)
+  {
+    ++MaxLevels;
+  }
+
+  NumLevels = max(1, min(NumLevels, min(MaxLevels, NumIterations)));
+
+  const int share = NumIterations / NumLevels;
+
+  vector<SLevel> levels(NumLevels);
+
+  for (int level=0; level<NumLevels; ++level)
+  {
+    //the size halved once for every stage still to come, rounding up
+    const int halvings = NumLevels - 1 - level;
+
+    levels[level].iCellsUp     = max(min(2, CellsUp),     (CellsUp     - 1) / (1 << halvings) + 1);
+    levels[level].iCellsAcross = max(min(2, CellsAcross), (CellsAcross - 1) / (1 << halvings) + 1);
+    levels[level].iIterations  = share;
+  }
+
+  //the last stage gets what is left over
+  levels.back().iIterations = NumIterations - share * (NumLevels - 1);
+
+  //every stage is drawn over the whole client area
+  if (!Create(cxClient,
+              cyClient,
+              levels[0].iCellsUp,
+              levels[0].iCellsAcross,
+              levels[0].iIterations,
+              dim))
+  {
+    return false;
+  }
+
+  m_vLevels.swap(levels);
+
+  m_iNextLevel = 1;
+
+  return true;
+}
+
+//------------------------------ Upsample --------------------------------
+//
+//------------------------------------------------------------------------
+bool CSom::Upsample(int CellsUp, int CellsAcross, int NumIterations)
+{
+  const int OldUp     = m_Codebook.GetCellsUp();
+  const int OldAcross = m_Codebook.GetCellsAcross();
+
+  if (m_Codebook.GetNumNodes() == 0 || CellsUp <= 0 || CellsAcross <= 0) return false;
+
+  const int NumWeights = m_Codebook.GetDim();
+
+  CCodebook fine;
+
+  if (!fine.Create(CellsUp, CellsAcross, NumWeights, &m_Random)) return false;
+
+  //the corners of the new grid land on the corners of the old one
+  const double ScaleY = CellsUp     > 1 ? (double)(OldUp     - 1) / (CellsUp     - 1) : 0;
+  const double ScaleX = CellsAcross > 1 ? (double)(OldAcross - 1) / (CellsAcross - 1) : 0;
+
   for (int row=0; row<CellsUp; ++row)
   {
+    const double y = row * ScaleY;
+
+    const int    y0 = min((int)y, OldUp - 1);
+    const int    y1 = min(y0 + 1, OldUp - 1);
+    const double fy = y - y0;
+
     for (int col=0; col<CellsAcross; ++col)
     {
-      m_SOM.push_back(CNode(col*m_dCellWidth,           //left
-                            (col+1)*m_dCellWidth,       //right
-                            row*m_dCellHeight,          //top
-                            (row+1)*m_dCellHeight,      //bottom
-                            constSizeOfInputVector));   //num weights
+      const double x = col * ScaleX;
+
+      const int    x0 = min((int)x, OldAcross - 1);
+      const int    x1 = min(x0 + 1, OldAcross - 1);
+      const double fx = x - x0;
+
+      const double* p00 = m_Codebook.GetRow(y0 * OldAcross + x0);
+      const double* p01 = m_Codebook.GetRow(y0 * OldAcross + x1);
+      const double* p10 = m_Codebook.GetRow(y1 * OldAcross + x0);
+      const double* p11 = m_Codebook.GetRow(y1 * OldAcross + x1);
+
+      double* pRow = fine.GetRow(row * CellsAcross + col);
+
+      for (int w=0; w<NumWeights; ++w)
+      {
+        pRow[w] = (1 - fy) * ((1 - fx) * p00[w] + fx * p01[w]) +
+                       fy  * ((1 - fx) * p10[w] + fx * p11[w]);
+      }
     }
   }
 
-  //this is the topological 'radius' of the feature map
-  m_dMapRadius = max(constWindowWidth, constWindowHeight)/2;
+  m_Codebook.Swap(fine);
+
+  //the new codebook is a copy, even if the old one was mapped
+  m_Mapping.Close();
+
+  m_bNodeNormsValid = false;
+
+  //the cells Render draws cover the same area as before
+  m_dCellWidth  = m_dCellWidth  * OldAcross / CellsAcross;
+  m_dCellHeight = m_dCellHeight * OldUp     / CellsUp;
 
-   //used in the calculation of the neighbourhood width of m_dInfluence
-  m_dTimeConstant = m_iNumIterations/log(m_dMapRadius);
+  //an old cell now spans this many new ones
+  const double stretch = max((double)CellsUp / OldUp, (double)CellsAcross / OldAcross);
+
+  m_iNumIterations       = NumIterations;
+  m_iIterationCount      = 1;
+  m_dNeighbourhoodRadius = 0;
+  m_dLearningRate        = m_dStartLearningRate;
+  m_bDone                = false;
+
+  //the schedule decays from here to a radius of one cell
+  m_dMapRadius = max(2.0, 2 * stretch);
+
+  BuildSchedules(NumIterations);
+
+  return true;
 }
-      
-//--------------------------- Epoch --------------------------------------
+
+//------------------------------------------------------------------------
 //
-//  Given a std::vector of input vectors this method choses one at random
-//  and runs the network through one training epoch
+//  linear initialization. The principal components are found by
+//  randomized subspace iteration: a few random directions are multiplied
+//  by the covariance matrix, one pass over the data each time, and made
+//  orthonormal again, which turns them towards the directions of the
+//  largest variance. The covariance matrix itself is never formed, so a
+//  pass costs a few dot products per vector whatever the dimension
 //------------------------------------------------------------------------
-bool Csom::Epoch(const vector<vector<double> > &data)
-{
-  //make sure the size of the input vector matches the size of each node's 
-  //weight vector
-  if (data[0].size() != constSizeOfInputVector) return false;
 
-  //return if the training is complete
-  if (m_bDone) return true;
- 
-  
-  //enter the training loop
-  if (--m_iNumIterations > 0)
+//makes the count vectors of dim values in pBasis orthonormal, by modified
+//Gram-Schmidt. A vector that turns out to lie in the span of the ones
+//before it is replaced by a random one
+static void Orthonormalize(double* pBasis, int count, int dim, CRandom &random)
+{
+  for (int j=0; j<count; ++j)
   {
-    //the input vectors are presented to the network at random
-    int ThisVector = RandInt(0, data.size()-1);
+    double* pJ = pBasis + (size_t)j * dim;
+
+    for (int attempt=0; attempt<4; ++attempt)
+    {
+      for (int i=0; i<j; ++i)
+      {
+        const double* pI = pBasis + (size_t)i * dim;
 
-    //present the vector to each node and determine the BMU
-    m_pWinningNode = FindBestMatchingNode(data[ThisVector]);
+        double dot = 0;
 
-    //calculate the width of the neighbourhood for this timestep
-    m_dNeighbourhoodRadius = m_dMapRadius * exp(-(double)m_iIterationCount/m_dTimeConstant);
+        for (int w=0; w<dim; ++w) dot += pI[w] * pJ[w];
 
-    //Now to adjust the weight vector of the BMU and its
-    //neighbours
+        for (int w=0; w<dim; ++w) pJ[w] -= dot * pI[w];
+      }
 
-    //For each node calculate the m_dInfluence (Theta from equation 6 in
-    //the tutorial. If it is greater than zero adjust the node's weights
-    //accordingly
-    for (int n=0; n<m_SOM.size(); ++n)
+      double norm = 0;
+
+      for (int w=0; w<dim; ++w) norm += pJ[w] * pJ[w];
+
+      norm = sqrt(norm);
+
+      if (norm > 1e-12)
+      {
+        for (int w=0; w<dim; ++w) pJ[w] /= norm;
+
+        break;
+      }
+
+      for (int w=0; w<dim; ++w) pJ[w] = random.NextDouble() - 0.5;
+    }
+  }
+}
+
+//diagonalizes the symmetric n x n matrix a with Jacobi rotations. The
+//eigenvalues end up on its diagonal and the eigenvectors in the columns
+//of v
+static void JacobiEigen(double* a, double* v, int n)
+{
+  for (int i=0; i<n; ++i)
+  {
+    for (int j=0; j<n; ++j) v[i * n + j] = i == j;
+  }
+
+  for (int sweep=0; sweep<50; ++sweep)
+  {
+    double off = 0;
+
+    for (int i=0; i<n; ++i)
     {
-      //calculate the Euclidean distance (squared) to this node from the
-      //BMU
-      double DistToNodeSq = (m_pWinningNode->X()-m_SOM[n].X()) *
-                            (m_pWinningNode->X()-m_SOM[n].X()) +
-                            (m_pWinningNode->Y()-m_SOM[n].Y()) *
-                            (m_pWinningNode->Y()-m_SOM[n].Y()) ;
+      for (int j=i+1; j<n; ++j) off += a[i * n + j] * a[i * n + j];
+    }
 
-      double WidthSq = m_dNeighbourhoodRadius * m_dNeighbourhoodRadius;
+    if (off < 1e-30) break;
 
-      //if within the neighbourhood adjust its weights
-      if (DistToNodeSq < (m_dNeighbourhoodRadius * m_dNeighbourhoodRadius))
+    for (int p=0; p<n; ++p)
+    {
+      for (int q=p+1; q<n; ++q)
       {
+        if (a[p * n + q] == 0) continue;
 
-        //calculate by how much its weights are adjusted
-        m_dInfluence = exp(-(DistToNodeSq) / (2*WidthSq));
+        const double theta = (a[q * n + q] - a[p * n + p]) / (2 * a[p * n + q]);
 
-        m_SOM[n].AdjustWeights(data[ThisVector],
-                               m_dLearningRate,
-                               m_dInfluence);
-      }
+        const double t = (theta >= 0 ? 1 : -1) / (fabs(theta) + sqrt(theta * theta + 1));
 
-    }//next node
+        const double c = 1 / sqrt(t * t + 1);
+        const double s = t * c;
 
+        for (int k=0; k<n; ++k)
+        {
+          const double kp = a[k * n + p], kq = a[k * n + q];
 
-    //reduce the learning rate
-    m_dLearningRate = constStartLearningRate * exp(-(double)m_iIterationCount/m_iNumIterations);
-    
-    ++m_iIterationCount;
+          a[k * n + p] = c * kp - s * kq;
+          a[k * n + q] = s * kp + c * kq;
+        }
+
+        for (int k=0; k<n; ++k)
+        {
+          const double pk = a[p * n + k], qk = a[q * n + k];
+
+          a[p * n + k] = c * pk - s * qk;
+          a[q * n + k] = s * pk + c * qk;
+        }
 
+        for (int k=0; k<n; ++k)
+        {
+          const double kp = v[k * n + p], kq = v[k * n + q];
+
+          v[k * n + p] = c * kp - s * kq;
+          v[k * n + q] = s * kp + c * kq;
+        }
+      }
+    }
   }
+}
 
-  else
+//-------------------------- InitializeLinear ----------------------------
+//
+//------------------------------------------------------------------------
+bool CSom::InitializeLinear(const vector<vector<double> > &data)
+{
+  if (data.empty() || data[0].size() != (size_t)m_Codebook.GetDim()) return false;
+
+  return LinearInit(data.size(), NULL, [&](size_t v, double* pInput)
   {
-    m_bDone = true;
-  }
+    const vector<double> &vec = data[v];
 
-  return true;
+    for (size_t w=0; w<vec.size(); ++w)
+    {
+      pInput[w] = vec[w];
+    }
+  });
 }
 
-//--------------------- CalculateBestMatchingNode ------------------------
+bool CSom::InitializeLinear(const CDataSet &data)
+{
+  if (data.GetNumVectors() == 0 || data.GetDim() != m_Codebook.GetDim()) return false;
+
+  const int NumWeights = m_Codebook.GetDim();
+
+  return LinearInit(data.GetNumVectors(), &data, [&](size_t v, double* pInput)
+  {
+    const float* pVector = data.GetVector(v);
+
+    for (int w=0; w<NumWeights; ++w)
+    {
+      pInput[w] = pVector[w];
+    }
+  });
+}
+
+//---------------------------- SumOverData -------------------------------
 //
-//  this function presents an input vector to each node in the network
-//  and calculates the Euclidean distance between the vectors for each
-//  node. It returns a pointer to the best performer
+//  every block of vectors is added up on its own and the block sums are
+//  added together in order. With a data set the vectors go by a chunk
+//  at a time with the next chunk read ahead, as in BatchEpoch
 //------------------------------------------------------------------------
-CNode* Csom::FindBestMatchingNode(const vector<double> &vec)
+void CSom::SumOverData(size_t NumVectors,
+                       const CDataSet* pSet,
+                       const function<void(size_t, double*)> &GetVector,
+                       int width,
+                       const function<void(double*, double*)> &Add,
+                       vector<double> &total)
 {
-  CNode* winner = NULL;
+  const int NumWeights = m_Codebook.GetDim();
+
+  const size_t ChunkSize = pSet ? max((size_t)LinearBlock, pSet->GetChunkSize() / LinearBlock * LinearBlock)
+                                : NumVectors;
+
+  total.assign(width, 0);
 
-  double LowestDistance = 999999;
- 
-  for (int n=0; n<m_SOM.size(); ++n)
+  vector<double> partial;
+
+  for (size_t first=0; first<NumVectors; first+=ChunkSize)
   {
-    double dist = m_SOM[n].CalculateDistance(vec);
+    const size_t count = min(ChunkSize, NumVectors - first);
+
+    if (pSet && first + count < NumVectors)
+    {
+      pSet->WillNeed(first + count, min(ChunkSize, NumVectors - first - count));
+    }
 
-    if (dist < LowestDistance)
+    const int NumBlocks = (int)((count + LinearBlock - 1) / LinearBlock);
+
+    partial.assign((size_t)NumBlocks * width, 0);
+
+    const int NumTasks = m_pThreadPool ? min(NumBlocks, m_pThreadPool->GetNumThreads() * 4) : 1;
+
+    CThreadPool::RunRanges(m_pThreadPool, NumBlocks, NumTasks, [&](int, int FirstBlock, int LastBlock)
     {
-      LowestDistance = dist;
+      vector<double> vec(NumWeights);
+
+      for (int b=FirstBlock; b<LastBlock; ++b)
+      {
+        double* pSum = &partial[(size_t)b * width];
+
+        const size_t end = min(count, (size_t)(b + 1) * LinearBlock);
+
+        for (size_t v=(size_t)b * LinearBlock; v<end; ++v)
+        {
+          GetVector(first + v, &vec[0]);
+
+          Add(&vec[0], pSum);
+        }
+      }
+    });
 
-      winner = &m_SOM[n];
+    for (int b=0; b<NumBlocks; ++b)
+    {
+      for (int i=0; i<width; ++i)
+      {
+        total[i] += partial[(size_t)b * width + i];
+      }
     }
+
+    if (pSet) pSet->DontNeed(first, count);
   }
+}
 
-  return winner;
+//----------------------------- LinearInit -------------------------------
+//
+//------------------------------------------------------------------------
+bool CSom::LinearInit(size_t NumVectors,
+                      const CDataSet* pSet,
+                      const function<void(size_t, double*)> &GetVector)
+{
+  if (m_Codebook.GetNumNodes() == 0 || m_Codebook.IsReadOnly()) return false;
+
+  const int NumWeights = m_Codebook.GetDim();
+
+  //the mean
+  vector<double> mean;
+
+  SumOverData(NumVectors, pSet, GetVector, NumWeights, [&](double* pVec, double* pSum)
+  {
+    for (int w=0; w<NumWeights; ++w)
+    {
+      pSum[w] += pVec[w];
+    }
+  },
+  mean);
+
+  for (int w=0; w<NumWeights; ++w)
+  {
+    mean[w] /= NumVectors;
+  }
+
+  //there can't be more directions than dimensions
+  const int k = min(LinearBasis, NumWeights);
+
+  vector<double> basis((size_t)k * NumWeights);
+
+  for (size_t i=0; i<basis.size(); ++i)
+  {
+    basis[i] = m_Random.NextDouble() - 0.5;
+  }
+
+  Orthonormalize(&basis[0], k, NumWeights, m_Random);
+
+  //each pass works out the covariance matrix times the basis, adding up
+  //(x - mean) * ((x - mean) . basis[j]) for every vector x
+  vector<double> product;
+
+  for (int pass=0; pass<LinearPasses; ++pass)
+  {
+    SumOverData(NumVectors, pSet, GetVector, k * NumWeights, [&](double* pCentred, double* pSum)
+    {
+      double dots[LinearBasis];
+
+      for (int w=0; w<NumWeights; ++w)
+      {
+        pCentred[w] -= mean[w];
+      }
+
+      for (int j=0; j<k; ++j)
+      {
+        const double* pB = &basis[(size_t)j * NumWeights];
+
+        double dot = 0;
+
+        for (int w=0; w<NumWeights; ++w) dot += pCentred[w] * pB[w];
+
+        dots[j] = dot;
+      }
+
+      for (int j=0; j<k; ++j)
+      {
+        double* pOut = pSum + (size_t)j * NumWeights;
+
+        for (int w=0; w<NumWeights; ++w) pOut[w] += dots[j] * pCentred[w];
+      }
+    },
+    product);
+
+    if (pass + 1 == LinearPasses) break;
+
+    basis.swap(product);
+
+    Orthonormalize(&basis[0], k, NumWeights, m_Random);
+  }
+
+  //the covariance matrix seen from inside the basis, whose eigenvectors
+  //turn the basis into the principal components and whose eigenvalues
+  //are their variances
+  vector<double> small((size_t)k * k), rotation((size_t)k * k);
+
+  for (int i=0; i<k; ++i)
+  {
+    for (int j=0; j<k; ++j)
+    {
+      double dot = 0;
+
+      for (int w=0; w<NumWeights; ++w)
+      {
+        dot += basis[(size_t)i * NumWeights + w] * product[(size_t)j * NumWeights + w];
+      }
+
+      small[i * k + j] = dot / NumVectors;
+    }
+  }
+
+  //made exactly symmetric, rounding leaves it slightly off
+  for (int i=0; i<k; ++i)
+  {
+    for (int j=i+1; j<k; ++j)
+    {
+      small[i * k + j] = small[j * k + i] = (small[i * k + j] + small[j * k + i]) / 2;
+    }
+  }
+
+  JacobiEigen(&small[0], &rotation[0], k);
+
+  //the two largest, first
+  int first = 0, second = -1;
+
+  for (int i=1; i<k; ++i)
+  {
+    if (small[i * k + i] > small[first * k + first]) first = i;
+  }
+
+  for (int i=0; i<k; ++i)
+  {
+    if (i != first && (second < 0 || small[i * k + i] > small[second * k + second])) second = i;
+  }
+
+  vector<double> axes(2 * (size_t)NumWeights, 0);
+
+  for (int a=0; a<2; ++a)
+  {
+    const int e = a == 0 ? first : second;
+
+    if (e < 0) continue;
+
+    //a principal component spans sqrt(variance) either side of the mean
+    const double spread = sqrt(max(0.0, small[e * k + e]));
+
+    for (int j=0; j<k; ++j)
+    {
+      for (int w=0; w<NumWeights; ++w)
+      {
+        axes[(size_t)a * NumWeights + w] += spread * rotation[j * k + e] * basis[(size_t)j * NumWeights + w];
+      }
+    }
+  }
+
+  //the first component runs along the longer side of the grid
+  const int CellsUp     = m_Codebook.GetCellsUp();
+  const int CellsAcross = m_Codebook.GetCellsAcross();
+
+  const double* pAlongCols = &axes[CellsAcross >= CellsUp ? 0 : NumWeights];
+  const double* pAlongRows = &axes[CellsAcross >= CellsUp ? NumWeights : 0];
+
+  for (int row=0; row<CellsUp; ++row)
+  {
+    const double y = CellsUp > 1 ? 2.0 * row / (CellsUp - 1) - 1 : 0;
+
+    for (int col=0; col<CellsAcross; ++col)
+    {
+      const double x = CellsAcross > 1 ? 2.0 * col / (CellsAcross - 1) - 1 : 0;
+
+      double* pRow = m_Codebook.GetRow(row * CellsAcross + col);
+
+      for (int w=0; w<NumWeights; ++w)
+      {
+        pRow[w] = mean[w] + x * pAlongCols[w] + y * pAlongRows[w];
+      }
+    }
+  }
+
+  m_bNodeNormsValid = false;
+
+  return true;
+}
+
+//--------------------------- SetStartRadius -----------------------------
+//
+//------------------------------------------------------------------------
+void CSom::SetStartRadius(double radius)
+{
+  //the schedule decays to one cell, so it has to start above that
+  m_dMapRadius = max(2.0, radius);
+
+  m_iNumIterations       = m_iStageIterations;
+  m_iIterationCount      = 1;
+  m_dNeighbourhoodRadius = 0;
+  m_dLearningRate        = m_dStartLearningRate;
+
+  BuildSchedules(m_iStageIterations);
 }
 
+//------------------------------ NextLevel -------------------------------
+//
+//------------------------------------------------------------------------
+bool CSom::NextLevel()
+{
+  if (m_iNextLevel <= 0 || m_iNextLevel >= (int)m_vLevels.size()) return false;
+
+  const SLevel &level = m_vLevels[m_iNextLevel++];
+
+  return Upsample(level.iCellsUp, level.iCellsAcross, level.iIterations);
+}
+
+//------------------------- BuildSchedules -------------------------------
+//
+//  works out the radius and learning rate of every iteration up front.
+//  The learning rate used by an iteration is the one the previous
+//  iteration left behind, computed from the iterations remaining then
+//------------------------------------------------------------------------
+void CSom::BuildSchedules(int NumIterations)
+{
+  //early stopping starts over with every schedule
+  m_iStageEpochs     = 0;
+  m_iStageIterations = NumIterations;
+
+  //used in the calculation of the neighbourhood width of influence
+  m_dTimeConstant = BuildSomSchedules(NumIterations,
+                                      m_dMapRadius,
+                                      m_dStartLearningRate,
+                                      m_vRadiusSchedule,
+                                      m_vLearningRateSchedule);
+}
+
+#ifdef _WIN32
+
+//--------------------------- Render -------------------------------------
+//
+//------------------------------------------------------------------------
+void CSom::Render(HDC surface)
+{
+  const int NumWeights = m_Codebook.GetDim();
+
+  for (int n=0; n<m_Codebook.GetNumNodes(); ++n)
+  {
+    const double* pWeights = m_Codebook.GetRow(n);
+
+    //the weights are treated as red, green and blue
+    int red   = NumWeights > 0 ? (int)(pWeights[0] * 255) : 0;
+    int green = NumWeights > 1 ? (int)(pWeights[1] * 255) : 0;
+    int blue  = NumWeights > 2 ? (int)(pWeights[2] * 255) : 0;
+
+    RECT cell;
+
+    cell.left   = (int)(m_Codebook.GetGridX()[n] * m_dCellWidth);
+    cell.top    = (int)(m_Codebook.GetGridY()[n] * m_dCellHeight);
+    cell.right  = (int)((m_Codebook.GetGridX()[n] + 1) * m_dCellWidth);
+    cell.bottom = (int)((m_Codebook.GetGridY()[n] + 1) * m_dCellHeight);
+
+    HBRUSH brush = CreateSolidBrush(RGB(max(0, min(255, red)),
+                                        max(0, min(255, green)),
+                                        max(0, min(255, blue))));
+
+    FillRect(surface, &cell, brush);
+
+    DeleteObject(brush);
+  }
+}
+
+#endif
+
+//--------------------------- Epoch --------------------------------------
+//
+//  Given a std::vector of input vectors this method choses one at random
+//  and runs the network through one training epoch
+//------------------------------------------------------------------------
+bool CSom::Epoch(const vector<vector<double> > &data)
+{
+  //make sure the size of the input vector matches the size of each node's
+  //weight vector
+  if (data.empty() || data[0].size() != (size_t)m_Codebook.GetDim()) return false;
+
+  return OnlineStep(data.size(), [&](size_t v)
+  {
+    return &data[v][0];
+  });
+}
+
+bool CSom::Epoch(const CDataSet &data)
+{
+  if (data.GetNumVectors() == 0 || data.GetDim() != m_Codebook.GetDim()) return false;
+
+  const int NumWeights = m_Codebook.GetDim();
+
+  //the one vector the epoch trains on is widened to doubles
+  return OnlineStep(data.GetNumVectors(), [&](size_t v)
+  {
+    const float* pVector = data.GetVector(v);
+
+    m_vSample.resize(NumWeights);
+
+    for (int w=0; w<NumWeights; ++w)
+    {
+      m_vSample[w] = pVector[w];
+    }
+
+    return (const double*)&m_vSample[0];
+  });
+}
+
+//--------------------------- OnlineStep ---------------------------------
+//
+//------------------------------------------------------------------------
+bool CSom::OnlineStep(size_t NumVectors, const function<const double*(size_t)> &GetVector)
+{
+  //a mapped map can't be written to
+  if (m_Codebook.IsReadOnly()) return false;
+
+  //return if the training is complete
+  if (m_bDone) return true;
+
+
+  //enter the training loop
+  if (--m_iNumIterations > 0)
+  {
+    //the input vectors are presented to the network at random
+    size_t ThisVector = (size_t)m_Random.NextIndex(NumVectors);
+
+    //look up the width of the neighbourhood and the learning rate for
+    //this timestep
+    m_dNeighbourhoodRadius = m_vRadiusSchedule[m_iIterationCount];
+    m_dLearningRate        = m_vLearningRateSchedule[m_iIterationCount];
+
+    TrainOn(GetVector(ThisVector));
+
+    ++m_iIterationCount;
+
+    EndEpoch(NumVectors, &GetVector);
+
+    CheckConvergence();
+  }
+
+  //the schedule has run out. A coarse to fine run moves on to its next
+  //map, anything else is finished
+  else if (!NextLevel())
+  {
+    m_bDone = true;
+
+    //the weights won't move any more, so Project can use cached lengths
+    UpdateNodeNorms();
+  }
+
+  return true;
+}
+
+//--------------------------- Adapt --------------------------------------
+//
+//------------------------------------------------------------------------
+bool CSom::Adapt(const double* pInput, double radius, double LearningRate)
+{
+  if (m_Codebook.GetNumNodes() == 0 || m_Codebook.IsReadOnly()) return false;
+
+  m_dNeighbourhoodRadius = radius;
+  m_dLearningRate        = LearningRate;
+
+  TrainOn(pInput);
+
+  EndEpoch(0, NULL);
+
+  return true;
+}
+
+//--------------------------- EndEpoch -----------------------------------
+//
+//------------------------------------------------------------------------
+void CSom::EndEpoch(size_t NumVectors, const function<const double*(size_t)>* pGetVector)
+{
+#ifdef SOM_TELEMETRY
+  SSomTelemetry &telemetry = m_Telemetry.Current();
+
+  ++telemetry.iEpochs;
+
+  if (m_iErrorSampleEvery > 0 && pGetVector && NumVectors > 0 &&
+      telemetry.iEpochs % m_iErrorSampleEvery == 0)
+  {
+    const int NumWeights = m_Codebook.GetDim();
+
+    const size_t count = min(NumVectors, (size_t)m_iErrorSampleSize);
+
+    //the same vectors every time, spread evenly over the set, so the
+    //errors only move because the map did
+    m_vErrorSample.resize(count * NumWeights);
+
+    for (size_t i=0; i<count; ++i)
+    {
+      const double* pVector = (*pGetVector)(i * NumVectors / count);
+
+      for (int w=0; w<NumWeights; ++w)
+      {
+        m_vErrorSample[i * NumWeights + w] = (float)pVector[w];
+      }
+    }
+
+    telemetry.dQuantizationError = QuantizationError(&m_vErrorSample[0], count);
+    telemetry.dTopographicError  = TopographicError(&m_vErrorSample[0], count);
+    telemetry.iErrorEpoch        = telemetry.iEpochs;
+  }
+
+  m_Telemetry.Publish();
+#else
+  (void)NumVectors;
+  (void)pGetVector;
+#endif
+}
+
+//------------------------- SetEarlyStopping -----------------------------
+//
+//------------------------------------------------------------------------
+void CSom::SetEarlyStopping(SomConvergence measure, int Window, double Threshold, double MinFraction)
+{
+  m_Convergence             = measure;
+  m_iConvergenceWindow      = max(1, Window);
+  m_dConvergenceThreshold   = Threshold;
+  m_dConvergenceMinFraction = MinFraction;
+
+  m_iStageEpochs = 0;
+}
+
+//-------------------------- CheckConvergence ----------------------------
+//
+//  the average is an exponential one with a time constant of a window,
+//  started from the first epoch's value. It is only compared from the
+//  end of the second window on, once it has forgotten where it started
+//------------------------------------------------------------------------
+void CSom::CheckConvergence()
+{
+  if (m_Convergence == SOM_CONVERGE_NEVER) return;
+
+  const double value = m_Convergence == SOM_CONVERGE_QUANTIZATION_ERROR ? m_dEpochError : m_dEpochChange;
+
+  const int window = m_iConvergenceWindow;
+
+  if (m_iStageEpochs == 0) m_dConvergenceAverage = value;
+  else                     m_dConvergenceAverage += (value - m_dConvergenceAverage) / window;
+
+  if (++m_iStageEpochs % window != 0) return;
+
+  const double previous = m_dConvergenceCheckpoint;
+
+  m_dConvergenceCheckpoint = m_dConvergenceAverage;
+
+  if (m_iStageEpochs < 2 * window ||
+      m_iStageEpochs < m_dConvergenceMinFraction * m_iStageIterations)
+  {
+    return;
+  }
+
+  if (previous - m_dConvergenceAverage > m_dConvergenceThreshold * previous) return;
+
+  //jump to the last window of the schedule. m_iNumIterations counts the
+  //call that ends the schedule as well
+  const int skip = m_iNumIterations - 1 - window;
+
+  if (skip <= 0) return;
+
+  m_iIterationCount  += skip;
+  m_iNumIterations   -= skip;
+  m_iIterationsSaved += skip;
+}
+
+//--------------------------- TrainOn ------------------------------------
+//
+//  moves the BMU of pTarget and its neighbours towards it, using the
+//  current neighbourhood radius and learning rate
+//------------------------------------------------------------------------
+void CSom::TrainOn(const double* pTarget)
+{
+#ifdef SOM_TELEMETRY
+  const CSomTelemetry::Time start = CSomTelemetry::Now();
+#endif
+
+  //present the vector to each node and determine the BMU
+  double DistSq;
+
+  m_iWinningNode = FindBestMatchingNode(pTarget, &DistSq);
+
+  //the winner is about to move the learning rate's share of the way
+  //towards the vector, and its neighbours less
+  m_dEpochError  = sqrt(DistSq);
+  m_dEpochChange = m_dLearningRate * m_dEpochError;
+
+#ifdef SOM_TELEMETRY
+  const CSomTelemetry::Time searched = CSomTelemetry::Now();
+#endif
+
+  //Now to adjust the weight vector of the BMU and its
+  //neighbours. Only the nodes inside the square around the BMU that
+  //bounds the neighbourhood can be affected, so the update is limited
+  //to it, and the gaussian is looked up per row and per column rather
+  //than calculated for each node
+  BuildInfluenceTable(m_dNeighbourhoodRadius, m_vInfluence);
+
+  const int reach = (int)m_vInfluence.size() - 1;
+
+  const int WinnerRow = (int)m_Codebook.GetGridY()[m_iWinningNode];
+
+  const int FirstRow = max(0, WinnerRow - reach);
+  const int LastRow  = min(m_Codebook.GetCellsUp(), WinnerRow + reach + 1);
+
+  const int BoxWidth = min(m_Codebook.GetCellsAcross(), 2 * reach + 1);
+
+  //every row is only written by the task that owns it so the rows can
+  //be updated in parallel
+  CThreadPool::RunRanges(m_pThreadPool,
+                         LastRow - FirstRow,
+                         min(LastRow - FirstRow, NumTasksFor((LastRow - FirstRow) * BoxWidth)),
+                         [&](int, int first, int last)
+  {
+    AdjustRows(FirstRow + first, FirstRow + last, reach, pTarget);
+  });
+
+  m_bNodeNormsValid = false;
+
+#ifdef SOM_TELEMETRY
+  SSomTelemetry &telemetry = m_Telemetry.Current();
+
+  telemetry.dSearchSeconds += CSomTelemetry::Seconds(start, searched);
+  telemetry.dUpdateSeconds += CSomTelemetry::Seconds(searched, CSomTelemetry::Now());
+  telemetry.dRadius         = m_dNeighbourhoodRadius;
+  telemetry.dLearningRate   = m_dLearningRate;
+
+  ++telemetry.iVectors;
+
+  //the nodes AdjustRows moved: those strictly inside the radius. The
+  //half width of the disc only shrinks going away from the winner's row
+  const int WinnerCol = (int)m_Codebook.GetGridX()[m_iWinningNode];
+
+  const double WidthSq = m_dNeighbourhoodRadius * m_dNeighbourhoodRadius;
+
+  for (int dy=0, dx=reach; dy<=reach; ++dy)
+  {
+    while (dx >= 0 && (double)(dx * dx + dy * dy) >= WidthSq) --dx;
+
+    if (dx < 0) break;
+
+    const int span = min(m_Codebook.GetCellsAcross() - 1, WinnerCol + dx) - max(0, WinnerCol - dx) + 1;
+
+    if (WinnerRow - dy >= 0)                 telemetry.iNodesTouched += span;
+    if (dy > 0 && WinnerRow + dy < LastRow)  telemetry.iNodesTouched += span;
+  }
+#endif
+}
+
+//---------------------------- AdjustRows --------------------------------
+//
+//------------------------------------------------------------------------
+void CSom::AdjustRows(int firstRow, int lastRow, int reach, const double* pTarget)
+{
+  const int CellsAcross = m_Codebook.GetCellsAcross();
+
+  const int WinnerCol = (int)m_Codebook.GetGridX()[m_iWinningNode];
+  const int WinnerRow = (int)m_Codebook.GetGridY()[m_iWinningNode];
+
+  const int FirstCol = max(0, WinnerCol - reach);
+  const int LastCol  = min(CellsAcross, WinnerCol + reach + 1);
+
+  const double WidthSq = m_dNeighbourhoodRadius * m_dNeighbourhoodRadius;
+
+  const int NumWeights = m_Codebook.GetDim();
+
+  for (int row=firstRow; row<lastRow; ++row)
+  {
+    const int dy = abs(row - WinnerRow);
+
+    const double RowFactor = m_dLearningRate * m_vInfluence[dy];
+
+    //For each node calculate the influence (Theta from equation 6 in
+    //the tutorial. If it is greater than zero adjust the node's weights
+    //accordingly
+    for (int col=FirstCol; col<LastCol; ++col)
+    {
+      const int dx = abs(col - WinnerCol);
+
+      //the square is a little larger than the neighbourhood itself, so
+      //skip the corners
+      if ((double)(dx * dx + dy * dy) >= WidthSq) continue;
+
+      const double rate = RowFactor * m_vInfluence[dx];
+
+      double* pWeights = m_Codebook.GetRow(row * CellsAcross + col);
+
+      for (int w=0; w<NumWeights; ++w)
+      {
+        pWeights[w] += rate * (pTarget[w] - pWeights[w]);
+      }
+
+    }//next node
+  }
+}
+
+//------------------------ BuildInfluenceTable ---------------------------
+//
+//  exp(-(dx^2 + dy^2) / 2r^2) = exp(-dx^2 / 2r^2) * exp(-dy^2 / 2r^2),
+//  so one factor per offset is all that is needed
+//------------------------------------------------------------------------
+void CSom::BuildInfluenceTable(double radius, vector<double> &table)
+{
+  const double WidthSq = radius * radius;
+
+  table.assign(1, 1.0);
+
+  for (int k=1; (double)k * k < WidthSq; ++k)
+  {
+    table.push_back(exp(-(double)(k * k) / (2 * WidthSq)));
+  }
+}
+
+//---------------------------- NumTasksFor -------------------------------
+//
+//------------------------------------------------------------------------
+int CSom::NumTasksFor(int NumNodes) const
+{
+  return CThreadPool::NumTasksFor(m_pThreadPool, NumNodes, MinNodesPerTask);
+}
+
+//---------------------------- BatchEpoch --------------------------------
+//
+//------------------------------------------------------------------------
+bool CSom::BatchEpoch(const vector<vector<double> > &data)
+{
+  //make sure the size of the input vector matches the size of each node's
+  //weight vector
+  if (data.empty() || data[0].size() != (size_t)m_Codebook.GetDim()) return false;
+
+  const int NumWeights = m_Codebook.GetDim();
+
+  return BatchStep(data.size(), [&](size_t v)
+  {
+    return &data[v][0];
+  },
+  [&]()
+  {
+    AccumulateBatch((int)data.size(), [&](int v, double* pInput)
+    {
+      for (int w=0; w<NumWeights; ++w)
+      {
+        pInput[w] = data[v][w];
+      }
+    });
+  });
+}
+
+bool CSom::BatchEpoch(const CDataSet &data)
+{
+  if (data.GetNumVectors() == 0 || data.GetDim() != m_Codebook.GetDim()) return false;
+
+  const int NumWeights = m_Codebook.GetDim();
+
+  const size_t NumVectors = data.GetNumVectors();
+
+  const size_t ChunkSize = min(data.GetChunkSize(), (size_t)0x7fffffff);
+
+  return BatchStep(NumVectors, [&](size_t v)
+  {
+    const float* pVector = data.GetVector(v);
+
+    m_vSample.resize(NumWeights);
+
+    for (int w=0; w<NumWeights; ++w)
+    {
+      m_vSample[w] = pVector[w];
+    }
+
+    return (const double*)&m_vSample[0];
+  },
+  [&]()
+  {
+    //the set is streamed through a chunk at a time, asking for the next
+    //chunk to be read in while this one is worked on. The pages of a
+    //finished chunk are let go, which doesn't cost a second read next
+    //epoch as long as the page cache still has room for them
+    for (size_t first=0; first<NumVectors; first+=ChunkSize)
+    {
+      const size_t count = min(ChunkSize, NumVectors - first);
+
+      if (first + count < NumVectors)
+      {
+        data.WillNeed(first + count, min(ChunkSize, NumVectors - first - count));
+      }
+
+      AccumulateBatch((int)count, [&](int v, double* pInput)
+      {
+        const float* pVector = data.GetVector(first + v);
+
+        for (int w=0; w<NumWeights; ++w)
+        {
+          pInput[w] = pVector[w];
+        }
+      });
+
+      data.DontNeed(first, count);
+    }
+  });
+}
+
+//----------------------------- BatchStep --------------------------------
+//
+//  one iteration of the batch schedule, with Accumulate adding every
+//  training vector to the sums of its BMU
+//------------------------------------------------------------------------
+bool CSom::BatchStep(size_t NumVectors,
+                     const function<const double*(size_t)> &GetVector,
+                     const function<void()> &Accumulate)
+{
+  if (m_Codebook.IsReadOnly()) return false;
+
+  //return if the training is complete
+  if (m_bDone) return true;
+
+  if (--m_iNumIterations > 0)
+  {
+#ifdef SOM_TELEMETRY
+    const CSomTelemetry::Time start = CSomTelemetry::Now();
+
+    //AssignBatch adds its share to the search time as it goes
+    const double searched = m_Telemetry.Current().dSearchSeconds;
+#endif
+
+    //look up the width of the neighbourhood for this timestep
+    m_dNeighbourhoodRadius = m_vRadiusSchedule[m_iIterationCount];
+
+    m_vBatchSum.assign((size_t)m_Codebook.GetNumNodes() * m_Codebook.GetDim(), 0);
+    m_vBatchCount.assign(m_Codebook.GetNumNodes(), 0);
+
+    m_dEpochError = 0;
+
+    Accumulate();
+
+    m_dEpochError /= NumVectors;
+
+    SmoothBatch();
+
+    //the mean distance the nodes moved, added up in node order so it
+    //doesn't depend on how the rows were split
+    if (m_Convergence == SOM_CONVERGE_WEIGHT_CHANGE)
+    {
+      double total = 0;
+
+      for (size_t n=0; n<m_vBatchMove.size(); ++n)
+      {
+        total += sqrt(m_vBatchMove[n]);
+      }
+
+      m_dEpochChange = total / m_Codebook.GetNumNodes();
+    }
+
+    m_bNodeNormsValid = false;
+
+    ++m_iIterationCount;
+
+#ifdef SOM_TELEMETRY
+    SSomTelemetry &telemetry = m_Telemetry.Current();
+
+    //every node is moved to its smoothed mean
+    telemetry.dUpdateSeconds += CSomTelemetry::Seconds(start, CSomTelemetry::Now()) -
+                                (telemetry.dSearchSeconds - searched);
+    telemetry.dRadius         = m_dNeighbourhoodRadius;
+    telemetry.dLearningRate   = 0;
+    telemetry.iVectors       += NumVectors;
+    telemetry.iNodesTouched  += m_Codebook.GetNumNodes();
+#endif
+
+    EndEpoch(NumVectors, &GetVector);
+
+    CheckConvergence();
+  }
+
+  //the schedule has run out. A coarse to fine run moves on to its next
+  //map, anything else is finished
+  else if (!NextLevel())
+  {
+    m_bDone = true;
+
+    //the weights won't move any more, so Project can use cached lengths
+    UpdateNodeNorms();
+  }
+
+  return true;
+}
+
+//------------------------- AccumulateBatch ------------------------------
+//
+//  adds the vectors of one chunk to the sums of their BMUs
+//------------------------------------------------------------------------
+void CSom::AccumulateBatch(int NumVectors, const function<void(int, double*)> &GetVector)
+{
+#ifdef SOM_TELEMETRY
+  const CSomTelemetry::Time start = CSomTelemetry::Now();
+#endif
+
+  AssignBatch(NumVectors, GetVector);
+
+#ifdef SOM_TELEMETRY
+  m_Telemetry.Current().dSearchSeconds += CSomTelemetry::Seconds(start, CSomTelemetry::Now());
+#endif
+
+  if (m_Convergence == SOM_CONVERGE_QUANTIZATION_ERROR)
+  {
+    for (int v=0; v<NumVectors; ++v)
+    {
+      m_dEpochError += sqrt(m_vBatchDist[v]);
+    }
+  }
+
+  const int NumNodes   = m_Codebook.GetNumNodes();
+  const int NumWeights = m_Codebook.GetDim();
+
+  //sort the vectors by BMU. This is a counting sort that keeps the
+  //vectors of each node in their original order, so the sums below
+  //always add them up in the same order, however the vectors are split
+  //into chunks
+  m_vBatchStart.assign(NumNodes + 1, 0);
+
+  for (int v=0; v<NumVectors; ++v)
+  {
+    ++m_vBatchStart[m_vBatchBmu[v] + 1];
+  }
+
+  for (int n=0; n<NumNodes; ++n)
+  {
+    m_vBatchStart[n + 1] += m_vBatchStart[n];
+  }
+
+  m_vBatchOrder.resize(NumVectors);
+
+  {
+    vector<int> next(m_vBatchStart.begin(), m_vBatchStart.end() - 1);
+
+    for (int v=0; v<NumVectors; ++v)
+    {
+      m_vBatchOrder[next[m_vBatchBmu[v]]++] = v;
+    }
+  }
+
+  //add up the vectors won by each node
+  CThreadPool::RunRanges(m_pThreadPool, NumNodes, NumTasksFor(NumNodes), [&](int, int first, int last)
+  {
+    vector<double> vec(NumWeights);
+
+    for (int n=first; n<last; ++n)
+    {
+      double* pSum = &m_vBatchSum[(size_t)n * NumWeights];
+
+      for (int i=m_vBatchStart[n]; i<m_vBatchStart[n + 1]; ++i)
+      {
+        GetVector(m_vBatchOrder[i], &vec[0]);
+
+        for (int w=0; w<NumWeights; ++w)
+        {
+          pSum[w] += vec[w];
+        }
+      }
+
+      m_vBatchCount[n] += m_vBatchStart[n + 1] - m_vBatchStart[n];
+    }
+  });
+}
+
+//---------------------------- AssignBatch -------------------------------
+//
+//  the vectors are independent of each other, so they are split into
+//  ranges and each task searches the whole map for its own vectors
+//------------------------------------------------------------------------
+void CSom::AssignBatch(int NumVectors, const function<void(int, double*)> &GetVector)
+{
+  BmuKernel kernel = GetBmuKernel();
+
+  const int Stride = m_Codebook.GetStride();
+
+  m_vBatchBmu.resize(NumVectors);
+  m_vBatchDist.resize(NumVectors);
+
+  //a few ranges per thread so a slow thread doesn't hold up the rest
+  int NumTasks = m_pThreadPool ? min(NumVectors, m_pThreadPool->GetNumThreads() * 4) : 1;
+
+  if (UseGemm())
+  {
+    UpdateNodeNorms();
+
+    CThreadPool::RunRanges(m_pThreadPool, NumVectors, NumTasks, [&](int, int first, int last)
+    {
+      vector<double> inputs((size_t)TileVectors * Stride, 0);
+
+      vector<double> scratch;
+
+      for (int v=first; v<last; v+=TileVectors)
+      {
+        const int count = min(TileVectors, last - v);
+
+        for (int i=0; i<count; ++i)
+        {
+          GetVector(v + i, &inputs[(size_t)i * Stride]);
+        }
+
+        SearchTile(&inputs[0], count, m_vNodeNorms.data(), scratch, &m_vBatchDist[v], &m_vBatchBmu[v], NULL, NULL);
+      }
+    });
+
+    return;
+  }
+
+  CThreadPool::RunRanges(m_pThreadPool, NumVectors, NumTasks, [&](int, int first, int last)
+  {
+    //padded like the rows for the kernel
+    vector<double> input(Stride, 0);
+
+    for (int v=first; v<last; ++v)
+    {
+      GetVector(v, &input[0]);
+
+      m_vBatchBmu[v] = kernel(m_Codebook.GetWeights(),
+                              Stride,
+                              m_Codebook.GetDim(),
+                              &input[0],
+                              0,
+                              m_Codebook.GetNumNodes(),
+                              &m_vBatchDist[v]);
+    }
+  });
+}
+
+//---------------------------- SmoothBatch -------------------------------
+//
+//  the neighbourhood function exp(-d^2 / 2r^2) is the product of a
+//  factor for the row offset and one for the column offset, so the sums
+//  are convolved along the rows first and the result along the columns,
+//  which costs O(r) per node instead of O(r^2)
+//------------------------------------------------------------------------
+void CSom::SmoothBatch()
+{
+  const int CellsAcross = m_Codebook.GetCellsAcross();
+  const int CellsUp     = m_Codebook.GetCellsUp();
+  const int NumNodes    = m_Codebook.GetNumNodes();
+  const int NumWeights  = m_Codebook.GetDim();
+
+  //the kernel covers the offsets strictly inside the radius
+  BuildInfluenceTable(m_dNeighbourhoodRadius, m_vInfluence);
+
+  const vector<double> &kernel = m_vInfluence;
+
+  const int reach = (int)kernel.size() - 1;
+
+  //both passes work on whole rows of the grid
+  const int NumTasks = min(CellsUp, NumTasksFor(NumNodes));
+
+  m_vBatchRowSum.assign((size_t)NumNodes * NumWeights, 0);
+  m_vBatchRowCount.assign(NumNodes, 0);
+  m_vBatchMove.assign(NumNodes, 0);
+
+  //along each row
+  CThreadPool::RunRanges(m_pThreadPool, CellsUp, NumTasks, [&](int, int first, int last)
+  {
+    for (int row=first; row<last; ++row)
+    {
+      for (int col=0; col<CellsAcross; ++col)
+      {
+        int n = row * CellsAcross + col;
+
+        double* pOut = &m_vBatchRowSum[(size_t)n * NumWeights];
+
+        int from = max(0, col - reach);
+        int to   = min(CellsAcross - 1, col + reach);
+
+        for (int c=from; c<=to; ++c)
+        {
+          int src = row * CellsAcross + c;
+
+          if (m_vBatchCount[src] == 0) continue;
+
+          double h = kernel[abs(c - col)];
+
+          const double* pIn = &m_vBatchSum[(size_t)src * NumWeights];
+
+          for (int w=0; w<NumWeights; ++w)
+          {
+            pOut[w] += h * pIn[w];
+          }
+
+          m_vBatchRowCount[n] += h * m_vBatchCount[src];
+        }
+      }
+    }
+  });
+
+  //then along each column, straight into the weights
+  CThreadPool::RunRanges(m_pThreadPool, CellsUp, NumTasks, [&](int, int first, int last)
+  {
+    vector<double> sum(NumWeights);
+
+    for (int row=first; row<last; ++row)
+    {
+      for (int col=0; col<CellsAcross; ++col)
+      {
+        int n = row * CellsAcross + col;
+
+        int from = max(0, row - reach);
+        int to   = min(CellsUp - 1, row + reach);
+
+        double count = 0;
+
+        sum.assign(NumWeights, 0);
+
+        for (int r=from; r<=to; ++r)
+        {
+          int src = r * CellsAcross + col;
+
+          if (m_vBatchRowCount[src] == 0) continue;
+
+          double h = kernel[abs(r - row)];
+
+          const double* pIn = &m_vBatchRowSum[(size_t)src * NumWeights];
+
+          for (int w=0; w<NumWeights; ++w)
+          {
+            sum[w] += h * pIn[w];
+          }
+
+          count += h * m_vBatchRowCount[src];
+        }
+
+        //a node with no vectors anywhere near it keeps its weights
+        if (count > 0)
+        {
+          double* pWeights = m_Codebook.GetRow(n);
+
+          double move = 0;
+
+          for (int w=0; w<NumWeights; ++w)
+          {
+            const double mean = sum[w] / count;
+
+            move += (mean - pWeights[w]) * (mean - pWeights[w]);
+
+            pWeights[w] = mean;
+          }
+
+          m_vBatchMove[n] = move;
+        }
+      }
+    }
+  });
+}
+
+//--------------------- CalculateBestMatchingNode ------------------------
+//
+//  this function presents an input vector to each node in the network
+//  and calculates the Euclidean distance between the vectors for each
+//  node. It returns the index of the best performer.
+//
+//  The search itself is done by the vectorized kernel picked for this
+//  CPU, which compares squared distances since the square root doesn't
+//  change which node wins
+//------------------------------------------------------------------------
+int CSom::FindBestMatchingNode(const double* pInput, double* pDistSq)
+{
+  const int NumWeights = m_Codebook.GetDim();
+
+  //the kernel reads whole padded rows, so the input is copied into a
+  //buffer padded the same way
+  m_vInput.resize(m_Codebook.GetStride(), 0);
+
+  for (int w=0; w<NumWeights; ++w)
+  {
+    m_vInput[w] = pInput[w];
+  }
+
+  BmuKernel kernel = GetBmuKernel();
+
+  const int NumNodes = m_Codebook.GetNumNodes();
+  const int NumTasks = NumTasksFor(NumNodes);
+
+  double LowestDistance = DBL_MAX;
+
+  int winner = -1;
+
+  if (NumTasks > 1)
+  {
+    //each task finds the winner of its own range of nodes...
+    m_vTaskWinner.resize(NumTasks);
+    m_vTaskDist.resize(NumTasks);
+
+    CThreadPool::RunRanges(m_pThreadPool, NumNodes, NumTasks, [&](int task, int first, int last)
+    {
+      m_vTaskWinner[task] = kernel(m_Codebook.GetWeights(),
+                                   m_Codebook.GetStride(),
+                                   NumWeights,
+                                   &m_vInput[0],
+                                   first,
+                                   last,
+                                   &m_vTaskDist[task]);
+    });
+
+    //...and the local winners are compared in node order, so ties are
+    //resolved exactly as a single search over the whole map would
+    for (int task=0; task<NumTasks; ++task)
+    {
+      if (m_vTaskWinner[task] >= 0 && m_vTaskDist[task] < LowestDistance)
+      {
+        LowestDistance = m_vTaskDist[task];
+
+        winner = m_vTaskWinner[task];
+      }
+    }
+  }
+
+  else
+  {
+    winner = kernel(m_Codebook.GetWeights(),
+                    m_Codebook.GetStride(),
+                    NumWeights,
+                    &m_vInput[0],
+                    0,
+                    NumNodes,
+                    &LowestDistance);
+  }
+
+  if (pDistSq) *pDistSq = LowestDistance;
+
+  return winner;
+}
+
+//------------------------------- Project --------------------------------
+//
+//------------------------------------------------------------------------
+void CSom::Project(const float* pData,
+                   size_t NumVectors,
+                   uint32_t* pBmu,
+                   float* pDist,
+                   uint32_t* pSecond) const
+{
+  const int NumWeights = m_Codebook.GetDim();
+  const int Stride     = m_Codebook.GetStride();
+
+  //the cached node lengths are used once training has stopped moving
+  //the weights, otherwise the call works out its own so it never writes
+  //to the map
+  vector<double> norms;
+
+  const double* pNodeNorms = NULL;
+
+  if (UseGemm())
+  {
+    if (!m_bNodeNormsValid) ComputeNodeNorms(norms);
+
+    pNodeNorms = m_bNodeNormsValid ? m_vNodeNorms.data() : norms.data();
+  }
+
+  const int NumTiles = (int)((NumVectors + TileVectors - 1) / TileVectors);
+
+  const int NumTasks = m_pThreadPool ? min(NumTiles, m_pThreadPool->GetNumThreads() * 4) : 1;
+
+  CThreadPool::RunRanges(m_pThreadPool, NumTiles, NumTasks, [&](int, int FirstTile, int LastTile)
+  {
+    //the vectors of the tile, padded like the codebook rows
+    vector<double> inputs((size_t)TileVectors * Stride, 0);
+
+    vector<double> scratch;
+
+    double best[TileVectors], second[TileVectors];
+    int    bestNode[TileVectors], secondNode[TileVectors];
+
+    for (int tile=FirstTile; tile<LastTile; ++tile)
+    {
+      const size_t FirstVector = (size_t)tile * TileVectors;
+
+      const int count = (int)min((size_t)TileVectors, NumVectors - FirstVector);
+
+      for (int i=0; i<count; ++i)
+      {
+        const float* pIn = pData + (FirstVector + i) * NumWeights;
+
+        for (int w=0; w<NumWeights; ++w)
+        {
+          inputs[(size_t)i * Stride + w] = pIn[w];
+        }
+      }
+
+      SearchTile(&inputs[0], count, pNodeNorms, scratch, best, bestNode, second, secondNode);
+
+      for (int i=0; i<count; ++i)
+      {
+        pBmu[FirstVector + i] = (uint32_t)bestNode[i];
+
+        if (pDist)   pDist[FirstVector + i]   = (float)sqrt(best[i]);
+        if (pSecond) pSecond[FirstVector + i] = (uint32_t)secondNode[i];
+      }
+    }
+  });
+}
+
+//----------------------------- SearchTile -------------------------------
+//
+//  the map is walked a cache sized slice of nodes at a time, so the
+//  slice is reused by every vector of the tile while it is hot.
+//
+//  the exact search works out each vector's distances to the slice with
+//  the distance kernel. The matrix product search works out the dot
+//  products of all the vectors with the slice in one go, which loads
+//  every weight once per four vectors instead of once per vector, and
+//  turns them into distances with the cached lengths
+//------------------------------------------------------------------------
+void CSom::SearchTile(const double* pInputs,
+                      int count,
+                      const double* pNodeNorms,
+                      vector<double> &scratch,
+                      double* pBest,
+                      int* pBestNode,
+                      double* pSecond,
+                      int* pSecondNode) const
+{
+  DistKernel kernel = GetDistKernel();
+
+  const int NumNodes   = m_Codebook.GetNumNodes();
+  const int NumWeights = m_Codebook.GetDim();
+  const int Stride     = m_Codebook.GetStride();
+
+  const int SliceNodes = max(64, SliceBytes / (int)(Stride * sizeof(double)));
+
+  const bool gemm = UseGemm();
+
+  double InputNorms[TileVectors];
+
+  for (int i=0; i<count; ++i)
+  {
+    pBest[i]     = DBL_MAX;
+    pBestNode[i] = -1;
+
+    if (pSecond)
+    {
+      pSecond[i]     = DBL_MAX;
+      pSecondNode[i] = -1;
+    }
+
+    if (gemm)
+    {
+      const double* pIn = pInputs + (size_t)i * Stride;
+
+      double norm = 0;
+
+      for (int w=0; w<NumWeights; ++w)
+      {
+        norm += pIn[w] * pIn[w];
+      }
+
+      InputNorms[i] = norm;
+    }
+  }
+
+  scratch.resize((size_t)(gemm ? count : 1) * SliceNodes);
+
+  for (int first=0; first<NumNodes; first+=SliceNodes)
+  {
+    const int last = min(NumNodes, first + SliceNodes);
+
+    const int ld = last - first;
+
+    if (gemm)
+    {
+      GetDotKernel()(m_Codebook.GetWeights(), Stride, NumWeights,
+                     pInputs, count, first, last, &scratch[0]);
+    }
+
+    for (int i=0; i<count; ++i)
+    {
+      double* pDist = &scratch[gemm ? (size_t)i * ld : 0];
+
+      if (gemm)
+      {
+        //rounding can take a distance of about zero just below it
+        for (int n=0; n<ld; ++n)
+        {
+          pDist[n] = max(0.0, InputNorms[i] - 2 * pDist[n] + pNodeNorms[first + n]);
+        }
+      }
+
+      else
+      {
+        kernel(m_Codebook.GetWeights(), Stride, NumWeights,
+               pInputs + (size_t)i * Stride, first, last, pDist);
+      }
+
+      //nodes are visited in order and only a strictly smaller distance
+      //replaces the winner, so ties go to the lowest index just as they
+      //do in FindBestMatchingNode
+      for (int n=first; n<last; ++n)
+      {
+        double d = pDist[n - first];
+
+        if (d < pBest[i])
+        {
+          if (pSecond)
+          {
+            pSecond[i]     = pBest[i];
+            pSecondNode[i] = pBestNode[i];
+          }
+
+          pBest[i]     = d;
+          pBestNode[i] = n;
+        }
+
+        else if (pSecond && d < pSecond[i])
+        {
+          pSecond[i]     = d;
+          pSecondNode[i] = n;
+        }
+      }
+    }
+  }
+
+  //the expanded form loses precision to cancellation when the vectors
+  //are long and close together, so the winner's distance is redone
+  if (gemm)
+  {
+    for (int i=0; i<count; ++i)
+    {
+      if (pBestNode[i] < 0) continue;
+
+      kernel(m_Codebook.GetWeights(), Stride, NumWeights,
+             pInputs + (size_t)i * Stride, pBestNode[i], pBestNode[i] + 1, &pBest[i]);
+    }
+  }
+}
+
+//-------------------------- UpdateNodeNorms -----------------------------
+//
+//------------------------------------------------------------------------
+void CSom::UpdateNodeNorms()
+{
+  if (m_bNodeNormsValid) return;
+
+  ComputeNodeNorms(m_vNodeNorms);
+
+  m_bNodeNormsValid = true;
+}
+
+//------------------------- ComputeNodeNorms -----------------------------
+//
+//------------------------------------------------------------------------
+void CSom::ComputeNodeNorms(vector<double> &norms) const
+{
+  const int NumNodes   = m_Codebook.GetNumNodes();
+  const int NumWeights = m_Codebook.GetDim();
+
+  norms.resize(NumNodes);
+
+  CThreadPool::RunRanges(m_pThreadPool, NumNodes, NumTasksFor(NumNodes), [&](int, int first, int last)
+  {
+    for (int n=first; n<last; ++n)
+    {
+      const double* pRow = m_Codebook.GetRow(n);
+
+      double norm = 0;
+
+      for (int w=0; w<NumWeights; ++w)
+      {
+        norm += pRow[w] * pRow[w];
+      }
+
+      norms[n] = norm;
+    }
+  });
+}
+
+//------------------------- QuantizationError ----------------------------
+//
+//------------------------------------------------------------------------
+double CSom::QuantizationError(const float* pData, size_t NumVectors) const
+{
+  if (NumVectors == 0) return 0;
+
+  vector<uint32_t> bmu(NumVectors);
+  vector<float> dist(NumVectors);
+
+  Project(pData, NumVectors, &bmu[0], &dist[0]);
+
+  double total = 0;
+
+  for (size_t v=0; v<NumVectors; ++v)
+  {
+    total += dist[v];
+  }
+
+  return total / NumVectors;
+}
+
+//-------------------------- TopographicError ----------------------------
+//
+//------------------------------------------------------------------------
+double CSom::TopographicError(const float* pData, size_t NumVectors) const
+{
+  double QuantizationError, TopographicError;
+
+  MapErrors(pData, NumVectors, QuantizationError, TopographicError);
+
+  return TopographicError;
+}
+
+//----------------------------- MapErrors --------------------------------
+//
+//------------------------------------------------------------------------
+void CSom::MapErrors(const float* pData,
+                     size_t NumVectors,
+                     double &QuantizationError,
+                     double &TopographicError) const
+{
+  QuantizationError = 0;
+  TopographicError  = 0;
+
+  if (NumVectors == 0) return;
+
+  //a single node has no second best unit to compare with
+  if (m_Codebook.GetNumNodes() < 2)
+  {
+    QuantizationError = this->QuantizationError(pData, NumVectors);
+
+    return;
+  }
+
+  vector<uint32_t> bmu(NumVectors), second(NumVectors);
+  vector<float> dist(NumVectors);
+
+  Project(pData, NumVectors, &bmu[0], &dist[0], &second[0]);
+
+  const double* pGridX = m_Codebook.GetGridX();
+  const double* pGridY = m_Codebook.GetGridY();
+
+  double total = 0;
+
+  size_t errors = 0;
+
+  for (size_t v=0; v<NumVectors; ++v)
+  {
+    total += dist[v];
+
+    if (fabs(pGridX[bmu[v]] - pGridX[second[v]]) > 1 ||
+        fabs(pGridY[bmu[v]] - pGridY[second[v]]) > 1)
+    {
+      ++errors;
+    }
+  }
+
+  QuantizationError = total / NumVectors;
+  TopographicError  = (double)errors / NumVectors;
+}
+
+//---------------------------- Save --------------------------------------
+//
+//------------------------------------------------------------------------
+bool CSom::Save(const char* path) const
+{
+  if (m_Codebook.GetNumNodes() == 0) return false;
+
+  SSomFileHeader header;
+
+  memset(&header, 0, sizeof(header));
+
+  memcpy(header.szMagic, SomFileMagic, sizeof(SomFileMagic));
+
+  const size_t WeightsBytes = (size_t)m_Codebook.GetNumNodes() *
+                              m_Codebook.GetStride() * sizeof(double);
+
+  header.iVersion             = SomFileVersion;
+  header.iHeaderSize          = sizeof(SSomFileHeader);
+  header.iByteOrder           = SomFileByteOrder;
+  header.iScalarType          = SOM_SCALAR_FLOAT64;
+  header.iTopology            = SOM_TOPOLOGY_RECT;
+  header.iDim                 = m_Codebook.GetDim();
+  header.iStride              = m_Codebook.GetStride();
+  header.iCellsAcross         = m_Codebook.GetCellsAcross();
+  header.iCellsUp             = m_Codebook.GetCellsUp();
+  header.iTotalIterations     = m_vRadiusSchedule.empty() ? 0 : (uint32_t)m_vRadiusSchedule.size() - 1;
+  header.iIterationCount      = m_iIterationCount;
+  header.iDone                = m_bDone ? 1 : 0;
+  header.dMapRadius           = m_dMapRadius;
+  header.dTimeConstant        = m_dTimeConstant;
+  header.dNeighbourhoodRadius = m_dNeighbourhoodRadius;
+  header.dLearningRate        = m_dLearningRate;
+  header.dStartLearningRate   = m_dStartLearningRate;
+  header.iWeightsOffset       = (sizeof(SSomFileHeader) + 63) & ~(size_t)63;
+  header.iWeightsBytes        = WeightsBytes;
+
+  //write everything to a file next to the target and only swap it in once
+  //it is complete. Overwriting the target in place would pull the pages
+  //out from under anyone who has it mapped
+  const string temp = string(path) + ".tmp";
+
+  FILE* pFile = fopen(temp.c_str(), "wb");
+
+  if (!pFile) return false;
+
+  static const char zeros[64] = { 0 };
+
+  bool ok = fwrite(&header, sizeof(header), 1, pFile) == 1 &&
+            fwrite(zeros, 1, header.iWeightsOffset - sizeof(header), pFile) == header.iWeightsOffset - sizeof(header) &&
+            fwrite(m_Codebook.GetWeights(), 1, WeightsBytes, pFile) == WeightsBytes;
+
+  ok = (fclose(pFile) == 0) && ok;
+
+#ifdef _WIN32
+  //rename won't replace an existing file on Windows
+  if (ok) remove(path);
+#endif
+
+  if (ok) ok = rename(temp.c_str(), path) == 0;
+
+  if (!ok) remove(temp.c_str());
+
+  return ok;
+}
+
+//---------------------------- Load --------------------------------------
+//
+//------------------------------------------------------------------------
+bool CSom::Load(const char* path)
+{
+  CFileMapping file;
+
+  if (!file.Open(path) || !IsValidSomFile(file.GetData(), file.GetSize())) return false;
+
+  const SSomFileHeader* pHeader = (const SSomFileHeader*)file.GetData();
+
+  //the map in memory stays as it is if there is no room for this one
+  CCodebook codebook;
+
+  if (!codebook.Create(pHeader->iCellsUp, pHeader->iCellsAcross, pHeader->iDim)) return false;
+
+  m_Codebook.Swap(codebook);
+
+  m_Mapping.Close();
+
+  m_bNodeNormsValid = false;
+
+  memcpy(m_Codebook.GetWeights(),
+         (const char*)file.GetData() + pHeader->iWeightsOffset,
+         pHeader->iWeightsBytes);
+
+  RestoreTraining(*pHeader);
+
+  //ready for Project, which won't work them out for itself
+  UpdateNodeNorms();
+
+  return true;
+}
+
+//------------------------- RestoreTraining ------------------------------
+//
+//  picks the training up where the saved map left it, with the same
+//  schedule
+//------------------------------------------------------------------------
+void CSom::RestoreTraining(const SSomFileHeader &header)
+{
+  const int total = (int)min(header.iTotalIterations, (uint32_t)0x7ffffffe);
+
+  m_dMapRadius           = header.dMapRadius;
+  m_iIterationCount      = max(1, (int)min(header.iIterationCount, (uint32_t)total + 1));
+  m_iNumIterations       = total - (m_iIterationCount - 1);
+  m_dNeighbourhoodRadius = header.dNeighbourhoodRadius;
+  m_dLearningRate        = header.dLearningRate;
+  m_bDone                = header.iDone != 0;
+
+  //files from before the start rate was saved leave it zero
+  m_dStartLearningRate   = header.dStartLearningRate > 0 ? header.dStartLearningRate : constStartLearningRate;
+
+  m_vLevels.clear();
+  m_iNextLevel = 0;
+
+#ifdef SOM_TELEMETRY
+  m_Telemetry.Reset();
+#endif
+
+  m_iIterationsSaved = 0;
+
+  BuildSchedules(total);
+}
+
+//----------------------------- Map --------------------------------------
+//
+//------------------------------------------------------------------------
+bool CSom::Map(const char* path)
+{
+  CFileMapping file;
+
+  if (!file.Open(path) || !IsValidSomFile(file.GetData(), file.GetSize())) return false;
+
+  const SSomFileHeader* pHeader = (const SSomFileHeader*)file.GetData();
+
+  //the mapping starts on a page boundary and the weights on a multiple
+  //of 64 bytes into it, so the rows are aligned just as Create aligns them
+  m_Codebook.Attach((const double*)((const char*)file.GetData() + pHeader->iWeightsOffset),
+                    pHeader->iCellsUp,
+                    pHeader->iCellsAcross,
+                    pHeader->iDim);
+
+  //the training state is kept so the map saves back out as it came in
+  RestoreTraining(*pHeader);
+
+  m_Mapping.Swap(file);
+
+  m_bNodeNormsValid = false;
+
+  //ready for Project, which won't work them out for itself
+  UpdateNodeNorms();
+
+  return true;
+}
@@ -0,0 +1,170 @@
+#include "CSomSweep.h"
+
+#include <math.h>
+#include <chrono>
+#include <algorithm>
+
+using namespace std;
+
+
+//------------------------------ AddGrid ---------------------------------
+//
+//------------------------------------------------------------------------
+void CSomSweep::AddGrid(const vector<int> &sizes,
+                        const vector<int> &iterations,
+                        const vector<double> &rates,
+                        const vector<int> &levels,
+                        bool batch,
+                        uint64_t seed)
+{
+	for (size_t s=0; s<sizes.size(); ++s)
+	{
+		for (size_t i=0; i<iterations.size(); ++i)
+		{
+			for (size_t r=0; r<rates.size(); ++r)
+			{
+				for (size_t l=0; l<levels.size(); ++l)
+				{
+					SSomConfig config;
+
+					config.iCellsUp           = sizes[s];
+					config.iCellsAcross       = sizes[s];
+					config.iIterations        = iterations[i];
+					config.dStartLearningRate = rates[r];
+					config.iLevels            = levels[l];
+					config.bBatch             = batch;
+					config.iSeed              = seed++;
+
+					Add(config);
+				}
+			}
+		}
+	}
+}
+
+//------------------------------- CostOf ---------------------------------
+//
+//  an online epoch touches every node once, a batch pass every node for
+//  every vector. Coarse to fine runs are cheaper than this says, but only
+//  the order matters
+//------------------------------------------------------------------------
+double CSomSweep::CostOf(int c) const
+{
+	const SSomConfig &config = m_vConfigs[c];
+
+	double cost = (double)config.iCellsUp * config.iCellsAcross * config.iIterations;
+
+	if (config.bBatch) cost *= (double)m_pData->GetNumVectors();
+
+	return cost;
+}
+
+//-------------------------------- Run -----------------------------------
+//
+//------------------------------------------------------------------------
+bool CSomSweep::Run(const function<void(const SSweepResult&)> &OnFinished)
+{
+	const CDataSet &data = *m_pData;
+
+	if (data.GetNumVectors() == 0) return false;
+
+	const int NumConfigs = (int)m_vConfigs.size();
+
+	m_vResults.assign(NumConfigs, SSweepResult());
+
+	//a worker runs the newest task on its own queue first and the scheduler
+	//deals the tasks out over the queues in turn, so submitting the
+	//cheapest first has every worker start on the most expensive it was
+	//dealt and leaves the short runs for the end, where they fill the gaps
+	vector<int> order(NumConfigs);
+
+	for (int c=0; c<NumConfigs; ++c)
+	{
+		order[c] = c;
+	}
+
+	stable_sort(order.begin(), order.end(), [this](int a, int b){ return CostOf(a) < CostOf(b); });
+
+	for (int i=0; i<NumConfigs; ++i)
+	{
+		const int c = order[i];
+
+		m_pScheduler->Submit([this, c, &data, &OnFinished]()
+		{
+			const SSomConfig &config = m_vConfigs[c];
+
+			const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+			//one map per task, alive only while it trains, so a sweep
+			//holds no more maps in memory than there are threads
+			CSom som;
+
+			som.Seed(config.iSeed);
+
+			som.SetStartLearningRate(config.dStartLearningRate);
+
+			som.SetEarlyStopping(m_Convergence, m_iStopWindow, m_dStopThreshold);
+
+			const bool created = config.iLevels > 1 ?
+				som.CreateCoarseToFine(config.iCellsAcross, config.iCellsUp,
+				                       config.iCellsUp, config.iCellsAcross,
+				                       config.iIterations, config.iLevels, data.GetDim()) :
+				som.Create(config.iCellsAcross, config.iCellsUp,
+				           config.iCellsUp, config.iCellsAcross,
+				           config.iIterations, data.GetDim());
+
+			SSweepResult &result = m_vResults[c];
+
+			result.config = config;
+
+			//a map too big for memory is reported rather than trained
+			if (!created)
+			{
+				result.dQuantizationError = NAN;
+				result.dTopographicError  = NAN;
+				result.iIterationsSaved   = 0;
+				result.dSeconds           = 0;
+
+				if (OnFinished)
+				{
+					lock_guard<mutex> lock(m_Mutex);
+
+					OnFinished(result);
+				}
+
+				return;
+			}
+
+			if (m_bLinearInit)
+			{
+				som.InitializeLinear(data);
+
+				if (m_dLinearStartRadius > 0) som.SetStartRadius(m_dLinearStartRadius);
+			}
+
+			while (!som.FinishedTraining())
+			{
+				if (config.bBatch) som.BatchEpoch(data);
+				else               som.Epoch(data);
+			}
+
+			//both measures from one pass over the set
+			som.MapErrors(data.GetData(), data.GetNumVectors(),
+			              result.dQuantizationError, result.dTopographicError);
+
+			result.iIterationsSaved   = som.GetIterationsSaved();
+			result.dSeconds           = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+			if (OnFinished)
+			{
+				lock_guard<mutex> lock(m_Mutex);
+
+				OnFinished(result);
+			}
+		});
+	}
+
+	m_pScheduler->Wait();
+
+	return true;
+}
@@ -0,0 +1,175 @@
+#include "CTaskScheduler.h"
+
+
+//the worker the calling thread is, -1 for threads that aren't workers
+static thread_local int t_iWorker = -1;
+
+//and the scheduler it belongs to
+static thread_local const CTaskScheduler* t_pScheduler = NULL;
+
+
+CTaskScheduler::CTaskScheduler(int NumThreads):
+	m_iQueued(0),
+	m_iPending(0),
+	m_iNextQueue(0),
+	m_bStop(false)
+{
+	if (NumThreads <= 0)
+	{
+		NumThreads = max(1, (int)thread::hardware_concurrency());
+	}
+
+	for (int t=0; t<NumThreads; ++t)
+	{
+		m_vQueues.push_back(new SQueue);
+	}
+
+	for (int t=0; t<NumThreads; ++t)
+	{
+		m_Workers.push_back(thread(&CTaskScheduler::WorkerLoop, this, t));
+	}
+}
+
+CTaskScheduler::~CTaskScheduler()
+{
+	Wait();
+
+	{
+		lock_guard<mutex> lock(m_Mutex);
+
+		m_bStop = true;
+	}
+
+	m_WorkReady.notify_all();
+
+	for (size_t t=0; t<m_Workers.size(); ++t)
+	{
+		m_Workers[t].join();
+	}
+
+	for (size_t t=0; t<m_vQueues.size(); ++t)
+	{
+		delete m_vQueues[t];
+	}
+}
+
+//------------------------------- Submit ---------------------------------
+//
+//------------------------------------------------------------------------
+void CTaskScheduler::Submit(const function<void()> &task)
+{
+	const int worker = t_pScheduler == this ? t_iWorker
+	                                        : (int)(m_iNextQueue.fetch_add(1) % m_vQueues.size());
+
+	++m_iPending;
+
+	{
+		lock_guard<mutex> lock(m_vQueues[worker]->m_Mutex);
+
+		m_vQueues[worker]->m_Tasks.push_back(task);
+	}
+
+	//counted under the lock the workers sleep on, so a worker that has
+	//just found every queue empty can't miss it
+	{
+		lock_guard<mutex> lock(m_Mutex);
+
+		++m_iQueued;
+	}
+
+	m_WorkReady.notify_one();
+}
+
+//-------------------------------- Wait ----------------------------------
+//
+//------------------------------------------------------------------------
+void CTaskScheduler::Wait()
+{
+	unique_lock<mutex> lock(m_Mutex);
+
+	m_AllDone.wait(lock, [this]{ return m_iPending == 0; });
+}
+
+//------------------------------ TakeTask --------------------------------
+//
+//  the own queue is worked from the back, the others are robbed from the
+//  front: the oldest task of a queue is the one its owner would get to
+//  last, and where a task splits its work up, usually the biggest
+//------------------------------------------------------------------------
+bool CTaskScheduler::TakeTask(int worker, function<void()> &task)
+{
+	{
+		SQueue &own = *m_vQueues[worker];
+
+		lock_guard<mutex> lock(own.m_Mutex);
+
+		if (!own.m_Tasks.empty())
+		{
+			task = own.m_Tasks.back();
+
+			own.m_Tasks.pop_back();
+
+			--m_iQueued;
+
+			return true;
+		}
+	}
+
+	const int NumQueues = (int)m_vQueues.size();
+
+	for (int i=1; i<NumQueues; ++i)
+	{
+		SQueue &victim = *m_vQueues[(worker + i) % NumQueues];
+
+		lock_guard<mutex> lock(victim.m_Mutex);
+
+		if (!victim.m_Tasks.empty())
+		{
+			task = victim.m_Tasks.front();
+
+			victim.m_Tasks.pop_front();
+
+			--m_iQueued;
+
+			return true;
+		}
+	}
+
+	return false;
+}
+
+//----------------------------- WorkerLoop -------------------------------
+//
+//------------------------------------------------------------------------
+void CTaskScheduler::WorkerLoop(int worker)
+{
+	t_iWorker    = worker;
+	t_pScheduler = this;
+
+	function<void()> task;
+
+	for (;;)
+	{
+		if (TakeTask(worker, task))
+		{
+			task();
+
+			task = nullptr;
+
+			if (--m_iPending == 0)
+			{
+				lock_guard<mutex> lock(m_Mutex);
+
+				m_AllDone.notify_all();
+			}
+
+			continue;
+		}
+
+		unique_lock<mutex> lock(m_Mutex);
+
+		m_WorkReady.wait(lock, [this]{ return m_bStop || m_iQueued > 0; });
+
+		if (m_bStop) return;
+	}
+}
@@ -0,0 +1,177 @@
+#include "CThreadPool.h"
+
+
+CThreadPool::CThreadPool(int NumThreads):
+	m_pTask(NULL),
+	m_iNumTasks(0),
+	m_iNextTask(0),
+	m_iTasksDone(0),
+	m_iActive(0),
+	m_iGeneration(0),
+	m_bStop(false)
+{
+	if (NumThreads <= 0)
+	{
+		NumThreads = (int)thread::hardware_concurrency();
+	}
+
+	for (int t=1; t<NumThreads; ++t)
+	{
+		m_Workers.push_back(thread(&CThreadPool::WorkerLoop, this));
+	}
+}
+
+CThreadPool::~CThreadPool()
+{
+	{
+		lock_guard<mutex> lock(m_Mutex);
+
+		m_bStop = true;
+	}
+
+	m_WorkReady.notify_all();
+
+	for (size_t t=0; t<m_Workers.size(); ++t)
+	{
+		m_Workers[t].join();
+	}
+}
+
+//---------------------------- ParallelFor -------------------------------
+//
+//------------------------------------------------------------------------
+void CThreadPool::ParallelFor(int NumTasks, const function<void(int)> &task)
+{
+	if (NumTasks <= 0) return;
+
+	//nothing to share the work with
+	if (m_Workers.empty() || NumTasks == 1)
+	{
+		for (int i=0; i<NumTasks; ++i)
+		{
+			task(i);
+		}
+
+		return;
+	}
+
+	lock_guard<mutex> turn(m_LoopMutex);
+
+	unique_lock<mutex> lock(m_Mutex);
+
+	//a worker that woke up late for the previous loop may still be
+	//looking at it, so wait for it to leave before changing anything
+	m_WorkDone.wait(lock, [this]{ return m_iActive == 0; });
+
+	m_pTask      = &task;
+	m_iNumTasks  = NumTasks;
+	m_iNextTask  = 0;
+	m_iTasksDone = 0;
+
+	++m_iGeneration;
+
+	lock.unlock();
+
+	m_WorkReady.notify_all();
+
+	RunTasks();
+
+	lock.lock();
+
+	m_WorkDone.wait(lock, [this]{ return m_iTasksDone == m_iNumTasks; });
+
+	m_pTask = NULL;
+}
+
+//---------------------------- NumTasksFor -------------------------------
+//
+//------------------------------------------------------------------------
+int CThreadPool::NumTasksFor(const CThreadPool* pPool,
+                             size_t NumItems,
+                             size_t MinItemsPerTask,
+                             int TasksPerThread)
+{
+	if (!pPool) return 1;
+
+	const size_t MaxTasks = (size_t)pPool->GetNumThreads() * TasksPerThread;
+
+	return (int)max((size_t)1, min(MaxTasks, NumItems / MinItemsPerTask));
+}
+
+//----------------------------- RunRanges --------------------------------
+//
+//------------------------------------------------------------------------
+void CThreadPool::RunRanges(CThreadPool* pPool,
+                            size_t NumItems,
+                            int NumTasks,
+                            const function<void(int, size_t, size_t)> &body)
+{
+	if (NumTasks <= 1 || !pPool)
+	{
+		body(0, 0, NumItems);
+
+		return;
+	}
+
+	pPool->ParallelFor(NumTasks, [&](int task)
+	{
+		body(task, NumItems * task / NumTasks, NumItems * (task + 1) / NumTasks);
+	});
+}
+
+//----------------------------- RunTasks ---------------------------------
+//
+//  keeps taking tasks until there are none left
+//------------------------------------------------------------------------
+void CThreadPool::RunTasks()
+{
+	const int NumTasks = m_iNumTasks;
+
+	for (;;)
+	{
+		int i = m_iNextTask.fetch_add(1);
+
+		if (i >= NumTasks) break;
+
+		(*m_pTask)(i);
+
+		if (m_iTasksDone.fetch_add(1) + 1 == NumTasks)
+		{
+			lock_guard<mutex> lock(m_Mutex);
+
+			m_WorkDone.notify_all();
+		}
+	}
+}
+
+//---------------------------- WorkerLoop --------------------------------
+//
+//------------------------------------------------------------------------
+void CThreadPool::WorkerLoop()
+{
+	unsigned int seen = 0;
+
+	for (;;)
+	{
+		unique_lock<mutex> lock(m_Mutex);
+
+		m_WorkReady.wait(lock, [&]{ return m_bStop || m_iGeneration != seen; });
+
+		if (m_bStop) return;
+
+		seen = m_iGeneration;
+
+		++m_iActive;
+
+		lock.unlock();
+
+		RunTasks();
+
+		lock.lock();
+
+		if (--m_iActive == 0)
+		{
+			m_WorkDone.notify_all();
+		}
+	}
+}
@@ -0,0 +1,131 @@
+//------------------------------------------------------------------------
+//
+//  Name:   EegStreamMain.cpp
+//
+//  Desc:   trains a map live on the headset. The EEG decoder is linked
+//          in, and its constructor opens the headset's port and starts
+//          decoding on a thread of its own; every band power record it
+//          decodes is pushed to a CEegStreamTrainer.
+//
+//          the map is saved every minute and on Ctrl+C to the file given
+//          on the command line (som.map by default), and picked up from
+//          there on the next run, so it keeps adapting to the same user
+//          from one session to the next
+//
+//  Usage:  EegStream [map file]
+//
+//------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <signal.h>
+#include <chrono>
+#include <thread>
+
+#include "ThnkrEegDecoder.h"
+
+#include "CSom.h"
+#include "CEegStreamTrainer.h"
+#include "constants.h"
+
+
+//how often the map is written out, in seconds
+static const int SaveInterval = 60;
+
+static volatile sig_atomic_t g_bQuit = 0;
+
+
+static void OnInterrupt(int)
+{
+	g_bQuit = 1;
+}
+
+//called on the decoder's thread for every record
+static void OnEegSample(const EegData* pSample, void* customData)
+{
+	const unsigned int bands[constNumEegBands] = { pSample->delta,
+	                                               pSample->theta,
+	                                               pSample->lAlpha,
+	                                               pSample->hAlpha,
+	                                               pSample->lBeta,
+	                                               pSample->hBeta,
+	                                               pSample->lGamma,
+	                                               pSample->mGamma };
+
+	((CEegStreamTrainer*)customData)->PushBandPowers(bands);
+}
+
+//the trainer must be stopped, as its thread is the only one allowed near
+//the map while it runs
+static void WriteMap(const CEegStreamTrainer &trainer, const CSom &som, const char* path)
+{
+	if (!som.Save(path)) fprintf(stderr, "couldn't save the map to %s\n", path);
+
+	printf("trained on %llu records, dropped %llu\n",
+	       (unsigned long long)trainer.GetNumTrained(),
+	       (unsigned long long)trainer.GetNumDropped());
+
+	fflush(stdout);
+}
+
+static void SaveMap(CEegStreamTrainer &trainer, const CSom &som, const char* path)
+{
+	trainer.Stop();
+
+	WriteMap(trainer, som, path);
+
+	trainer.Start();
+}
+
+int main(int argc, char* argv[])
+{
+	const char* path = argc > 1 ? argv[1] : "som.map";
+
+	CSom som;
+
+	const bool resumed = som.Load(path) && som.GetCodebook().GetDim() == constNumEegBands;
+
+	if (!resumed && !som.Create(constNumCellsAcross,
+	                            constNumCellsDown,
+	                            constNumCellsDown,
+	                            constNumCellsAcross,
+	                            constNumIterations,
+	                            constNumEegBands))
+	{
+		fprintf(stderr, "not enough memory for the map\n");
+
+		return 1;
+	}
+
+	CEegStreamTrainer trainer(&som);
+
+	//a map that has already been trained is only fine tuned
+	if (resumed)
+	{
+		trainer.SetSchedule(2.0, 2.0, constStartLearningRate / 10, constStartLearningRate / 10, 1);
+	}
+
+	signal(SIGINT, OnInterrupt);
+	signal(SIGTERM, OnInterrupt);
+
+	setThnkrEegSampleSink(OnEegSample, &trainer);
+
+	trainer.Start();
+
+	int seconds = 0;
+
+	while (!g_bQuit)
+	{
+		std::this_thread::sleep_for(std::chrono::seconds(1));
+
+		if (++seconds % SaveInterval == 0) SaveMap(trainer, som, path);
+	}
+
+	//waits for a record already on its way to the trainer
+	setThnkrEegSampleSink(NULL, NULL);
+
+	trainer.Stop();
+
+	WriteMap(trainer, som, path);
+
+	return 0;
+}
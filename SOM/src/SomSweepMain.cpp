@@ -0,0 +1,219 @@
+//------------------------------------------------------------------------
+//
+//  Name:   SomSweepMain.cpp
+//
+//  Desc:   trains every combination of the map sizes, schedule lengths,
+//          start learning rates and coarse to fine levels given on one
+//          data set, as many maps at a time as there are threads, and
+//          prints the quantization and topographic error of each as CSV,
+//          one line per map as it finishes. The results are the same
+//          for any number of threads, so a sweep can be rerun on a bigger
+//          box and compared line by line.
+//
+//          --stop-window turns early stopping on, on the quantization
+//          error or with --stop-on-change on the weight change, and the
+//          saved column gives the iterations it left out
+//
+//          --linear starts every map from its principal components
+//          instead of random weights, and --start-radius then has its
+//          schedule start from a narrower neighbourhood
+//
+//          a data set file is mapped as it is; a .csv file is converted
+//          to one next to it first (the same name with .dat added), which
+//          later runs can be pointed at instead
+//
+//  Usage:  SomSweep <data set or csv> [--sizes 20,40] [--iterations n,n]
+//                   [--rates 0.05,0.1,0.2] [--levels 1,3] [--batch]
+//                   [--threads n] [--seed n] [--stop-window n]
+//                   [--stop-threshold 0.001] [--stop-on-change]
+//                   [--linear [--start-radius r]]
+//
+//------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <chrono>
+
+using namespace std;
+
+#include "CSomSweep.h"
+#include "CTaskScheduler.h"
+#include "CDataSet.h"
+#include "CThreadPool.h"
+#include "constants.h"
+
+
+template <class T>
+static vector<T> ParseList(const char* szList)
+{
+	vector<T> values;
+
+	for (const char* p = szList; *p; )
+	{
+		const double value = atof(p);
+
+		if (value > 0) values.push_back((T)value);
+
+		p = strchr(p, ',');
+
+		if (!p) break;
+
+		++p;
+	}
+
+	return values;
+}
+
+static bool EndsWith(const string &s, const char* suffix)
+{
+	const size_t length = strlen(suffix);
+
+	return s.size() >= length && s.compare(s.size() - length, length, suffix) == 0;
+}
+
+static void PrintResult(const SSweepResult &result)
+{
+	const SSomConfig &config = result.config;
+
+	printf("%d,%d,%d,%g,%d,%s,%llu,%.6f,%.6f,%lld,%.3f\n",
+	       config.iCellsUp,
+	       config.iCellsAcross,
+	       config.iIterations,
+	       config.dStartLearningRate,
+	       config.iLevels,
+	       config.bBatch ? "batch" : "online",
+	       (unsigned long long)config.iSeed,
+	       result.dQuantizationError,
+	       result.dTopographicError,
+	       result.iIterationsSaved,
+	       result.dSeconds);
+
+	fflush(stdout);
+}
+
+//-------------------------------- main ----------------------------------
+//
+//------------------------------------------------------------------------
+int main(int argc, char* argv[])
+{
+	const char* path = NULL;
+
+	vector<int> sizes      = ParseList<int>("20,40");
+	vector<int> iterations(1, constNumIterations);
+	vector<double> rates   = ParseList<double>("0.05,0.1,0.2");
+	vector<int> levels     = ParseList<int>("1");
+
+	bool batch = false;
+
+	int threads = 0;
+
+	uint64_t seed = 1;
+
+	SomConvergence convergence = SOM_CONVERGE_NEVER;
+
+	int StopWindow = 0;
+
+	double StopThreshold = 0.001;
+
+	bool linear = false;
+
+	double LinearRadius = 0;
+
+	for (int i=1; i<argc; ++i)
+	{
+		const char* arg  = argv[i];
+		const char* next = i + 1 < argc ? argv[i + 1] : "";
+
+		if      (!strcmp(arg, "--sizes"))      { sizes      = ParseList<int>(next); ++i; }
+		else if (!strcmp(arg, "--iterations")) { iterations = ParseList<int>(next); ++i; }
+		else if (!strcmp(arg, "--rates"))      { rates      = ParseList<double>(next); ++i; }
+		else if (!strcmp(arg, "--levels"))     { levels     = ParseList<int>(next); ++i; }
+		else if (!strcmp(arg, "--batch"))      { batch      = true; }
+		else if (!strcmp(arg, "--threads"))    { threads    = atoi(next); ++i; }
+		else if (!strcmp(arg, "--seed"))       { seed       = strtoull(next, NULL, 10); ++i; }
+		else if (!strcmp(arg, "--stop-window")) { StopWindow = atoi(next); ++i; }
+		else if (!strcmp(arg, "--stop-threshold")) { StopThreshold = atof(next); ++i; }
+		else if (!strcmp(arg, "--stop-on-change")) { convergence = SOM_CONVERGE_WEIGHT_CHANGE; }
+		else if (!strcmp(arg, "--linear"))     { linear = true; }
+		else if (!strcmp(arg, "--start-radius")) { LinearRadius = atof(next); ++i; }
+		else if (arg[0] != '-' && !path)       { path       = arg; }
+		else
+		{
+			path = NULL;
+			break;
+		}
+	}
+
+	if (!path || sizes.empty() || iterations.empty() || rates.empty() || levels.empty())
+	{
+		fprintf(stderr, "usage: %s <data set or csv> [--sizes 20,40] [--iterations n,n] "
+		                "[--rates 0.1,0.2] [--levels 1,3] [--batch] [--threads n] [--seed n] "
+		                "[--stop-window n] [--stop-threshold x] [--stop-on-change] "
+		                "[--linear [--start-radius r]]\n", argv[0]);
+		return 1;
+	}
+
+	string DataPath = path;
+
+	if (EndsWith(DataPath, ".csv") || EndsWith(DataPath, ".CSV"))
+	{
+		DataPath += ".dat";
+
+		CThreadPool pool;
+
+		if (!CDataSet::ImportCsv(path, DataPath.c_str(), &pool))
+		{
+			fprintf(stderr, "couldn't convert %s to a data set\n", path);
+			return 1;
+		}
+	}
+
+	CDataSet data;
+
+	if (!data.Open(DataPath.c_str()) || data.GetNumVectors() == 0)
+	{
+		fprintf(stderr, "couldn't open %s as a data set\n", DataPath.c_str());
+		return 1;
+	}
+
+	CTaskScheduler scheduler(threads);
+
+	CSomSweep sweep(data, scheduler);
+
+	sweep.AddGrid(sizes, iterations, rates, levels, batch, seed);
+
+	sweep.SetLinearInit(linear, LinearRadius);
+
+	if (StopWindow > 0)
+	{
+		if (convergence == SOM_CONVERGE_NEVER) convergence = SOM_CONVERGE_QUANTIZATION_ERROR;
+
+		sweep.SetEarlyStopping(convergence, StopWindow, StopThreshold);
+	}
+
+	fprintf(stderr, "%d maps on %d threads, %llu vectors of %d values\n",
+	        sweep.GetNumConfigs(), scheduler.GetNumThreads(),
+	        (unsigned long long)data.GetNumVectors(), data.GetDim());
+
+	printf("rows,cols,iterations,rate,levels,mode,seed,qe,te,saved,seconds\n");
+
+	const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+	sweep.Run(PrintResult);
+
+	//what the maps took one after the other against what the sweep took
+	double serial = 0;
+
+	for (size_t r=0; r<sweep.GetResults().size(); ++r)
+	{
+		serial += sweep.GetResults()[r].dSeconds;
+	}
+
+	fprintf(stderr, "%.1f s of training in %.1f s\n",
+	        serial, chrono::duration<double>(chrono::steady_clock::now() - start).count());
+
+	return 0;
+}
@@ -68,7 +68,7 @@ LRESULT CALLBACK WindowProc (HWND   hwnd,
          cyClient = rect.bottom;
 
          //seed random number generator
-         srand((unsigned) time(NULL));
+         SeedRandom((uint64_t) time(NULL));
 
          
          //---------------create a surface to render to(backbuffer)
@@ -125,6 +125,13 @@ LRESULT CALLBACK WindowProc (HWND   hwnd,
           }
           
           break;
+
+          case 'S':
+          {
+            g_Controller->Save("som.map");
+          }
+
+          break;
         }
       }
 
@@ -1,10 +1,43 @@
 #include "ThnkrEegDecoder.h"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+_Static_assert((THNKR_QUEUE_CAPACITY & (THNKR_QUEUE_CAPACITY - 1)) == 0,
+               "THNKR_QUEUE_CAPACITY must be a power of two");
+
+_Static_assert((THNKR_RAW_RING_SIZE & (THNKR_RAW_RING_SIZE - 1)) == 0,
+               "THNKR_RAW_RING_SIZE must be a power of two");
+
+/* zeroed, so it is empty and drops the oldest record when full */
+Queue eegDataQueue;
+
+/* zeroed, so it is empty */
+ThnkrRawRing eegRawRing;
+
+int dev = 0;
+
+/* Where decoded records go besides the queue, see setThnkrEegSampleSink */
+static ThnkrEegSampleSink sampleSink = NULL;
+static void* sampleSinkData = NULL;
+static int sampleSinkCalls = 0;		/* records being handed to a sink right now */
+
 /* Declare private function prototypes */
 int parsePacketPayload(
-	ThnkrEegDecoder *pParser
+	ThnkrEegDecoder *pParser,
+	const unsigned char* payload,
+	unsigned char payloadLength
 );
 
+static void pushRawSample(
+	ThnkrRawRing* pRing,
+	int16_t value,
+	int64_t timestamp
+);
+
+static int64_t monotonicNanoseconds(void);
+
 int parseDataRow(
 	ThnkrEegDecoder* pParser,
 	unsigned char* rowPtr
@@ -49,6 +82,11 @@ int ThnkrEegDecoderInit(
     pParser->handleDataValue = handleDataValueFunc;
     pParser->customData = customData;
 
+    pParser->pRawRing = NULL;
+    pParser->rawClock = 0;
+
+    pParser->carryLength = 0;
+
     return 0;
 }
 
@@ -92,7 +130,8 @@ int ThnkrEegDecoderParse(
             } else {
                 pParser->payloadBytesReceived = 0;
                 pParser->payloadSum = 0;
-                pParser->state = THNKR_STATE_PAYLOAD;
+                /* An empty payload is followed by its checksum straight away */
+                pParser->state = pParser->payloadLength ? THNKR_STATE_PAYLOAD : THNKR_STATE_CHKSUM;
             }
             break;
 
@@ -115,7 +154,10 @@ int ThnkrEegDecoderParse(
                 returnValue = -2;
             } else {
                 returnValue = 1;
-                parsePacketPayload(pParser);
+
+                if(pParser->pRawRing) pParser->rawClock = monotonicNanoseconds();
+
+                parsePacketPayload(pParser, pParser->payload, pParser->payloadLength);
             }
             break;
 
@@ -171,8 +213,192 @@ int ThnkrEegDecoderParse(
 return 0;
 }
 
+/*
+ * Returns the first position in [p, end) where two SYNC bytes follow each
+ * other, 16 positions at a time where SSE2 is there. Without a pair it
+ * returns end - 1, or end if p == end, so a SYNC byte at the very end can
+ * still start a packet carried over to the next buffer.
+ */
+static const unsigned char* findSyncPair(
+	const unsigned char* p,
+	const unsigned char* end
+) {
+    if(p == end) return end;
+
+#if defined(__SSE2__)
+    {
+        const __m128i sync = _mm_set1_epi8((char)THNKR_SYNC_BYTE);
+
+        /* Each byte is compared together with the one after it, so 17 are needed */
+        while(end - p >= 17) {
+            __m128i first = _mm_loadu_si128((const __m128i*)p);
+            __m128i second = _mm_loadu_si128((const __m128i*)(p + 1));
+
+            int mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(first, sync),
+                                                       _mm_cmpeq_epi8(second, sync)));
+
+            if(mask) return p + __builtin_ctz(mask);
+
+            p += 16;
+        }
+    }
+#endif
+
+    while(end - p >= 2) {
+        const unsigned char* sync = (const unsigned char*)memchr(p, THNKR_SYNC_BYTE, (size_t)(end - p - 1));
+
+        if(!sync) return end - 1;
+
+        if(sync[1] == THNKR_SYNC_BYTE) return sync;
+
+        p = sync + 2;
+    }
+
+    return end - 1;
+}
+
+/*
+ * Parses the whole packets in [p, end) in place, skipping anything that
+ * isn't one. A SYNC SYNC pair that doesn't start a packet, with a length
+ * out of range or a checksum that doesn't match, is a SYNC byte in the
+ * middle of other data, and the search goes on from the byte after it, so
+ * no packet behind it is lost. Returns end once everything is used, or
+ * the start of a packet that runs past end.
+ */
+static const unsigned char* parseWholePackets(
+	ThnkrEegDecoder* pParser,
+	const unsigned char* p,
+	const unsigned char* end,
+	int* pPackets
+) {
+    while(p < end) {
+
+        /* Only SYNC SYNC can start a packet, jump to the next pair */
+        p = findSyncPair(p, end);
+
+        /* A last byte on its own may still be the first of a pair */
+        if(end - p < 3) {
+            return (end - p == 1 && *p != THNKR_SYNC_BYTE) ? end : p;
+        }
+
+        {
+            unsigned char payloadLength = p[2];
+            const unsigned char* payload = p + 3;
+            unsigned char sum = 0;
+            unsigned char i;
+
+            if(payloadLength >= MAX_PAYLOAD_SIZE) {
+                p++;
+                continue;
+            }
+
+            if(end - p < 4 + payloadLength) return p;
+
+            for(i = 0; i < payloadLength; i++) {
+                sum = (unsigned char)(sum + payload[i]);
+            }
+
+            if(payload[payloadLength] != ((~sum) & 0xFF)) {
+                p++;
+                continue;
+            }
+
+            parsePacketPayload(pParser, payload, payloadLength);
+            (*pPackets)++;
+
+            p += 4 + payloadLength;
+            pParser->lastByte = p[-1];
+        }
+    }
+
+    return p;
+}
+
+int ThnkrEegDecoderParseBuffer(
+	ThnkrEegDecoder* pParser,
+	const unsigned char* buffer,
+	size_t length
+) {
+    const unsigned char* p = buffer;
+    const unsigned char* end = buffer + length;
+    int packets = 0;
+
+    if(!pParser) return -1;
+
+    /* one clock read for every raw sample in the buffer */
+    if(pParser->pRawRing) pParser->rawClock = monotonicNanoseconds();
+
+    while(p < end) {
+
+        /* Whole packets are parsed in place between packets, anything else
+           goes through the state machine */
+        if(pParser->type == THNKR_TYPE_PACKETS && pParser->state == THNKR_STATE_SYNC) {
+
+            /* The packet cut off last time is finished first, with enough of
+               this buffer behind it to hold the longest packet starting
+               anywhere in the carried bytes */
+            if(pParser->carryLength) {
+                size_t carried = pParser->carryLength;
+                size_t taken = (size_t)(end - p);
+                const unsigned char* stop;
+
+                if(taken > THNKR_CARRY_SIZE - carried) taken = THNKR_CARRY_SIZE - carried;
+
+                memcpy(pParser->carry + carried, p, taken);
+
+                stop = parseWholePackets(pParser, pParser->carry, pParser->carry + carried + taken, &packets);
+
+                pParser->carryLength = 0;
+
+                /* Still cut off, so all of this buffer is in the carry */
+                if(stop < pParser->carry + carried) {
+                    pParser->carryLength = (size_t)(pParser->carry + carried + taken - stop);
+                    memmove(pParser->carry, stop, pParser->carryLength);
+                    break;
+                }
+
+                /* The search went past the carried bytes, it goes on in the buffer */
+                p += stop - (pParser->carry + carried);
+            }
+
+            p = parseWholePackets(pParser, p, end, &packets);
+
+            /* A packet cut off by the end of the buffer waits for the rest */
+            pParser->carryLength = (size_t)(end - p);
+            memcpy(pParser->carry, p, pParser->carryLength);
+            break;
+        }
+
+        if(ThnkrEegDecoderParse(pParser, *p++) == 1) packets++;
+    }
+
+    return packets;
+}
+
+ssize_t ThnkrEegDecoderRead(
+	ThnkrEegDecoder* pParser,
+	int fd
+) {
+    unsigned char buffer[THNKR_READ_BUFFER_SIZE];
+
+    ssize_t count = read(fd, buffer, sizeof(buffer));
+
+    if(count < 0) {
+        return (errno == EINTR || errno == EAGAIN) ? 0 : -1;
+    }
+
+    /* Nothing came, so there is nothing to parse */
+    if(count > 0) {
+        ThnkrEegDecoderParseBuffer(pParser, buffer, (size_t)count);
+    }
+
+    return count;
+}
+
 int parsePacketPayload(
-	ThnkrEegDecoder* pParser
+	ThnkrEegDecoder* pParser,
+	const unsigned char* payload,
+	unsigned char payloadLength
 ) {
 
     unsigned char i = 0;
@@ -181,31 +407,50 @@ int parsePacketPayload(
     unsigned char numBytes = 0;
 
     /* Parse all bytes from the payload[] */
-    while(i < pParser->payloadLength) {
+    while(i < payloadLength) {
+
+        /* Every DataRow starts over at the base CODE level */
+        extendedCodeLevel = 0;
 
         /* Parse possible EXtended CODE bytes */
-        while(pParser->payload[i] == THNKR_EXCODE_BYTE) {
+        while(i < payloadLength && payload[i] == THNKR_EXCODE_BYTE) {
             extendedCodeLevel++;
             i++;
         }
 
         /* Parse CODE */
-        code = pParser->payload[i++];
+        if(i >= payloadLength) break;
+
+        code = payload[i++];
 
         /* Parse value length */
         if(code >= THNKR_CODE_RAW_SIGNAL) {
-			numBytes = pParser->payload[i++];
+            if(i >= payloadLength) break;
+			numBytes = payload[i++];
         } else {
 			numBytes = 1;
 		}
 
+        /* A DataRow running past the end of the payload is corrupt, and
+           the payload may be parsed in place in the read buffer */
+        if(numBytes > payloadLength - i) break;
+
+        /* Raw samples go to the ring if there is one, a big-endian int16 */
+        if(code == THNKR_CODE_RAW_SIGNAL && extendedCodeLevel == 0 && numBytes == 2 && pParser->pRawRing) {
+            pushRawSample(
+				pParser->pRawRing,
+				(int16_t)((payload[i] << 8) | payload[i + 1]),
+				pParser->rawClock
+			);
+        }
+
         /* Call the callback function to handle the DataRow value */
-        if(pParser->handleDataValue) {
+        else if(pParser->handleDataValue) {
             pParser->handleDataValue(
 				extendedCodeLevel,
 				code,
 				numBytes,
-                pParser->payload + i,
+                payload + i,
 				pParser->customData
 			);
         }
@@ -256,6 +501,9 @@ void handleDataValueFunc(
 			 * These 3-byte unsigned integers are in big-endian format.
 			**/
 			
+				/* a short row is corrupt, and the value may sit at the end of the read buffer */
+				if(valueLength < 24) break;
+
 				eegItem.delta = (value[0] << 16) | (value[1] << 8) | value[2];
 				eegItem.theta = (value[3] << 16) | (value[4] << 8) | value[5];
 				eegItem.lAlpha = (value[6] << 16) | (value[7] << 8) | value[8];
@@ -265,7 +513,20 @@ void handleDataValueFunc(
 				eegItem.lGamma = (value[18] << 16) | (value[19] << 8) | value[20];
 				eegItem.mGamma = (value[21] << 16) | (value[22] << 8) | value[23];
 				
-				eegDataQueue.push(&eegDataQueue, eegItem);
+				queuePush(&eegDataQueue, &eegItem);
+
+				{
+					ThnkrEegSampleSink sink;
+
+					/* counted before the sink is looked at, see setThnkrEegSampleSink */
+					__atomic_add_fetch(&sampleSinkCalls, 1, __ATOMIC_SEQ_CST);
+
+					sink = __atomic_load_n(&sampleSink, __ATOMIC_SEQ_CST);
+
+					if(sink) sink(&eegItem, __atomic_load_n(&sampleSinkData, __ATOMIC_RELAXED));
+
+					__atomic_sub_fetch(&sampleSinkCalls, 1, __ATOMIC_RELEASE);
+				}
 			break;
 			
 			/* Other [CODE]s */
@@ -276,61 +537,136 @@ void handleDataValueFunc(
 	}
 }
 
+void setThnkrEegSampleSink(
+	ThnkrEegSampleSink sink,
+	void* customData
+) {
+	/* A record counted before the old sink was cleared may still be using
+	   it; one counted after sees no sink. Either way nothing uses the old
+	   sink or customData once the count drops to zero */
+	__atomic_store_n(&sampleSink, NULL, __ATOMIC_SEQ_CST);
+
+	while(__atomic_load_n(&sampleSinkCalls, __ATOMIC_ACQUIRE)) {
+		sched_yield();
+	}
+
+	/* the data is published before the function */
+	__atomic_store_n(&sampleSinkData, customData, __ATOMIC_RELAXED);
+	__atomic_store_n(&sampleSink, sink, __ATOMIC_RELEASE);
+}
+
+/* one record's JSON without the values */
+#define THNKR_JSON_TEMPLATE "{\"attention\":\"\",\"meditation\":\"\",\"delta\":\"\",\"theta\":\"\"," \
+                            "\"low_alpha\":\"\",\"high_alpha\":\"\",\"low_beta\":\"\",\"high_beta\":\"\"," \
+                            "\"low_gamma\":\"\",\"mid_gamma\":\"\"}"
+
+/* the template, ten values of up to ten digits and a comma */
+_Static_assert(sizeof(THNKR_JSON_TEMPLATE) - 1 + 10 * 10 + 1 <= THNKR_JSON_RECORD_SIZE,
+               "THNKR_JSON_RECORD_SIZE is too small for a record");
+
+/* copies a string literal to p and returns the end of it */
+#define APPEND_LITERAL(p, literal) \
+	(memcpy((p), (literal), sizeof(literal) - 1), (p) + sizeof(literal) - 1)
+
+/*
+ * Writes value in decimal to p and returns the end of it.
+ */
+static char* appendUnsigned(
+	char* p,
+	unsigned int value
+) {
+    char digits[10];
+    int count = 0;
+
+    do {
+        digits[count++] = (char)('0' + value % 10);
+        value /= 10;
+    } while(value);
+
+    while(count) *p++ = digits[--count];
+
+    return p;
+}
+
+/*
+ * Writes one record as a JSON object to p, at most THNKR_JSON_RECORD_SIZE
+ * - 1 bytes, and returns the end of it. The values are strings, as they
+ * always were for the clients of the node server.
+ */
+static char* appendRecord(
+	char* p,
+	const EegData* pItem
+) {
+    p = APPEND_LITERAL(p, "{\"attention\":\"");
+    p = appendUnsigned(p, pItem->attention);
+    p = APPEND_LITERAL(p, "\",\"meditation\":\"");
+    p = appendUnsigned(p, pItem->meditation);
+    p = APPEND_LITERAL(p, "\",\"delta\":\"");
+    p = appendUnsigned(p, pItem->delta);
+    p = APPEND_LITERAL(p, "\",\"theta\":\"");
+    p = appendUnsigned(p, pItem->theta);
+    p = APPEND_LITERAL(p, "\",\"low_alpha\":\"");
+    p = appendUnsigned(p, pItem->lAlpha);
+    p = APPEND_LITERAL(p, "\",\"high_alpha\":\"");
+    p = appendUnsigned(p, pItem->hAlpha);
+    p = APPEND_LITERAL(p, "\",\"low_beta\":\"");
+    p = appendUnsigned(p, pItem->lBeta);
+    p = APPEND_LITERAL(p, "\",\"high_beta\":\"");
+    p = appendUnsigned(p, pItem->hBeta);
+    p = APPEND_LITERAL(p, "\",\"low_gamma\":\"");
+    p = appendUnsigned(p, pItem->lGamma);
+    p = APPEND_LITERAL(p, "\",\"mid_gamma\":\"");
+    p = appendUnsigned(p, pItem->mGamma);
+    p = APPEND_LITERAL(p, "\"}");
+
+    return p;
+}
+
 char* getThnkrDataJSON() {
-	
-	if(eegDataQueue.size == 0) return ""; 
-	
-	EegData eegItem = eegDataQueue.pop(&eegDataQueue);
-	
-	// {"attention":"","meditation":"","delta":"","theta":"","low_alpha":"","high_alpha":"","low_beta":"","high_beta":"","low_gamma":"","mid_gamma":""}
-	char num[25];
-	char* buf = (char*)malloc(255 * sizeof(char));
-	
-	strncpy(buf, "{\"attention\":\"", 14);
-	snprintf(num, 25, "%d", eegItem.attention);
-	strncat(buf, num, strlen(num));
-	
-	strncat(buf, "\",\"meditation\":\"", 16);
-	snprintf(num, 25, "%d", eegItem.attention);
-	strncat(buf, num, strlen(num));
-	
-	strncat(buf, "\",\"delta\":\"", 11);
-	snprintf(num, 25, "%d", eegItem.delta);
-	strncat(buf, num, strlen(num));
-	
-	strncat(buf, "\",\"theta\":\"", 11);
-	snprintf(num, 25, "%d", eegItem.theta);
-	strncat(buf, num, strlen(num));
-	
-	strncat(buf, "\",\"low_alpha\":\"", 15);
-	snprintf(num, 25, "%d", eegItem.lAlpha);
-	strncat(buf, num, strlen(num));
-	
-	strncat(buf, "\",\"high_alpha\":\"", 16);
-	snprintf(num, 25, "%d", eegItem.hAlpha);
-	strncat(buf, num, strlen(num));
-	
-	strncat(buf, "\",\"low_beta\":\"", 14);
-	snprintf(num, 25, "%d", eegItem.lBeta);
-	strncat(buf, num, strlen(num));
-	
-	strncat(buf, "\",\"high_beta\":\"", 15);
-	snprintf(num, 25, "%d", eegItem.hBeta);
-	strncat(buf, num, strlen(num));
-	
-	strncat(buf, "\",\"low_gamma\":\"", 15);
-	snprintf(num, 25, "%d", eegItem.lGamma);
-	strncat(buf, num, strlen(num));
-	
-	strncat(buf, "\",\"mid_gamma\":\"", 15);
-	snprintf(num, 25, "%d", eegItem.mGamma);
-	strncat(buf, num, strlen(num));
-	
-	strncat(buf, "\"}\0", 3);
-	
+
+	/* handed back to the caller, so it can't live on the stack */
+	static char buf[THNKR_JSON_RECORD_SIZE];
+
+	EegData eegItem;
+
+	if(!queuePop(&eegDataQueue, &eegItem)) return "";
+
+	*appendRecord(buf, &eegItem) = '\0';
+
 	return buf;
 }
 
+size_t getThnkrDataJSONArray(
+	char* buffer,
+	size_t size
+) {
+	if(buffer == NULL || size < 3) {
+		if(buffer != NULL && size > 0) buffer[0] = '\0';
+		return 0;
+	}
+
+	char* p = buffer;
+
+	/* room for the closing bracket and the terminating NUL */
+	char* end = buffer + size - 2;
+
+	*p++ = '[';
+
+	EegData eegItem;
+
+	/* a record is only taken off the queue once it is sure to fit */
+	while(end - p >= THNKR_JSON_RECORD_SIZE && queuePop(&eegDataQueue, &eegItem)) {
+		if(p != buffer + 1) *p++ = ',';
+
+		p = appendRecord(p, &eegItem);
+	}
+
+	*p++ = ']';
+	*p = '\0';
+
+	return (size_t)(p - buffer);
+}
+
 int setInterfaceAttributes(
 	int fd,
 	int speed,
@@ -351,8 +687,8 @@ int setInterfaceAttributes(
 	tty.c_lflag = 0;                // no signaling chars, no echo,
 									// no canonical processing
 	tty.c_oflag = 0;                // no remapping, no delays
-	tty.c_cc[VMIN]  = 0;            // read doesn't block
-	tty.c_cc[VTIME] = 5;            // 0.5 seconds read timeout
+	tty.c_cc[VMIN]  = 255;          // a read waits for a block of bytes,
+	tty.c_cc[VTIME] = 1;            // or for a 0.1 second gap once some came
 
 	tty.c_iflag &= ~(IXON | IXOFF | IXANY); // shut off xon/xoff ctrl
 
@@ -370,8 +706,6 @@ int setInterfaceAttributes(
 
 void* initialize(void* args) {
 
-	eegDataQueue = createQueue();
-	
 	char conBuf;
 	
 	dev = open(PORT_NAME, O_RDWR | O_NOCTTY | O_SYNC);
@@ -387,12 +721,13 @@ void* initialize(void* args) {
 	
 	ThnkrEegDecoder parser;
 	ThnkrEegDecoderInit(&parser, THNKR_TYPE_PACKETS, handleDataValueFunc, NULL);
+	ThnkrEegDecoderSetRawRing(&parser, &eegRawRing);
 	
-	size_t bufSize  = 1 * sizeof(char);
-	unsigned char buf = 0;
 	while(1) {
-		read(dev, &buf, bufSize);
-		ThnkrEegDecoderParse(&parser, buf);
+		if(ThnkrEegDecoderRead(&parser, dev) < 0) {
+			/* the port is gone, don't spin on it */
+			sleep(1);
+		}
 	}
 }
 
@@ -410,54 +745,208 @@ void libmain() {
 	if(err != 0) printf("\ncan't create thread :[%s]", strerror(err));
 }
 
-void push(
+/*
+ * Copies a record into or out of the queue a word at a time with relaxed
+ * atomics, as a record being popped may be written over by a producer
+ * dropping the oldest one. See queuePop.
+ */
+static void copyRecord(
+	EegData* pTo,
+	const EegData* pFrom
+) {
+    unsigned int* to = (unsigned int*)pTo;
+    const unsigned int* from = (const unsigned int*)pFrom;
+    size_t i;
+
+    for(i = 0; i < sizeof(EegData) / sizeof(unsigned int); i++) {
+        __atomic_store_n(&to[i], __atomic_load_n(&from[i], __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+    }
+}
+
+void queueInit(
 	Queue* queue,
-	EegData item
+	unsigned char overflow
 ) {
-	if(queue->size > MAX_QUEUE_SIZE) {
-		queue->pop(queue);
-	}
-	
-    Node* n = (Node*)malloc(sizeof(Node));
-    n->item = item;
-    n->next = NULL;
-
-    if (queue->head == NULL) { // no head
-        queue->head = n;
-    } else{
-        queue->tail->next = n;
+	memset(queue, 0, sizeof(*queue));
+	queue->overflow = overflow;
+}
+
+int queuePush(
+	Queue* queue,
+	const EegData* pItem
+) {
+    unsigned int tail = __atomic_load_n(&queue->tail, __ATOMIC_RELAXED);
+    unsigned int head = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+
+    while(tail - head >= THNKR_QUEUE_CAPACITY) {
+
+        switch(__atomic_load_n(&queue->overflow, __ATOMIC_RELAXED)) {
+
+            case THNKR_OVERFLOW_DROP_NEWEST:
+                __atomic_fetch_add(&queue->dropped, 1, __ATOMIC_RELAXED);
+                return 0;
+
+            case THNKR_OVERFLOW_BLOCK:
+                usleep(1000);
+                head = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+            break;
+
+            default:
+                /* take the oldest record from under the consumer. If it
+                   pops one first the exchange fails, and there is room */
+                if(__atomic_compare_exchange_n(&queue->head, &head, head + 1, 0,
+                                               __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                    __atomic_fetch_add(&queue->dropped, 1, __ATOMIC_RELAXED);
+                    head++;
+
+                    /* a consumer that sees any of the record written below
+                       sees head moved too */
+                    __atomic_thread_fence(__ATOMIC_RELEASE);
+                }
+            break;
+        }
     }
-    queue->tail = n;
-    queue->size++;
+
+    copyRecord(&queue->items[tail & (THNKR_QUEUE_CAPACITY - 1)], pItem);
+
+    /* the record is written before the consumer can see it */
+    __atomic_store_n(&queue->tail, tail + 1, __ATOMIC_RELEASE);
+
+    return 1;
 }
 
-EegData pop(
-	Queue* queue
+int queuePop(
+	Queue* queue,
+	EegData* pItem
 ) {
-    Node* head = queue->head;
-    EegData item = head->item;
-    queue->head = head->next;
-    queue->size--;
-    free(head);
-	
-    return item;
+    unsigned int head = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+
+    /* with THNKR_OVERFLOW_DROP_OLDEST the producer may drop the record
+       while it is being copied, and write the next one over it. The
+       exchange fails then, and the copy is thrown away */
+    do {
+        if(head == __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE)) return 0;
+
+        copyRecord(pItem, &queue->items[head & (THNKR_QUEUE_CAPACITY - 1)]);
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    } while(!__atomic_compare_exchange_n(&queue->head, &head, head + 1, 0,
+                                         __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+
+    return 1;
 }
 
-EegData peek(
+unsigned int queueSize(
 	Queue* queue
 ) {
-    Node* head = queue->head;
-    return head->item;
+    unsigned int head = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+
+    return __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE) - head;
 }
 
-Queue createQueue() {
-    Queue queue;
-    queue.size = 0;
-    queue.head = NULL;
-    queue.tail = NULL;
-    queue.push = &push;
-    queue.pop = &pop;
-    queue.peek = &peek;
-	
-    return queue;
+void setThnkrEegQueueOverflow(
+	unsigned char overflow
+) {
+	__atomic_store_n(&eegDataQueue.overflow, overflow, __ATOMIC_RELAXED);
+}
+
+void ThnkrEegDecoderSetRawRing(
+	ThnkrEegDecoder* pParser,
+	ThnkrRawRing* pRing
+) {
+	pParser->pRawRing = pRing;
+}
+
+static int64_t monotonicNanoseconds(void) {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/*
+ * Stores sample number count in both of its slots. writing is moved on
+ * first, so a reader that sees any of the new values also sees that the
+ * sample in those slots before is gone, see ThnkrRawViewValid.
+ */
+static void pushRawSample(
+	ThnkrRawRing* pRing,
+	int16_t value,
+	int64_t timestamp
+) {
+    uint64_t count = __atomic_load_n(&pRing->count, __ATOMIC_RELAXED);
+    size_t slot = (size_t)(count & (THNKR_RAW_RING_SIZE - 1));
+
+    __atomic_store_n(&pRing->writing, count + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    pRing->samples[slot] = value;
+    pRing->samples[slot + THNKR_RAW_RING_SIZE] = value;
+    pRing->timestamps[slot] = timestamp;
+    pRing->timestamps[slot + THNKR_RAW_RING_SIZE] = timestamp;
+
+    /* the sample is stored before readers can see it */
+    __atomic_store_n(&pRing->count, count + 1, __ATOMIC_RELEASE);
+}
+
+void ThnkrRawRingInit(
+	ThnkrRawRing* pRing
+) {
+	memset(pRing, 0, sizeof(*pRing));
+}
+
+uint64_t ThnkrRawRingCount(
+	const ThnkrRawRing* pRing
+) {
+	return __atomic_load_n(&pRing->count, __ATOMIC_ACQUIRE);
+}
+
+size_t ThnkrRawRingView(
+	const ThnkrRawRing* pRing,
+	uint64_t first,
+	size_t length,
+	ThnkrRawView* pView
+) {
+    uint64_t count = __atomic_load_n(&pRing->count, __ATOMIC_ACQUIRE);
+
+    /* the slots of the oldest sample are the next to be written */
+    uint64_t oldest = count >= THNKR_RAW_RING_SIZE ? count - (THNKR_RAW_RING_SIZE - 1) : 0;
+
+    uint64_t last = first + length < first ? UINT64_MAX : first + length;
+
+    if(first < oldest) first = oldest;
+    if(last > count) last = count;
+    if(last < first) last = first;
+
+    size_t slot = (size_t)(first & (THNKR_RAW_RING_SIZE - 1));
+
+    pView->samples = pRing->samples + slot;
+    pView->timestamps = pRing->timestamps + slot;
+    pView->first = first;
+    pView->length = (size_t)(last - first);
+
+    return pView->length;
+}
+
+size_t ThnkrRawRingLatest(
+	const ThnkrRawRing* pRing,
+	size_t length,
+	ThnkrRawView* pView
+) {
+    uint64_t count = __atomic_load_n(&pRing->count, __ATOMIC_ACQUIRE);
+
+    return ThnkrRawRingView(pRing, length < count ? count - length : 0, length, pView);
+}
+
+int ThnkrRawViewValid(
+	const ThnkrRawRing* pRing,
+	const ThnkrRawView* pView
+) {
+    /* pairs with the fence in pushRawSample: if the samples read were
+       already being written over, writing shows it */
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    return __atomic_load_n(&pRing->writing, __ATOMIC_RELAXED) - pView->first <= THNKR_RAW_RING_SIZE;
 }
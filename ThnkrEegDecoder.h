@@ -10,7 +10,10 @@
 #include <termios.h>
 #include <unistd.h>
 #include <string.h>
+#include <stdint.h>
+#include <time.h>
 #include <pthread.h>
+#include <sched.h>
 #include <sys/stat.h>
 #include <sys/fcntl.h>
 
@@ -21,9 +24,20 @@ extern "C" {
 /* name of the USB Port to connect to */
 #define PORT_NAME "/dev/ttyUSB0"
 #define MAX_PAYLOAD_SIZE 170
-#define MAX_QUEUE_SIZE 10
 #define BAUD_RATE B115200
 
+/* records the EegData queue holds, a power of two */
+#define THNKR_QUEUE_CAPACITY 64
+
+/* so the two ends of the queue don't share a cache line */
+#define THNKR_CACHE_LINE 64
+
+/* bytes ThnkrEegDecoderRead asks the port for at a time */
+#define THNKR_READ_BUFFER_SIZE 4096
+
+/* room for two of the longest packets, SYNC SYNC PLENGTH PAYLOAD... CHKSUM */
+#define THNKR_CARRY_SIZE (2 * (MAX_PAYLOAD_SIZE + 3))
+
 /* Parser types */
 #define THNKR_TYPE_NULL       0x00
 #define THNKR_TYPE_PACKETS    0x01    /* Stream bytes as ThinkGear Packets */
@@ -89,60 +103,192 @@ typedef struct EegData {
 	unsigned int mGamma;
 } EegData;
 
-/**
- * The Node struct,
- * contains item and the pointer that point to next node.
- */
-typedef struct Node {
-    struct EegData item;
-    struct Node* next;
-} Node;
+/* What queuePush() does when the queue is full */
+#define THNKR_OVERFLOW_DROP_OLDEST 0x00  /* make room by dropping the oldest record */
+#define THNKR_OVERFLOW_DROP_NEWEST 0x01  /* drop the record being pushed */
+#define THNKR_OVERFLOW_BLOCK       0x02  /* wait for the consumer to make room */
 
 /**
- * The Queue struct, contains the pointers that
- * point to first node and last node, the size of the Queue,
- * and the function pointers.
+ * A fixed size ring of EegData records between one producer thread, the
+ * decoder's, and one consumer thread. Nothing is allocated, and the two
+ * ends are handed over with acquire/release atomics rather than a lock.
+ *
+ * head and tail count records popped and pushed since the start and only
+ * ever grow; they sit on cache lines of their own so the producer and the
+ * consumer don't keep taking the line from each other. A zeroed Queue is
+ * empty and drops the oldest record when full.
  */
 typedef struct Queue {
-    Node* head;
-    Node* tail;
+    EegData items[THNKR_QUEUE_CAPACITY];
+
+    unsigned char overflow;  /* one of the THNKR_OVERFLOW_* constants */
+
+    /* records pushed so far, written by the producer only */
+    unsigned int tail __attribute__ ((aligned (THNKR_CACHE_LINE)));
 
-    void (*push) (struct Queue*, EegData); // add item to tail
-    // get item from head and remove it from queue
-    EegData (*pop) (struct Queue*);
-    // get item from head but keep it in queue
-    EegData (*peek) (struct Queue*);
+    /* records popped so far, written by the consumer, and by the
+       producer when it drops the oldest record */
+    unsigned int head __attribute__ ((aligned (THNKR_CACHE_LINE)));
 
-    // size of this queue
-    int size;
+    /* records lost to a full queue */
+    unsigned int dropped __attribute__ ((aligned (THNKR_CACHE_LINE)));
 } Queue;
 
 /**
- * Push an item into queue, if this is the first item,
- * both queue->head and queue->tail will point to it,
- * otherwise the oldtail->next and tail will point to it.
+ * Empties @c queue and sets what it does when full.
+ *
+ * @param overflow One of the THNKR_OVERFLOW_* constants.
+ */
+void queueInit(Queue* queue, unsigned char overflow);
+
+/**
+ * Adds a copy of @c pItem at the tail. Producer side, call it from one
+ * thread only. With THNKR_OVERFLOW_BLOCK it waits for room, polling every
+ * millisecond, so bytes from the headset back up behind a slow consumer.
+ *
+ * @return 1 if the record was queued, 0 if it was dropped.
  */
-void push(Queue* queue, EegData item);
+int queuePush(Queue* queue, const EegData* pItem);
 
 /**
- * Return and remove the first item.
+ * Copies the record at the head to @c pItem and removes it. Consumer
+ * side, call it from one thread only.
+ *
+ * @return 1 if there was a record, 0 if the queue is empty.
  */
-EegData pop(Queue* queue);
+int queuePop(Queue* queue, EegData* pItem);
 
 /**
- * Return but not remove the first item.
+ * How many records are waiting, a snapshot that may be stale by the
+ * time it is looked at.
  */
-EegData peek(Queue* queue);
+unsigned int queueSize(Queue* queue);
 
-/** 
-* Initializing the Queue
+/**
+* Global queue to hold our data
 */
-Queue createQueue();
+extern Queue eegDataQueue;
 
 /**
-* Global queue to hold our data
+* Sets what happens to decoded records when nobody collects them fast
+* enough, THNKR_OVERFLOW_DROP_OLDEST by default.
+*/
+void setThnkrEegQueueOverflow(unsigned char overflow);
+
+/* raw samples a ThnkrRawRing holds, a power of two: two minutes at 512 Hz */
+#define THNKR_RAW_RING_SIZE 65536
+
+/**
+ * The raw EEG signal of one headset, the 16 bit samples of its
+ * THNKR_CODE_RAW_SIGNAL rows, kept in a ring the decoder writes straight
+ * into, with no callback and nothing allocated per sample.
+ *
+ * Samples are numbered from 0 in the order they arrive, and sample n sits
+ * in slot n % THNKR_RAW_RING_SIZE. Every sample is stored twice, in its
+ * slot and THNKR_RAW_RING_SIZE slots further on, so any run of samples
+ * still in the ring is contiguous in memory and can be looked at in place
+ * through a ThnkrRawView. With it goes the CLOCK_MONOTONIC time, in
+ * nanoseconds, at which the decoder was handed the bytes carrying it;
+ * those come in blocks, so neighbouring samples often share a time.
+ *
+ * One decoder writes to a ring, any number of threads may read it. A
+ * zeroed ring is empty. It is large, so make it static or allocate it.
+ */
+typedef struct ThnkrRawRing {
+    int16_t samples[2 * THNKR_RAW_RING_SIZE];
+    int64_t timestamps[2 * THNKR_RAW_RING_SIZE];
+
+    /* samples being written, one ahead of count while a sample is stored */
+    uint64_t writing __attribute__ ((aligned (THNKR_CACHE_LINE)));
+
+    /* samples written so far, the number of the next one */
+    uint64_t count;
+} ThnkrRawRing;
+
+/**
+ * A window of consecutive samples of a ThnkrRawRing, pointing into it.
+ * The ring goes on to write over them once THNKR_RAW_RING_SIZE newer
+ * samples have come in, so check ThnkrRawViewValid() after using them.
+ */
+typedef struct ThnkrRawView {
+    const int16_t* samples;
+    const int64_t* timestamps;
+    uint64_t first;          /* number of samples[0] */
+    size_t length;
+} ThnkrRawView;
+
+/**
+ * Empties @c pRing. Not while a decoder is writing to it.
+ */
+void ThnkrRawRingInit(ThnkrRawRing* pRing);
+
+/**
+ * How many samples have been written to @c pRing so far, the number the
+ * next one will get.
+ */
+uint64_t ThnkrRawRingCount(const ThnkrRawRing* pRing);
+
+/**
+ * Sets @c pView to up to @c length samples from number @c first on, as
+ * far as they are in the ring: samples older than the THNKR_RAW_RING_SIZE
+ * - 1 newest are gone, and those not written yet are cut off.
+ *
+ * @return the number of samples in the view.
+ */
+size_t ThnkrRawRingView(
+	const ThnkrRawRing* pRing,
+	uint64_t first,
+	size_t length,
+	ThnkrRawView* pView
+);
+
+/**
+ * Sets @c pView to the newest @c length samples, or as many as there are.
+ *
+ * @return the number of samples in the view.
+ */
+size_t ThnkrRawRingLatest(
+	const ThnkrRawRing* pRing,
+	size_t length,
+	ThnkrRawView* pView
+);
+
+/**
+ * Whether none of the samples in @c pView has been written over yet. Call
+ * it after reading them, as with a seqlock, and drop what was read if it
+ * returns 0.
+ */
+int ThnkrRawViewValid(
+	const ThnkrRawRing* pRing,
+	const ThnkrRawView* pView
+);
+
+/**
+* Global ring holding the raw signal of the headset on PORT_NAME
+*/
+extern ThnkrRawRing eegRawRing;
+
+/**
+* Callback handed every complete EegData record as soon as it is decoded,
+* on the decoder's reading thread. It must return quickly and must not
+* block, or bytes from the headset back up behind it.
 */
-Queue eegDataQueue;
+typedef void (*ThnkrEegSampleSink)(
+	const EegData* pSample,
+	void* customData
+);
+
+/**
+* Registers @c sink to receive every decoded EegData record from now on,
+* alongside the JSON queue. Pass NULL to stop. Returns once a record
+* already being handed to the previous sink has been dealt with, so after
+* setThnkrEegSampleSink(NULL, NULL) its customData can be freed. Must not
+* be called from inside a sink.
+*/
+void setThnkrEegSampleSink(
+	ThnkrEegSampleSink sink,
+	void* customData
+);
 
 /**
  * The Parser is a state machine that manages the parsing state.
@@ -169,10 +315,20 @@ typedef struct ThnkrEegDecoder {
     
 	void* customData;
 
+    /* where THNKR_CODE_RAW_SIGNAL rows go instead of handleDataValue(),
+       if anywhere, and the time stamped on them */
+    ThnkrRawRing* pRawRing;
+    int64_t rawClock;
+
+    /* the start of a packet cut off by the end of the last buffer given to
+       ThnkrEegDecoderParseBuffer(), parsed together with the next one */
+    unsigned char carry[THNKR_CARRY_SIZE];
+    size_t carryLength;
+
 } ThnkrEegDecoder;
 
 /* GLOBAL our device TTY */
-int dev = 0;
+extern int dev;
 
 /**
  * @param parser              Pointer to a ThnkrEegDecoder object.
@@ -203,6 +359,17 @@ int ThnkrEegDecoderInit(
     void* customData
 );
 
+/**
+ * Has the 16 bit samples of THNKR_CODE_RAW_SIGNAL rows written to
+ * @c pRing rather than passed to the handleDataValue() callback, the way
+ * to keep up with 512 samples a second. Pass NULL to send them to the
+ * callback again. Give each headset's decoder a ring of its own.
+ */
+void ThnkrEegDecoderSetRawRing(
+	ThnkrEegDecoder* pParser,
+	ThnkrRawRing* pRing
+);
+
 /**
  * Feeds the @c byte into the @c parser.  If the @c byte completes a
  * complete, valid parser, then the @c parser's handleDataValue()
@@ -227,6 +394,56 @@ int ThnkrEegDecoderParse(
 	unsigned char byte
 );
 
+/**
+ * Feeds @c length bytes of the data stream to the @c parser at once.
+ * Packets may start and end anywhere. One cut off at the end of the
+ * buffer is kept by the parser and parsed again with the next call, so
+ * the packets that come out don't depend on how the stream was split
+ * into buffers.
+ *
+ * Whenever the parser is between packets it scans ahead, 16 bytes at a
+ * time with SSE2, for the next two SYNC bytes in a row. If a whole packet
+ * follows them in the buffer it is checked and handed to the
+ * handleDataValue() callback straight from the buffer, without going
+ * through the byte by byte state machine. If the length is out of range
+ * or the checksum doesn't match, the pair was noise or data and the scan
+ * goes on from the next byte, where ThnkrEegDecoderParse() would throw
+ * away everything up to the bad checksum, and with it any packet that
+ * started in there. Clean streams come out the same either way. Bytes
+ * kept back from the last buffer aren't seen by ThnkrEegDecoderParse(),
+ * so stick to one of the two for a stream.
+ *
+ * @param parser Pointer to an initialized ThnkrEegDecoder object.
+ * @param buffer The next bytes of the data stream.
+ * @param length How many there are.
+ *
+ * @return -1 if @c parser is NULL.
+ * @return the number of Packets received and parsed successfully otherwise.
+ */
+int ThnkrEegDecoderParseBuffer(
+	ThnkrEegDecoder* pParser,
+	const unsigned char* buffer,
+	size_t length
+);
+
+/**
+ * Reads whatever @c fd has to offer, up to THNKR_READ_BUFFER_SIZE bytes,
+ * with a single read() and feeds it to ThnkrEegDecoderParseBuffer(). Fits
+ * a poll() or select() loop serving several headsets from one thread; open
+ * the ports O_NONBLOCK for that, as setInterfaceAttributes() has a blocking
+ * read wait for a block of bytes.
+ *
+ * @return the number of bytes read. On a blocking port the read waits for
+ *         the first byte however long that takes, so it never times out.
+ * @return 0 if the read was interrupted or a nonblocking port had nothing
+ *         (EINTR, EAGAIN), or at end of file.
+ * @return -1 if the read failed, with errno set.
+ */
+ssize_t ThnkrEegDecoderRead(
+	ThnkrEegDecoder* pParser,
+	int fd
+);
+
 /**
 * Function which acts on the value[] bytes of each ThinkGear DataRow as it is received.
 */
@@ -265,11 +482,38 @@ void* initialize(void* args);
 void disconnectAndClose();
 
 
+/* the most bytes one record takes in JSON, with the comma before it */
+#define THNKR_JSON_RECORD_SIZE 256
+
+/* enough for getThnkrDataJSONArray() to drain a full queue */
+#define THNKR_JSON_BUFFER_SIZE (THNKR_JSON_RECORD_SIZE * THNKR_QUEUE_CAPACITY + 3)
+
 /**
-* EXPORTED function that gets data from the buffer
+* EXPORTED function that takes the oldest record off the queue and returns
+* it as a JSON object, or "" if there is none. The string lives in a
+* static buffer that the next call writes over.
 **/
 extern char* getThnkrDataJSON();
 
+/**
+* EXPORTED function that takes every queued record off the queue, as many
+* as fit, and writes them to @c buffer as one JSON array of the objects
+* getThnkrDataJSON() returns, oldest first and NUL terminated. Records that
+* don't fit stay queued for the next call; THNKR_JSON_BUFFER_SIZE bytes
+* always take them all. Nothing is allocated. Consumer side of the queue,
+* like getThnkrDataJSON(), so call them from one thread only.
+*
+* @param buffer Where the array goes.
+* @param size   Its size in bytes.
+*
+* @return the number of bytes written, not counting the NUL; "[]", 2, if
+*         nothing was queued, and 0 if @c size is below 3.
+**/
+extern size_t getThnkrDataJSONArray(
+	char* buffer,
+	size_t size
+);
+
 
 #ifdef __cplusplus
 }  /* extern "C" */
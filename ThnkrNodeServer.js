@@ -1,6 +1,6 @@
 function runServer() {
 	var http = require('http');
-	jxcore.store.shared.set("jsonData", "{\"attention\":\"0\",\"meditation\":\"0\",\"delta\":\"0\",\"theta\":\"0\",\"low_alpha\":\"0\",\"high_alpha\":\"0\",\"low_beta\":\"0\",\"high_beta\":\"0\",\"low_gamma\":\"0\",\"mid_gamma\":\"0\"}");
+	jxcore.store.shared.set("jsonData", "[{\"attention\":\"0\",\"meditation\":\"0\",\"delta\":\"0\",\"theta\":\"0\",\"low_alpha\":\"0\",\"high_alpha\":\"0\",\"low_beta\":\"0\",\"high_beta\":\"0\",\"low_gamma\":\"0\",\"mid_gamma\":\"0\"}]");
 	
 	http.createServer(function(req, res) {
 
@@ -18,18 +18,20 @@ function runServer() {
 
 function getData() {
 	var ffi = require("node-ffi");
-	var lib = ffi.Library("libThnkrEegDecoder", { "getThnkrDataJSON": [ 'string', [ ] ] });
-	var json = "";
-	
-	while(1) {
-		setTimeout(function(){}, 700);
-		json = lib.getThnkrDataJSON();
-		
-		if(json != "") {
-			jxcore.store.shared.set("jsonData", json);
-			json = "";
+	var lib = ffi.Library("libThnkrEegDecoder", { "getThnkrDataJSONArray": [ 'size_t', [ 'char *', 'size_t' ] ] });
+
+	// THNKR_JSON_BUFFER_SIZE, room for a full queue. Allocated once and
+	// filled in place by every call, so nothing is left for anyone to free
+	var buffer = new Buffer(256 * 64 + 3);
+
+	setInterval(function() {
+		// every record queued since the last call, as one JSON array
+		var length = lib.getThnkrDataJSONArray(buffer, buffer.length);
+
+		if(length > 2) {
+			jxcore.store.shared.set("jsonData", buffer.toString('utf8', 0, length));
 		}
-	}
+	}, 700);
 }
 
 jxcore.tasks.runOnThread(0, runServer);